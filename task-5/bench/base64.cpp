@@ -0,0 +1,67 @@
+// Throughput of the base64 decoder against the scalar table decoder.
+//
+// usage: bench_base64 [iterations]
+
+#include "http/base64.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string random_base64(size_t len, std::mt19937 &random) {
+  std::string str(len, 'A');
+  for (auto &c : str)
+    c = ALPHABET[random() % 64];
+  return str;
+}
+
+// Nanoseconds per decode of str.
+template <typename Decoder>
+static double measure(Decoder decode, const std::string &str, uint8_t *out, size_t iterations) {
+  volatile ssize_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    sink = sink + decode(str.data(), str.size(), out);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+  if (!iterations) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  // typical Basic credentials up to large bearer style tokens
+  const size_t lengths[] = {24, 64, 256, 1024, 4096};
+
+  std::mt19937 random(42);
+  printf("%8s %14s %14s %14s %14s %8s\n", "chars", "scalar ns", "scalar MB/s", "decode ns",
+         "decode MB/s", "speedup");
+  for (size_t len : lengths) {
+    std::string str = random_base64(len, random);
+    std::vector<uint8_t> out(Base64::decoded_size(len));
+
+    // also a sanity check, both decoders have to agree
+    std::vector<uint8_t> expected(out.size());
+    if (Base64::decode_scalar(str.data(), len, expected.data()) !=
+            Base64::decode(str.data(), len, out.data()) ||
+        out != expected) {
+      fprintf(stderr, "decoders disagree for %zu characters\n", len);
+      return 1;
+    }
+
+    size_t n = iterations * 64 / len + 1;
+    double scalar = measure(Base64::decode_scalar, str, out.data(), n);
+    double simd = measure(Base64::decode, str, out.data(), n);
+    printf("%8zu %14.1f %14.1f %14.1f %14.1f %7.2fx\n", len, scalar, len * 1e3 / scalar, simd,
+           len * 1e3 / simd, scalar / simd);
+  }
+  return 0;
+}
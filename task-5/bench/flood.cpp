@@ -0,0 +1,41 @@
+// Cost per request of the flood detector, for requests from a few sources and from many, none of
+// them above the threshold. A request arrives every microsecond, so the one second window rolls
+// over every million requests, or with every request for the cost of starting a window.
+//
+// usage: bench_flood [--filter <substring>] [--min-time <seconds>] [--repetitions <n>]
+//                    [--json <file>]
+
+#include "harness.h"
+
+#include "flood.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h> // htonl
+
+static constexpr size_t REQUESTS = 1 << 12;
+
+static void add_check(Bench::Suite &suite, size_t sources, uint64_t window, const char *label) {
+  auto ring = std::make_shared<std::vector<uint32_t>>(REQUESTS);
+  for (size_t n = 0; n < REQUESTS; n++)
+    (*ring)[n] = htonl(0x0a000000 + (uint32_t)(n * 2654435761u % sources));
+  const uint32_t thresholds[Flood::Detector::KINDS] = {UINT32_MAX, UINT32_MAX};
+  auto detector = std::make_shared<Flood::Detector>(window, thresholds, 0);
+  auto now = std::make_shared<uint64_t>(0);
+  suite.add(std::string("detector/check/") + label, [ring, detector, now](size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+      *now += 1000;
+      Bench::keep(detector->check(Flood::Detector::ECHO_REQUEST, (*ring)[i % REQUESTS], *now));
+    }
+  });
+}
+
+int main(int argc, char *argv[]) {
+  Bench::Suite suite;
+  add_check(suite, 8, 1000000000, "8_sources");
+  add_check(suite, 1 << 16, 1000000000, "64k_sources");
+  add_check(suite, 8, 1000, "window_per_request");
+  return suite.main(argc, argv);
+}
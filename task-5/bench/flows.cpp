@@ -0,0 +1,114 @@
+// Flow table updates at different numbers of flows, against std::unordered_map as the reference.
+//
+// The keys are read in order, like from packets that are in the cache already, the hash scatters
+// the slots of consecutive flows over the table so that the large tables miss the caches like
+// they would with real traffic. Updates of existing flows are what almost every packet costs, churn
+// adds a flow and expires the oldest for every packet. Batches count the packets of a burst
+// together, as the stack does.
+//
+// usage: bench_flows [--filter <substring>] [--min-time <seconds>] [--repetitions <n>]
+//                    [--json <file>]
+
+#include "harness.h"
+
+#include "counters.h"
+#include "flows.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h> // IPPROTO_ICMP
+
+// ICMP echo flows from n sources, like a ping flood from many peers
+static std::shared_ptr<std::vector<Flows::Key>> keys(size_t n) {
+  auto keys = std::make_shared<std::vector<Flows::Key>>(n);
+  for (size_t i = 0; i < n; i++)
+    (*keys)[i] = {htonl(0x0a000000 + (uint32_t)i), htonl(0xc0a83865), uint16_t(i * 7), 0,
+                  IPPROTO_ICMP};
+  return keys;
+}
+
+struct KeyHash {
+  size_t operator()(const Flows::Key &key) const {
+    uint64_t a, b;
+    memcpy(&a, &key, sizeof(a));
+    memcpy(&b, reinterpret_cast<const uint8_t *>(&key) + sizeof(a), sizeof(b));
+    return std::hash<uint64_t>()(a * 0x9e3779b97f4a7c15 ^ b);
+  }
+};
+struct KeyEqual {
+  bool operator()(const Flows::Key &a, const Flows::Key &b) const {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+  }
+};
+
+static void add_updates(Bench::Suite &suite, size_t n, const char *label) {
+  auto flows = keys(n);
+  auto table = std::make_shared<Flows::Table>(n, 60 * 1000000000ull);
+  for (const Flows::Key &key : *flows)
+    table->update(key, 84, 1);
+  suite.add(std::string("flows/update/") + label,
+            [flows, table, n](size_t iterations) {
+              for (size_t i = 0; i < iterations; i++)
+                table->update((*flows)[i & (n - 1)], 84, 2);
+            });
+
+  suite.add(std::string("flows/update_batch/") + label,
+            [flows, table, n](size_t iterations) {
+              Flows::Packet batch[Flows::Table::BATCH];
+              for (size_t i = 0; i < iterations; i += Flows::Table::BATCH) {
+                for (size_t j = 0; j < Flows::Table::BATCH; j++)
+                  batch[j] = {(*flows)[(i + j) & (n - 1)], 84, 2};
+                table->update(batch, std::min(iterations - i, Flows::Table::BATCH));
+              }
+            });
+
+  auto map = std::make_shared<std::unordered_map<Flows::Key, Flows::Stats, KeyHash, KeyEqual>>();
+  map->reserve(n);
+  for (const Flows::Key &key : *flows)
+    (*map)[key] = {1, 84, 1, 1};
+  suite.add(std::string("unordered_map/update/") + label,
+            [flows, map, n](size_t iterations) {
+              for (size_t i = 0; i < iterations; i++) {
+                Flows::Stats &stats = (*map)[(*flows)[i & (n - 1)]];
+                stats.packets++;
+                stats.bytes += 84;
+                stats.last_seen = 2;
+              }
+            });
+}
+
+// new flows at one per nanosecond of capture time with a timeout of n, so that the table stays at
+// about n flows while every expire call finds some to remove
+static void add_churn(Bench::Suite &suite, size_t n, const char *label) {
+  auto table = std::make_shared<Flows::Table>(2 * n, n);
+  auto now = std::make_shared<uint64_t>(0);
+  suite.add(std::string("flows/churn/") + label, [table, now](size_t iterations) {
+    Flows::Key key = {0, htonl(0xc0a83865), 0, 0, IPPROTO_UDP};
+    for (size_t i = 0; i < iterations; i++) {
+      uint64_t t = ++*now;
+      key.src_ip = (uint32_t)t;
+      key.src_port = t >> 32;
+      table->update(key, 84, t);
+      if (!(t & 31))
+        table->expire(t, 16);
+    }
+  });
+}
+
+int main(int argc, char *argv[]) {
+  // the table counts into the block of the calling thread
+  Counters::BlockPtr counters = Counters::allocate();
+  Counters::local = counters.get();
+
+  Bench::Suite suite;
+  add_updates(suite, 1 << 10, "1k");
+  add_updates(suite, 1 << 16, "64k");
+  add_updates(suite, 1 << 20, "1M");
+  add_churn(suite, 1 << 16, "64k");
+  return suite.main(argc, argv);
+}
@@ -0,0 +1,180 @@
+#pragma once
+// A small self-contained benchmark harness, so that the suite needs nothing beyond the compiler.
+//
+// Every benchmark is a function running its body a given number of times. The harness raises the
+// count until a run takes at least the minimum time and keeps the fastest of a few runs, which is
+// what is most stable between commits. The results are printed as a table and can be written in
+// the JSON layout of Google Benchmark (--json <file>), so that its compare.py works on them too.
+//
+// usage: <suite> [--filter <substring>] [--min-time <seconds>] [--repetitions <n>] [--json <file>]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h> // gethostname
+
+namespace Bench {
+
+// Keep the compiler from dropping a computation whose result is otherwise unused.
+template <typename T> inline void keep(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class Suite {
+public:
+  using Function = std::function<void(size_t iterations)>;
+
+  // bytes is the amount of data one iteration processes, 0 if throughput makes no sense.
+  void add(std::string name, Function run, size_t bytes = 0) {
+    benchmarks.push_back({std::move(name), std::move(run), bytes});
+  }
+
+  int main(int argc, char *argv[]) {
+    const char *filter = "";
+    const char *json = nullptr;
+    double min_time = 0.2;
+    size_t repetitions = 3;
+    for (int i = 1; i < argc; i++) {
+      if (strcmp("--filter", argv[i]) == 0 && i + 1 < argc) {
+        filter = argv[++i];
+      } else if (strcmp("--min-time", argv[i]) == 0 && i + 1 < argc) {
+        min_time = atof(argv[++i]);
+      } else if (strcmp("--repetitions", argv[i]) == 0 && i + 1 < argc) {
+        repetitions = strtoul(argv[++i], nullptr, 10);
+      } else if (strcmp("--json", argv[i]) == 0 && i + 1 < argc) {
+        json = argv[++i];
+      } else {
+        fprintf(stderr,
+                "usage: %s [--filter <substring>] [--min-time <seconds>] [--repetitions <n>] "
+                "[--json <file>]\n",
+                argv[0]);
+        return 1;
+      }
+    }
+    if (!repetitions)
+      repetitions = 1;
+
+    std::vector<Result> results;
+    printf("%-40s %14s %12s %12s %12s\n", "benchmark", "iterations", "ns", "cpu ns", "MB/s");
+    for (auto &benchmark : benchmarks) {
+      if (!strstr(benchmark.name.c_str(), filter))
+        continue;
+      Result result = measure(benchmark, min_time, repetitions);
+      printf("%-40s %14zu %12.1f %12.1f", result.name.c_str(), result.iterations, result.real_ns,
+             result.cpu_ns);
+      if (benchmark.bytes)
+        printf(" %12.1f", benchmark.bytes * 1e3 / result.real_ns);
+      printf("\n");
+      fflush(stdout);
+      results.push_back(result);
+    }
+
+    if (json && !write_json(json, results)) {
+      fprintf(stderr, "Could not write %s\n", json);
+      return 1;
+    }
+    return 0;
+  }
+
+  struct Result {
+    std::string name;
+    size_t iterations;
+    double real_ns; // per iteration
+    double cpu_ns;
+    size_t bytes;
+    // further per iteration values, written next to the times like the user counters of Google
+    // Benchmark
+    std::vector<std::pair<std::string, double>> counters;
+  };
+
+  static bool write_json(const char *path, const std::vector<Result> &results) {
+    FILE *file = fopen(path, "w");
+    if (!file)
+      return false;
+
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[64];
+    time_t t = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+#ifdef NDEBUG
+    const char *build_type = "release";
+#else
+    const char *build_type = "debug";
+#endif
+
+    fprintf(file,
+            "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n"
+            "    \"num_cpus\": %u,\n    \"library_build_type\": \"%s\"\n  },\n"
+            "  \"benchmarks\": [",
+            date, host, std::thread::hardware_concurrency(), build_type);
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result &result = results[i];
+      fprintf(file,
+              "%s\n    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+              "      \"iterations\": %zu,\n      \"real_time\": %.3f,\n"
+              "      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\"",
+              i ? "," : "", result.name.c_str(), result.iterations, result.real_ns,
+              result.cpu_ns);
+      if (result.bytes)
+        fprintf(file, ",\n      \"bytes_per_second\": %.1f", result.bytes * 1e9 / result.real_ns);
+      for (auto &counter : result.counters)
+        fprintf(file, ",\n      \"%s\": %.6f", counter.first.c_str(), counter.second);
+      fprintf(file, "\n    }");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+  }
+
+private:
+  struct Benchmark {
+    std::string name;
+    Function run;
+    size_t bytes;
+  };
+
+  std::vector<Benchmark> benchmarks;
+
+  static double now(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+  }
+
+  static Result measure(const Benchmark &benchmark, double min_time, size_t repetitions) {
+    // grow the count until a run is long enough to time, then repeat at that count
+    size_t iterations = 1;
+    for (;;) {
+      double start = now(CLOCK_MONOTONIC);
+      benchmark.run(iterations);
+      double elapsed = now(CLOCK_MONOTONIC) - start;
+      if (elapsed >= min_time * 1e9 || iterations >= (size_t)1 << 40)
+        break;
+      double factor = elapsed > 0 ? min_time * 1e9 * 1.2 / elapsed : 100;
+      iterations = factor > 100 ? iterations * 100 : (size_t)(iterations * factor) + 1;
+    }
+
+    Result result = {benchmark.name, iterations, 0, 0, benchmark.bytes, {}};
+    for (size_t i = 0; i < repetitions; i++) {
+      double start = now(CLOCK_MONOTONIC);
+      double cpu_start = now(CLOCK_PROCESS_CPUTIME_ID);
+      benchmark.run(iterations);
+      double real_ns = (now(CLOCK_MONOTONIC) - start) / iterations;
+      double cpu_ns = (now(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / iterations;
+      if (!i || real_ns < result.real_ns) {
+        result.real_ns = real_ns;
+        result.cpu_ns = cpu_ns;
+      }
+    }
+    return result;
+  }
+};
+} // namespace Bench
@@ -0,0 +1,201 @@
+// Header parsing and writing through casts to the packed structs against the typed views of
+// header_view.h, which the protocols use. Both variants read and write the same fields, one frame
+// per iteration from a ring of frames at varying alignment so that nothing is constant folded.
+//
+// usage: bench_headers [--filter <substring>] [--min-time <seconds>] [--repetitions <n>]
+//                      [--json <file>]
+
+#include "harness.h"
+
+#include "icmp/icmp.h"
+#include "layer_internet/arp.h"
+#include "layer_internet/ipv4.h"
+#include "layer_link/ethernet.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <netinet/in.h> // htons, IPPROTO_ICMP
+
+static constexpr size_t FRAMES = 64;
+static constexpr size_t FRAME_LEN = 14 + 20 + 8;
+static constexpr size_t STRIDE = 64 + 1; // every frame at another alignment
+
+// Ring of ICMP echo requests, or ARP requests with arp, from peers 10.0.0.n to 192.168.56.101.
+static std::shared_ptr<std::vector<uint8_t>> frames(bool arp) {
+  static const uint8_t OUR_MAC[ETH_ALEN] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+  static const uint8_t OUR_IP[4] = {192, 168, 56, 101};
+  auto ring = std::make_shared<std::vector<uint8_t>>(FRAMES * STRIDE);
+  for (size_t n = 0; n < FRAMES; n++) {
+    uint8_t *frame = ring->data() + n * STRIDE;
+    const uint8_t peer_mac[ETH_ALEN] = {0x02, 0, 0x0a, 0, 0, uint8_t(n + 1)};
+    const uint8_t peer_ip[4] = {10, 0, 0, uint8_t(n + 1)};
+    memcpy(frame, OUR_MAC, ETH_ALEN);
+    memcpy(frame + 6, peer_mac, ETH_ALEN);
+    frame[12] = 8;
+    frame[13] = arp ? 6 : 0;
+
+    if (arp) {
+      uint8_t *request = frame + 14;
+      const uint8_t fixed[8] = {0, 1, 8, 0, 6, 4, 0, 1}; // Ethernet, IPv4, request
+      memcpy(request, fixed, sizeof(fixed));
+      memcpy(request + 8, peer_mac, ETH_ALEN);
+      memcpy(request + 14, peer_ip, 4);
+      memcpy(request + 24, OUR_IP, 4);
+    } else {
+      uint8_t *ip = frame + 14;
+      ip[0] = 0x45;
+      ip[3] = 20 + 8;
+      ip[8] = 64;
+      ip[9] = IPPROTO_ICMP;
+      memcpy(ip + 12, peer_ip, 4);
+      memcpy(ip + 16, OUR_IP, 4);
+      uint8_t *icmp = ip + 20;
+      icmp[0] = ICMP_ECHO;
+      icmp[5] = 1;
+      icmp[7] = n;
+    }
+  }
+  return ring;
+}
+
+// The fields the stack reads of an echo request, folded into one value.
+static uint32_t parse_struct(const uint8_t *buffer) {
+  auto *eth = reinterpret_cast<const Ethernet::Header *>(buffer);
+  auto *ip = reinterpret_cast<const IPv4::Header *>(buffer + 14);
+  auto *icmp = reinterpret_cast<const ICMP::Header *>(buffer + 34);
+  if (ntohs(eth->ether_type) != Ethernet::TYPE_IP || ip->ip_v != 4 || ip->ip_hl != 5)
+    return 0;
+  if (icmp->type != ICMP_ECHO || icmp->code != 0)
+    return 0;
+  return ip->ip_src.s_addr + ip->ip_dst.s_addr + ntohs(ip->ip_len) + ip->ip_p +
+         ntohs(icmp->identifier) + ntohs(icmp->sequence);
+}
+
+static uint32_t parse_view(const uint8_t *buffer) {
+  const uint8_t *ip = buffer + 14;
+  const uint8_t *icmp = buffer + 34;
+  if (HeaderView::get<Ethernet::Fields::Type>(buffer) != Ethernet::TYPE_IP ||
+      !HeaderView::matches<IPv4::Fields::Plain>(ip))
+    return 0;
+  if (!HeaderView::matches<ICMP::Fields::EchoRequest>(icmp))
+    return 0;
+  return HeaderView::get<IPv4::Fields::Source>(ip).s_addr +
+         HeaderView::get<IPv4::Fields::Destination>(ip).s_addr +
+         HeaderView::get<IPv4::Fields::TotalLength>(ip) +
+         HeaderView::get<IPv4::Fields::Protocol>(ip) +
+         HeaderView::get<ICMP::Fields::Identifier>(icmp) +
+         HeaderView::get<ICMP::Fields::Sequence>(icmp);
+}
+
+// The validation of an ARP packet and the fields of a request.
+static uint32_t arp_struct(const uint8_t *buffer) {
+  auto *arp = reinterpret_cast<const ARP::Packet *>(buffer + 14);
+  if (ntohs(arp->hdr.ar_hrd) != ARPHRD_ETHER || ntohs(arp->hdr.ar_pro) != Ethernet::TYPE_IP ||
+      arp->hdr.ar_hln != ETH_ALEN || arp->hdr.ar_pln != 4)
+    return 0;
+  return ntohs(arp->hdr.ar_op) + arp->src_ip.s_addr + arp->dst_ip.s_addr +
+         arp->src_mac.ether_addr_octet[5];
+}
+
+static uint32_t arp_view(const uint8_t *buffer) {
+  const uint8_t *arp = buffer + 14;
+  if (!HeaderView::matches<ARP::Fields::EthernetIpv4>(arp))
+    return 0;
+  return HeaderView::get<ARP::Fields::Operation>(arp) +
+         HeaderView::get<ARP::Fields::SenderIp>(arp).s_addr +
+         HeaderView::get<ARP::Fields::TargetIp>(arp).s_addr +
+         HeaderView::get<ARP::Fields::SenderMac>(arp).ether_addr_octet[5];
+}
+
+// The headers of an echo reply, as the stack writes them around a payload.
+static void write_struct(uint8_t *buffer, const Ethernet::Address &mac, uint32_t n) {
+  auto *eth = reinterpret_cast<Ethernet::Header *>(buffer);
+  memcpy(eth->ether_dhost, &mac, ETH_ALEN);
+  memcpy(eth->ether_shost, &mac, ETH_ALEN);
+  eth->ether_type = htons(Ethernet::TYPE_IP);
+  auto *ip = reinterpret_cast<IPv4::Header *>(buffer + 14);
+  ip->ip_v = 4;
+  ip->ip_hl = 5;
+  ip->ip_len = htons(28);
+  ip->ip_ttl = 64;
+  ip->ip_p = IPPROTO_ICMP;
+  ip->ip_dst.s_addr = n;
+  auto *icmp = reinterpret_cast<ICMP::Header *>(buffer + 34);
+  icmp->type = ICMP_ECHOREPLY;
+  icmp->code = 0;
+  icmp->identifier = htons(1);
+  icmp->sequence = htons(n);
+}
+
+static void write_view(uint8_t *buffer, const Ethernet::Address &mac, uint32_t n) {
+  HeaderView::set<Ethernet::Fields::Destination>(buffer, mac);
+  HeaderView::set<Ethernet::Fields::Source>(buffer, mac);
+  HeaderView::set<Ethernet::Fields::Type>(buffer, Ethernet::TYPE_IP);
+  uint8_t *ip = buffer + 14;
+  HeaderView::set<IPv4::Fields::Version>(ip, 4);
+  HeaderView::set<IPv4::Fields::HeaderLength>(ip, 5);
+  HeaderView::set<IPv4::Fields::TotalLength>(ip, 28);
+  HeaderView::set<IPv4::Fields::TTL>(ip, 64);
+  HeaderView::set<IPv4::Fields::Protocol>(ip, IPPROTO_ICMP);
+  HeaderView::set<IPv4::Fields::Destination>(ip, IPv4::Address{n});
+  uint8_t *icmp = buffer + 34;
+  HeaderView::set<ICMP::Fields::Type>(icmp, ICMP_ECHOREPLY);
+  HeaderView::set<ICMP::Fields::Code>(icmp, 0);
+  HeaderView::set<ICMP::Fields::Identifier>(icmp, 1);
+  HeaderView::set<ICMP::Fields::Sequence>(icmp, n);
+}
+
+template <uint32_t (*parse)(const uint8_t *)>
+static void add_parse(Bench::Suite &suite, const char *name, bool arp) {
+  auto ring = frames(arp);
+  // a rejected frame would measure the early return only
+  if (!parse(ring->data())) {
+    fprintf(stderr, "%s: the frame was not accepted\n", name);
+    exit(1);
+  }
+  suite.add(name,
+            [ring](size_t iterations) {
+              uint32_t sum = 0;
+              for (size_t i = 0; i < iterations; i++)
+                sum += parse(ring->data() + i % FRAMES * STRIDE);
+              Bench::keep(sum);
+            },
+            FRAME_LEN);
+}
+
+template <void (*write)(uint8_t *, const Ethernet::Address &, uint32_t)>
+static void add_write(Bench::Suite &suite, const char *name) {
+  auto ring = frames(false);
+  suite.add(name,
+            [ring](size_t iterations) {
+              const Ethernet::Address mac = {{0x11, 0x22, 0x33, 0x44, 0x55, 0x66}};
+              for (size_t i = 0; i < iterations; i++) {
+                write(ring->data() + i % FRAMES * STRIDE, mac, i);
+                Bench::keep(ring->data());
+              }
+            },
+            FRAME_LEN);
+}
+
+int main(int argc, char *argv[]) {
+  // the variants read the same fields
+  auto echo = frames(false), arp = frames(true);
+  for (size_t n = 0; n < FRAMES; n++) {
+    if (parse_struct(echo->data() + n * STRIDE) != parse_view(echo->data() + n * STRIDE) ||
+        arp_struct(arp->data() + n * STRIDE) != arp_view(arp->data() + n * STRIDE)) {
+      fprintf(stderr, "The struct and view variants disagree on frame %zu\n", n);
+      return 1;
+    }
+  }
+
+  Bench::Suite suite;
+  add_parse<parse_struct>(suite, "parse/echo/struct", false);
+  add_parse<parse_view>(suite, "parse/echo/view", false);
+  add_parse<arp_struct>(suite, "parse/arp/struct", true);
+  add_parse<arp_view>(suite, "parse/arp/view", true);
+  add_write<write_struct>(suite, "write/echo/struct");
+  add_write<write_view>(suite, "write/echo/view");
+  return suite.main(argc, argv);
+}
@@ -0,0 +1,218 @@
+// Hot paths of every layer, driven from frames in memory with a send callback that only counts.
+//
+// Log messages are captured into a string instead of being printed so that the formatting is
+// measured without the terminal. With --json the results can be kept and diffed between commits.
+//
+// usage: bench_layers [--filter <substring>] [--min-time <seconds>] [--repetitions <n>]
+//                     [--json <file>]
+
+#include "harness.h"
+
+#include "logging.h"
+#include "stack.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>     // inet_aton
+#include <netinet/ether.h> // ether_aton_r
+
+static size_t sent = 0;
+
+static void count_send(char *, size_t) { sent++; }
+
+static void checksum(uint8_t *data, size_t len, size_t offset) {
+  uint16_t sum = IPv4::Protocol::checksum(data, len);
+  memcpy(data + offset, &sum, sizeof(sum));
+}
+
+static const uint8_t PEER_MAC[ETH_ALEN] = {0x0a, 0, 0x27, 0, 0, 1};
+static const uint8_t PEER_IP[4] = {192, 168, 56, 1};
+
+// Ethernet header from the peer to mac, the payload is left zeroed.
+static std::vector<uint8_t> ethernet_frame(const Ethernet::Address &mac, uint16_t type,
+                                           size_t len) {
+  std::vector<uint8_t> frame(len);
+  memcpy(frame.data(), &mac, ETH_ALEN);
+  memcpy(frame.data() + 6, PEER_MAC, ETH_ALEN);
+  frame[12] = type >> 8;
+  frame[13] = type & 0xff;
+  return frame;
+}
+
+// ARP request from the peer for ip
+static std::vector<uint8_t> arp_request(const Ethernet::Address &mac, const IPv4::Address &ip) {
+  auto frame = ethernet_frame(mac, Ethernet::TYPE_ARP, 14 + 28);
+  uint8_t *arp = frame.data() + 14;
+  const uint8_t fixed[8] = {0, 1, 8, 0, 6, 4, 0, 1}; // Ethernet, IPv4, request
+  memcpy(arp, fixed, sizeof(fixed));
+  memcpy(arp + 8, PEER_MAC, ETH_ALEN);
+  memcpy(arp + 14, PEER_IP, 4);
+  memcpy(arp + 24, &ip, 4);
+  return frame;
+}
+
+// ICMP echo request with payload bytes from the peer to dst
+static std::vector<uint8_t> echo_request(const Ethernet::Address &mac, const IPv4::Address &dst,
+                                         size_t payload) {
+  auto frame = ethernet_frame(mac, Ethernet::TYPE_IP, 14 + 20 + 8 + payload);
+  uint8_t *ip = frame.data() + 14;
+  ip[0] = 0x45;
+  uint16_t total_len = htons(20 + 8 + payload);
+  memcpy(ip + 2, &total_len, 2);
+  ip[8] = 64;
+  ip[9] = IPPROTO_ICMP;
+  memcpy(ip + 12, PEER_IP, 4);
+  memcpy(ip + 16, &dst, 4);
+  checksum(ip, 20, 10);
+
+  uint8_t *icmp = ip + 20;
+  icmp[0] = 8;
+  icmp[5] = 1;
+  icmp[7] = 1;
+  for (size_t i = 0; i < payload; i++)
+    icmp[8 + i] = i;
+  checksum(icmp, 8 + payload, 2);
+  return frame;
+}
+
+static void add_checksum(Bench::Suite &suite) {
+  for (size_t len : {20, 64, 576, 1500, 9000}) {
+    auto data = std::make_shared<std::vector<uint8_t>>(len);
+    for (size_t i = 0; i < len; i++)
+      (*data)[i] = i * 7;
+    suite.add("ipv4/checksum/" + std::to_string(len),
+              [data](size_t iterations) {
+                for (size_t i = 0; i < iterations; i++) {
+                  Bench::keep(data->data());
+                  Bench::keep(IPv4::Protocol::checksum(data->data(), data->size()));
+                }
+              },
+              len);
+  }
+}
+
+// frame handled by a stack, expected_sends is the number of frames it answers with
+static void add_frame(Bench::Suite &suite, const char *name, std::shared_ptr<Stack> stack,
+                      std::vector<uint8_t> frame, bool whole_stack, size_t expected_sends) {
+  auto buffer = std::make_shared<std::vector<uint8_t>>(std::move(frame));
+
+  // the benchmark would measure the wrong path if the frame was not handled as expected
+  size_t before = sent;
+  stack->handle_frame(buffer->data(), buffer->size(), 0);
+  if (sent - before != expected_sends) {
+    fprintf(stderr, "%s: %zu frames sent instead of %zu\n", name, sent - before, expected_sends);
+    exit(1);
+  }
+
+  suite.add(name,
+            [stack, buffer, whole_stack](size_t iterations) {
+              if (whole_stack) {
+                for (size_t i = 0; i < iterations; i++)
+                  stack->handle_frame(buffer->data(), buffer->size(), 0);
+              } else {
+                Ethernet::Protocol *ethernet = stack->ethernet();
+                for (size_t i = 0; i < iterations; i++)
+                  ethernet->handle_packet(buffer->data(), buffer->size());
+              }
+            },
+            buffer->size());
+}
+
+static void add_layers(Bench::Suite &suite) {
+  StackConfig config;
+  ether_aton_r("11:22:33:44:55:66", (ether_addr *)&config.mac);
+  inet_aton("192.168.56.101", (in_addr *)&config.ip);
+  config.respond = true;
+  static Route::Router router;
+  config.router = &router;
+  std::shared_ptr<Stack> stack = Stack::create(config, count_send);
+
+  IPv4::Address other;
+  inet_aton("192.168.56.102", (in_addr *)&other);
+
+  add_frame(suite, "ethernet/arp_request", stack, arp_request(config.mac, config.ip), false, 1);
+  add_frame(suite, "ethernet/arp_request_other", stack, arp_request(config.mac, other), false, 0);
+  add_frame(suite, "ethernet/ipv4_not_ours", stack, echo_request(config.mac, other, 56), false, 0);
+
+  // unicast to another host as captured in promiscuous mode, turned away by the MAC filter
+  Ethernet::Address other_mac;
+  ether_aton_r("02:00:00:00:00:02", (ether_addr *)&other_mac);
+  config.mac_filter = true;
+  std::shared_ptr<Stack> filtered = Stack::create(config, count_send);
+  add_frame(suite, "ethernet/other_mac_filtered", filtered, echo_request(other_mac, other, 56),
+            false, 0);
+  for (size_t payload : {56, 1472})
+    add_frame(suite, ("icmp/echo/" + std::to_string(payload)).c_str(), stack,
+              echo_request(config.mac, config.ip, payload), true, 1);
+}
+
+static void add_logging(Bench::Suite &suite) {
+  static Ethernet::Address mac_a, mac_b;
+  static IPv4::Address ip_a, ip_b;
+  ether_aton_r("11:22:33:44:55:66", (ether_addr *)&mac_a);
+  ether_aton_r("0a:00:27:00:00:01", (ether_addr *)&mac_b);
+  inet_aton("192.168.56.101", (in_addr *)&ip_a);
+  inet_aton("192.168.56.1", (in_addr *)&ip_b);
+  static const HTTP::View method = {"GET", 3}, path = {"/index.html", 11},
+                          host = {"example.com", 11}, cookie = {"session=0123456789abcdef", 24},
+                          auth = {"user:password", 13}, status = {"200", 3};
+
+  // log_ping_report is left out, it is printed once per interval and always to stdout
+  struct Message {
+    const char *name;
+    void (*log)();
+  };
+  static const Message messages[] = {
+      {"ethernet_frame", [] { log_ethernet_frame(&mac_a, &mac_b); }},
+      {"ip_packet", [] { log_ip_packet(&ip_a, &ip_b); }},
+      {"tcp_segment", [] { log_tcp_segment(49152, 80, 1000, 2000, 0x12); }},
+      {"arp_request", [] { log_arp_request(&mac_a, &ip_a, &mac_b, &ip_b); }},
+      {"arp_reply", [] { log_arp_reply(&mac_a, &ip_a, &mac_b, &ip_b); }},
+      {"icmp_ping", [] { log_icmp_ping(); }},
+      {"icmp_pong", [] { log_icmp_pong(); }},
+      {"icmp_drop", [] { log_icmp_drop("global"); }},
+      {"udp_datagram", [] { log_udp_datagram(49152, 7, 512); }},
+      {"http_response", [] { log_http_response(status); }},
+      {"http_request", [] { log_http_request(method, path); }},
+      {"http_request_host", [] { log_http_request_host(host); }},
+      {"http_request_cookie", [] { log_http_request_cookie(cookie); }},
+      {"http_request_auth", [] { log_http_request_auth(auth); }},
+  };
+
+  const struct {
+    const char *name;
+    size_t format;
+  } formats[] = {{"human", LOG_FORMAT_HUMAN_READABLE}, {"csv", LOG_FORMAT_CSV}};
+  for (auto &format : formats) {
+    for (auto &message : messages) {
+      size_t log = format.format;
+      void (*function)() = message.log;
+      suite.add(std::string("log/") + message.name + "/" + format.name,
+                [log, function](size_t iterations) {
+                  std::string buffer;
+                  log_format = log;
+                  log_capture(&buffer);
+                  for (size_t i = 0; i < iterations; i++) {
+                    function();
+                    if (buffer.size() > 1 << 16)
+                      buffer.clear();
+                  }
+                  log_capture(nullptr);
+                  log_format = LOG_FORMAT_NONE;
+                });
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  log_format = LOG_FORMAT_NONE;
+
+  Bench::Suite suite;
+  add_checksum(suite);
+  add_layers(suite);
+  add_logging(suite);
+  return suite.main(argc, argv);
+}
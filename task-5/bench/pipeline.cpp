@@ -0,0 +1,142 @@
+// Throughput of the pipeline mode by number of workers.
+//
+// The RX thread replays ICMP echo requests of many sources from memory and the TX thread
+// discards the replies, so the numbers show how far the stack itself scales.
+//
+// usage: bench_pipeline [frames per run] [max workers]
+
+#include "clock.h"
+#include "logging.h"
+#include "pipeline/pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>     // inet_aton
+#include <netinet/ether.h> // ether_aton_r
+
+static const size_t SOURCES = 4096;
+static const size_t FRAME_LEN = 98; // 56 bytes of payload like ping
+
+class MemorySource : public Pipeline::Source {
+public:
+  MemorySource(const std::vector<std::vector<uint8_t>> &frames, size_t count)
+      : frames(frames), remaining(count) {}
+
+  int receive(Pipeline::Runner &runner, size_t max) override {
+    if (!remaining)
+      return -1;
+    size_t n = std::min(max, remaining);
+    for (size_t i = 0; i < n; i++) {
+      const std::vector<uint8_t> &frame = frames[next++ % frames.size()];
+      runner.dispatch(frame.data(), frame.size(), 0);
+    }
+    remaining -= n;
+    return n;
+  }
+
+private:
+  const std::vector<std::vector<uint8_t>> &frames;
+  size_t remaining;
+  size_t next = 0;
+};
+
+class NullSink : public Pipeline::Sink {
+public:
+  void transmit(const uint8_t *, size_t) override { count++; }
+  size_t count = 0;
+};
+
+static void checksum(uint8_t *data, size_t len, size_t offset) {
+  uint16_t sum = IPv4::Protocol::checksum(data, len);
+  memcpy(data + offset, &sum, sizeof(sum));
+}
+
+// echo requests from 10.0.x.y to 192.168.56.101
+static std::vector<std::vector<uint8_t>> make_frames(const Ethernet::Address &mac) {
+  std::vector<std::vector<uint8_t>> frames;
+  for (size_t i = 0; i < SOURCES; i++) {
+    std::vector<uint8_t> frame(FRAME_LEN);
+    uint8_t *p = frame.data();
+    memcpy(p, &mac, ETH_ALEN);
+    const uint8_t peer_mac[ETH_ALEN] = {0x0a, 0, 0x27, 0, 0, 0};
+    memcpy(p + 6, peer_mac, ETH_ALEN);
+    p[12] = 0x08;
+
+    uint8_t *ip = p + 14;
+    ip[0] = 0x45;
+    uint16_t total_len = htons(FRAME_LEN - 14);
+    memcpy(ip + 2, &total_len, 2);
+    ip[8] = 64;
+    ip[9] = IPPROTO_ICMP;
+    const uint8_t src[4] = {10, 0, (uint8_t)(i >> 8), (uint8_t)i};
+    const uint8_t dst[4] = {192, 168, 56, 101};
+    memcpy(ip + 12, src, 4);
+    memcpy(ip + 16, dst, 4);
+    checksum(ip, 20, 10);
+
+    uint8_t *icmp = ip + 20;
+    icmp[0] = 8;
+    icmp[5] = 1;
+    icmp[7] = i & 0xff;
+    for (size_t j = 8; j < FRAME_LEN - 34; j++)
+      icmp[j] = j;
+    checksum(icmp, FRAME_LEN - 34, 2);
+
+    frames.push_back(std::move(frame));
+  }
+  return frames;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+  size_t max_workers = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+  if (!max_workers) {
+    // leave room for the RX and TX threads
+    size_t cores = std::thread::hardware_concurrency();
+    max_workers = std::max<size_t>(cores > 2 ? cores - 2 : 1, 1);
+  }
+  log_format = LOG_FORMAT_NONE;
+
+  StackConfig config;
+  ether_aton_r("11:22:33:44:55:66", (ether_addr *)&config.mac);
+  inet_aton("192.168.56.101", (in_addr *)&config.ip);
+  config.respond = true;
+  Route::Router router;
+  config.router = &router;
+
+  auto frames = make_frames(config.mac);
+
+  printf("%8s %12s %10s %12s\n", "workers", "Mpps", "ns/frame", "replies");
+  double baseline = 0;
+  for (size_t workers = 1; workers <= max_workers; workers *= 2) {
+    std::vector<std::unique_ptr<Stack>> stacks;
+    for (size_t i = 0; i < workers; i++)
+      stacks.push_back(Stack::create(config, Pipeline::Runner::send_bytes));
+
+    Pipeline::Config pipeline;
+    pipeline.workers = workers;
+    pipeline.lossless = true;
+    Pipeline::Runner runner(pipeline, std::move(stacks));
+    MemorySource source(frames, count);
+    NullSink sink;
+
+    uint64_t start = Clock::monotonic();
+    runner.run(source, sink);
+    double seconds = (double)(Clock::monotonic() - start) / Clock::NS_PER_SEC;
+
+    double mpps = count / seconds / 1e6;
+    if (workers == 1)
+      baseline = mpps;
+    printf("%8zu %12.3f %10.1f %12zu   %.2fx\n", workers, mpps, 1e3 / mpps, sink.count,
+           mpps / baseline);
+    if (workers < max_workers && workers * 2 > max_workers)
+      workers = max_workers / 2;
+  }
+  return 0;
+}
@@ -0,0 +1,244 @@
+// End-to-end throughput of one stack instance on a capture held in memory.
+//
+// The capture is read completely before the clock starts and then handed to the stack in a loop,
+// in bursts followed by a poll like the sequential mode does, until the duration or the number of
+// frames is reached. Replies are copied into a ring in memory (or only counted with --null), so
+// neither the disk, libpcap nor a device is part of the number. One warm-up pass fills the
+// neighbour cache and the pools before measuring. Logging is off, bench_layers covers it.
+//
+// usage: bench_replay <capture> [--seconds <s>] [--count <frames>] [--null] [--udp-echo <port>]
+//                     [--tcp-listen <port>] [--http-inspect <port>] [--json <file>]
+//
+// The stack answers as 11:22:33:44:55:66 / 192.168.56.101 like in the tests.
+
+#include "harness.h"
+
+#include "clock.h"
+#include "logging.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>     // inet_aton
+#include <netinet/ether.h> // ether_aton_r
+#include <pcap/pcap.h>
+
+// Every allocation through operator new is counted, the stack does not use malloc on its path.
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static const size_t BURST = 32;
+
+// where replies go, a ring of frame sized slots like the TX ring of a device
+static const size_t RING_SLOTS = 1024;
+static const size_t SLOT_SIZE = 2048;
+static uint8_t *ring = nullptr;
+static size_t ring_next = 0;
+static uint64_t replies = 0;
+
+static void ring_send(char *buf, size_t bufsiz) {
+  memcpy(ring + (ring_next++ % RING_SLOTS) * SLOT_SIZE, buf, std::min(bufsiz, SLOT_SIZE));
+  replies++;
+}
+
+static void null_send(char *, size_t) { replies++; }
+
+struct Capture {
+  std::vector<uint8_t> data;
+  std::vector<size_t> offsets; // of every frame in data, followed by the end
+  std::vector<uint64_t> timestamps;
+  uint64_t duration; // from the first to the last frame
+};
+
+static bool load(const char *path, Capture &capture) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_t *pcap = pcap_open_offline(path, errbuf);
+  if (!pcap) {
+    fprintf(stderr, "Could not open %s: %s\n", path, errbuf);
+    return false;
+  }
+  pcap_pkthdr *header;
+  const u_char *bytes;
+  while (pcap_next_ex(pcap, &header, &bytes) == 1) {
+    capture.offsets.push_back(capture.data.size());
+    capture.data.insert(capture.data.end(), bytes, bytes + header->caplen);
+    capture.timestamps.push_back(header->ts.tv_sec * Clock::NS_PER_SEC +
+                                 header->ts.tv_usec * 1000);
+  }
+  capture.offsets.push_back(capture.data.size());
+  pcap_close(pcap);
+
+  if (capture.timestamps.empty()) {
+    fprintf(stderr, "%s contains no frames\n", path);
+    return false;
+  }
+  capture.duration = capture.timestamps.back() - capture.timestamps.front();
+  return true;
+}
+
+// Hand count frames of the capture to the stack, starting at pass. Every pass is shifted in time
+// behind the previous one so that timers see the clock advance.
+static uint64_t replay(Stack &stack, const Capture &capture, uint64_t count, uint64_t &pass,
+                       uint64_t deadline) {
+  size_t frames = capture.timestamps.size();
+  uint64_t shift = capture.duration + Clock::NS_PER_SEC / 1000;
+  // read the clock about every thousand frames, not after every pass of a short capture
+  uint64_t passes_per_check = std::max<size_t>(1, 1024 / frames);
+  uint64_t done = 0;
+  while (done < count) {
+    size_t n = std::min<uint64_t>(frames, count - done);
+    for (size_t i = 0; i < n; i++) {
+      stack.handle_frame(&capture.data[capture.offsets[i]],
+                         capture.offsets[i + 1] - capture.offsets[i],
+                         capture.timestamps[i] + pass * shift);
+      if ((i + 1) % BURST == 0)
+        stack.poll();
+    }
+    stack.poll();
+    done += n;
+    pass++;
+    if (deadline && pass % passes_per_check == 0 && Clock::monotonic() >= deadline)
+      break;
+  }
+  return done;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = nullptr;
+  const char *json = nullptr;
+  double seconds = 0;
+  uint64_t count = 0;
+  bool null_sink = false;
+
+  StackConfig config;
+  ether_aton_r("11:22:33:44:55:66", (ether_addr *)&config.mac);
+  inet_aton("192.168.56.101", (in_addr *)&config.ip);
+  config.respond = true;
+  Route::Router router;
+  config.router = &router;
+
+  for (int i = 1; i < argc; i++) {
+    int remaining = argc - i;
+    if (strcmp("--seconds", argv[i]) == 0 && remaining > 1) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp("--count", argv[i]) == 0 && remaining > 1) {
+      count = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp("--null", argv[i]) == 0) {
+      null_sink = true;
+    } else if (strcmp("--udp-echo", argv[i]) == 0 && remaining > 1) {
+      config.udp_echo_port = atoi(argv[++i]);
+    } else if (strcmp("--tcp-listen", argv[i]) == 0 && remaining > 1) {
+      config.tcp_ports.push_back(atoi(argv[++i]));
+    } else if (strcmp("--http-inspect", argv[i]) == 0 && remaining > 1) {
+      config.http_ports.push_back(atoi(argv[++i]));
+    } else if (strcmp("--json", argv[i]) == 0 && remaining > 1) {
+      json = argv[++i];
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (!path) {
+    fprintf(stderr,
+            "usage: %s <capture> [--seconds <s>] [--count <frames>] [--null] [--udp-echo <port>] "
+            "[--tcp-listen <port>] [--http-inspect <port>] [--json <file>]\n",
+            argv[0]);
+    return 1;
+  }
+  if (!seconds && !count)
+    seconds = 2;
+  log_format = LOG_FORMAT_NONE;
+
+  Capture capture;
+  if (!load(path, capture))
+    return 1;
+
+  std::vector<uint8_t> ring_memory(RING_SLOTS * SLOT_SIZE);
+  ring = ring_memory.data();
+  std::unique_ptr<Stack> stack = Stack::create(config, null_sink ? null_send : ring_send);
+  if (!stack) {
+    fprintf(stderr, "Could not set up the stack\n");
+    return 1;
+  }
+
+  uint64_t pass = 0;
+  replay(*stack, capture, capture.timestamps.size(), pass, 0);
+
+  // with a duration only whole passes are replayed, the deadline is checked between them
+  uint64_t frames = count ? count : UINT64_MAX;
+  timespec cpu_start, cpu_end;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+  uint64_t start = Clock::monotonic();
+  uint64_t deadline = seconds ? start + (uint64_t)(seconds * Clock::NS_PER_SEC) : 0;
+  uint64_t allocations_before = allocations.load(std::memory_order_relaxed);
+  uint64_t replies_before = replies;
+  const Counters::Block &block = stack->counter_block();
+  uint64_t hits_before = Counters::load(block, Counters::IPV4_TX_HEADER_HITS);
+  uint64_t misses_before = Counters::load(block, Counters::IPV4_TX_HEADER_MISSES);
+  frames = replay(*stack, capture, frames, pass, deadline);
+  double elapsed = (double)(Clock::monotonic() - start);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec);
+  uint64_t allocated = allocations.load(std::memory_order_relaxed) - allocations_before;
+  uint64_t hits = Counters::load(block, Counters::IPV4_TX_HEADER_HITS) - hits_before;
+  uint64_t misses = Counters::load(block, Counters::IPV4_TX_HEADER_MISSES) - misses_before;
+
+  // whole passes are replayed, so the bytes follow from the passes and the rest of the last one
+  size_t per_pass = capture.timestamps.size();
+  uint64_t bytes = frames / per_pass * capture.data.size() + capture.offsets[frames % per_pass];
+
+  double ns_per_frame = elapsed / frames;
+  double allocations_per_frame = (double)allocated / frames;
+  printf("%s: %lu frames (%zu per pass) in %.3f s\n", path, (unsigned long)frames, per_pass,
+         elapsed / Clock::NS_PER_SEC);
+  printf("  %10.3f Mpps\n  %10.1f ns/frame\n  %10.1f MB/s\n  %10.3f allocations/frame\n"
+         "  %10.3f replies/frame\n",
+         1e3 / ns_per_frame, ns_per_frame, bytes * 1e3 / elapsed, allocations_per_frame,
+         (double)(replies - replies_before) / frames);
+  if (hits + misses)
+    printf("  %10.3f header cache hit rate\n", (double)hits / (hits + misses));
+
+  if (json) {
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    Bench::Suite::Result result = {std::string("replay/") + name,
+                                   (size_t)frames,
+                                   ns_per_frame,
+                                   cpu / frames,
+                                   (size_t)(bytes / frames),
+                                   {{"items_per_second", 1e9 / ns_per_frame},
+                                    {"allocations_per_item", allocations_per_frame}}};
+    if (!Bench::Suite::write_json(json, {result})) {
+      fprintf(stderr, "Could not write %s\n", json);
+      return 1;
+    }
+  }
+  return 0;
+}
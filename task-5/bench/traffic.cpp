@@ -0,0 +1,70 @@
+// Cost per frame of the traffic summary of the report mode, for traffic from a few sources, which
+// stay in the talker counters, and from many, where almost every frame replaces the lowest
+// counter. Merging is what the multi-threaded modes do once per stack at exit.
+//
+// usage: bench_traffic [--filter <substring>] [--min-time <seconds>] [--repetitions <n>]
+//                      [--json <file>]
+
+#include "harness.h"
+
+#include "traffic.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h> // htonl, IPPROTO_UDP
+
+static constexpr size_t FRAMES = 1 << 12;
+static constexpr size_t FRAME_LEN = 14 + 20 + 8 + 18;
+
+// UDP frames from sources 10.x.y.z spread over a ring, one of them per frame.
+static std::shared_ptr<std::vector<uint8_t>> frames(size_t sources) {
+  auto ring = std::make_shared<std::vector<uint8_t>>(FRAMES * FRAME_LEN);
+  for (size_t n = 0; n < FRAMES; n++) {
+    uint8_t *frame = ring->data() + n * FRAME_LEN;
+    frame[12] = 8;
+    uint8_t *ip = frame + 14;
+    ip[0] = 0x45;
+    ip[3] = FRAME_LEN - 14;
+    ip[9] = IPPROTO_UDP;
+    uint32_t source = htonl(0x0a000000 + (uint32_t)(n * 2654435761u % sources));
+    memcpy(ip + 12, &source, 4);
+  }
+  return ring;
+}
+
+static void add_frames(Bench::Suite &suite, size_t sources, const char *label) {
+  auto ring = frames(sources);
+  auto summary = std::make_shared<Traffic::Summary>();
+  suite.add(std::string("summary/add/") + label,
+            [ring, summary](size_t iterations) {
+              for (size_t i = 0; i < iterations; i++)
+                summary->add(ring->data() + i % FRAMES * FRAME_LEN, FRAME_LEN);
+              Bench::keep(summary.get());
+            },
+            FRAME_LEN);
+}
+
+int main(int argc, char *argv[]) {
+  Bench::Suite suite;
+  add_frames(suite, 8, "8_sources");
+  add_frames(suite, 1 << 16, "64k_sources");
+
+  // two summaries with full talker counters
+  auto ring = frames(1 << 16);
+  auto a = std::make_shared<Traffic::Summary>(), b = std::make_shared<Traffic::Summary>();
+  for (size_t n = 0; n < FRAMES; n++) {
+    a->add(ring->data() + n * FRAME_LEN, FRAME_LEN);
+    b->add(ring->data() + (FRAMES - 1 - n) * FRAME_LEN, FRAME_LEN);
+  }
+  suite.add("summary/merge", [a, b](size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+      Traffic::Summary merged = *a;
+      merged.add(*b);
+      Bench::keep(&merged);
+    }
+  });
+  return suite.main(argc, argv);
+}
@@ -0,0 +1,72 @@
+# This script registers a custom target building a tuned release of pinger in stages, with
+# profile guided optimization (PGO), link time optimization (LTO) and -fno-plt.
+#
+# The stages run in builds of their own below PGO_OUTPUT_DIR, configured with the compiler and
+# libpcap of this build but as Release and without the sanitizers of the default flags:
+#   baseline......................Plain Release build, the reference for the benchmark deltas.
+#   build.........................Instrumented build which is trained by replaying the test
+#                                 captures and floods written by pinger-gen through bench_replay,
+#                                 then rebuilt in place with the profile, LTO and -fno-plt.
+# At the end bench_layers and bench_replay of both builds are compared like the perf tests do.
+#
+# GCC and Clang are supported. Clang needs llvm-profdata to merge the raw profiles, both need
+# CMake 3.19 for comparing the benchmark results.
+#
+# Processed variables:
+#   PGO_OUTPUT_DIR................custom output directory of the builds
+#                                 (gets exported into the cache)
+#   PGO_TRAINING_SECONDS..........replay time per training capture (gets exported into the cache)
+#
+# Provided targets:
+#   pgo...........................Run all stages, the tuned binaries end up in
+#                                 PGO_OUTPUT_DIR/build.
+#
+
+if(NOT CMAKE_CXX_COMPILER_ID STREQUAL GNU AND NOT CMAKE_CXX_COMPILER_ID STREQUAL Clang)
+  message(STATUS "PGO builds are only supported with GCC and Clang.")
+  return()
+endif()
+if(CMAKE_VERSION VERSION_LESS 3.19)
+  message(STATUS "PGO builds need CMake 3.19 or newer.")
+  return()
+endif()
+
+# Clang writes raw profiles, which have to be merged by the llvm-profdata of the same version.
+if(CMAKE_CXX_COMPILER_ID STREQUAL Clang)
+  string(REGEX REPLACE "^([0-9]+).*" "\\1" CLANG_MAJOR_VERSION "${CMAKE_CXX_COMPILER_VERSION}")
+  find_program(LLVM_PROFDATA_COMMAND NAMES llvm-profdata-${CLANG_MAJOR_VERSION} llvm-profdata)
+  mark_as_advanced(LLVM_PROFDATA_COMMAND)
+  if(NOT LLVM_PROFDATA_COMMAND)
+    message(STATUS "llvm-profdata couldn't be found.")
+    message(STATUS "PGO builds will not be available.")
+    return()
+  endif()
+endif()
+
+# Export the output directory and the training time to the cache to enable modification.
+set(PGO_OUTPUT_DIR "${PROJECT_BINARY_DIR}/_pgo" CACHE PATH "Output directory of the PGO builds.")
+set(PGO_TRAINING_SECONDS 1 CACHE STRING "Replay time in seconds per PGO training capture.")
+mark_as_advanced(PGO_OUTPUT_DIR PGO_TRAINING_SECONDS)
+
+set_property(
+  DIRECTORY "${CMAKE_CURRENT_SOURCE_DIR}"
+  APPEND PROPERTY ADDITIONAL_MAKE_CLEAN_FILES "${PGO_OUTPUT_DIR}"
+)
+
+add_custom_target(pgo
+                  COMMAND "${CMAKE_COMMAND}"
+                          -D "SOURCE_DIR:PATH=${PROJECT_SOURCE_DIR}"
+                          -D "OUTPUT_DIR:PATH=${PGO_OUTPUT_DIR}"
+                          -D "GENERATOR:STRING=${CMAKE_GENERATOR}"
+                          -D "CXX_COMPILER:FILEPATH=${CMAKE_CXX_COMPILER}"
+                          -D "COMPILER_ID:STRING=${CMAKE_CXX_COMPILER_ID}"
+                          -D "COMPILER_VERSION:STRING=${CMAKE_CXX_COMPILER_VERSION}"
+                          -D "LLVM_PROFDATA:FILEPATH=${LLVM_PROFDATA_COMMAND}"
+                          -D "PCAP_INCLUDE_DIR:PATH=${PCAP_INCLUDE_DIR}"
+                          -D "PCAP_LIBRARY:FILEPATH=${PCAP_LIBRARY}"
+                          -D "TRAINING_SECONDS:STRING=${PGO_TRAINING_SECONDS}"
+                          -P "${PROJECT_SOURCE_DIR}/cmake/scripts/pgo.cmake"
+                  COMMENT "Build a PGO and LTO optimized release in ${PGO_OUTPUT_DIR}."
+                  USES_TERMINAL
+                  VERBATIM
+)
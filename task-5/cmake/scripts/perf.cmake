@@ -0,0 +1,209 @@
+# Runs a benchmark several times and compares the medians of its results to a stored baseline.
+#
+# The benchmark has to accept "--json <file>" and write the layout of bench/harness.h. Of every
+# benchmark the real time per iteration and, if present, the allocations per iteration are
+# compared. Needs CMake 3.19 for string(JSON).
+#
+# The following variables have to be defined to run this script:
+#   PROGRAM.............................The benchmark and its parameters.
+#   BASELINE............................Path of the baseline of this machine class.
+#   CURRENT.............................Path where the medians of this run are written.
+#
+# The following variables can to be defined to control the behavior:
+#   REPETITIONS.........................Runs of the benchmark the medians are taken over (default: 5).
+#   TOLERANCE...........................Slowdown in percent that still passes (default: 10).
+#   ALLOCATION_TOLERANCE................Additional allocations per iteration that still pass (default: 0.01).
+#   UPDATE..............................Write the medians to BASELINE instead of comparing.
+#
+# Without a baseline the medians are only written to CURRENT and "[PERF] No baseline" is printed,
+# copy the file to BASELINE to start comparing.
+cmake_minimum_required(VERSION 3.19)
+
+if(NOT PROGRAM OR NOT BASELINE OR NOT CURRENT)
+  message(FATAL_ERROR "[PERF] PROGRAM, BASELINE and CURRENT have to be defined (-D)")
+endif()
+if(NOT REPETITIONS)
+  set(REPETITIONS 5)
+endif()
+if(NOT DEFINED TOLERANCE)
+  set(TOLERANCE 10)
+endif()
+if(NOT DEFINED ALLOCATION_TOLERANCE)
+  set(ALLOCATION_TOLERANCE 0.01)
+endif()
+
+# Decimal string to an integer in units of 10^-digits, math() only knows integers.
+function(to_fixed value digits out)
+  if(value MATCHES "^([0-9]+)\\.([0-9]*)$")
+    set(integer "${CMAKE_MATCH_1}")
+    set(fraction "${CMAKE_MATCH_2}000000000")
+  elseif(value MATCHES "^([0-9]+)$")
+    set(integer "${CMAKE_MATCH_1}")
+    set(fraction "000000000")
+  else()
+    message(FATAL_ERROR "[PERF] Unexpected value ${value}")
+  endif()
+  string(SUBSTRING "${fraction}" 0 ${digits} fraction)
+  string(REGEX REPLACE "^0+([0-9])" "\\1" fraction "${fraction}")
+  string(REPEAT "0" ${digits} zeros)
+  math(EXPR fixed "${integer} * 1${zeros} + ${fraction}")
+  set(${out} ${fixed} PARENT_SCOPE)
+endfunction()
+
+function(from_fixed fixed digits out)
+  string(REPEAT "0" ${digits} zeros)
+  math(EXPR integer "${fixed} / 1${zeros}")
+  math(EXPR fraction "${fixed} % 1${zeros}")
+  string(LENGTH "${fraction}" len)
+  math(EXPR pad "${digits} - ${len}")
+  string(REPEAT "0" ${pad} padding)
+  set(${out} "${integer}.${padding}${fraction}" PARENT_SCOPE)
+endfunction()
+
+# Median of a list of integers.
+function(median values out)
+  list(SORT values COMPARE NATURAL)
+  list(LENGTH values count)
+  math(EXPR middle "${count} / 2")
+  list(GET values ${middle} upper)
+  if(count EQUAL 1 OR NOT count MATCHES "[02468]$")
+    set(${out} ${upper} PARENT_SCOPE)
+  else()
+    math(EXPR lower_index "${middle} - 1")
+    list(GET values ${lower_index} lower)
+    math(EXPR result "(${lower} + ${upper}) / 2")
+    set(${out} ${result} PARENT_SCOPE)
+  endif()
+endfunction()
+
+# Times in thousandths of nanoseconds and allocations in millionths, as written by the harness.
+set(TIME_DIGITS 3)
+set(ALLOCATION_DIGITS 6)
+
+#
+# Run the benchmark and collect the samples of every benchmark by name.
+#
+string(REGEX REPLACE ";" " " program_str "${PROGRAM}")
+message(STATUS "[PERF] ${REPETITIONS} runs of \"${program_str}\"")
+set(names)
+foreach(run RANGE 1 ${REPETITIONS})
+  set(result_file "${CURRENT}.run${run}")
+  execute_process(COMMAND ${PROGRAM} --json ${result_file} RESULT_VARIABLE result
+                  OUTPUT_QUIET)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "[PERF] Run ${run} failed: ${result}")
+  endif()
+  file(READ "${result_file}" json)
+  file(REMOVE "${result_file}")
+
+  string(JSON count LENGTH "${json}" benchmarks)
+  math(EXPR last "${count} - 1")
+  foreach(i RANGE ${last})
+    string(JSON name GET "${json}" benchmarks ${i} name)
+    string(MAKE_C_IDENTIFIER "${name}" key)
+    if(run EQUAL 1)
+      list(APPEND names "${name}")
+    endif()
+    string(JSON time GET "${json}" benchmarks ${i} real_time)
+    to_fixed(${time} ${TIME_DIGITS} time)
+    list(APPEND times_${key} ${time})
+    string(JSON allocations ERROR_VARIABLE missing GET "${json}" benchmarks ${i}
+           allocations_per_item)
+    if(NOT missing)
+      to_fixed(${allocations} ${ALLOCATION_DIGITS} allocations)
+      list(APPEND allocations_${key} ${allocations})
+    endif()
+  endforeach()
+endforeach()
+
+#
+# Write the medians, in the same layout so that they can serve as a baseline.
+#
+set(entries)
+foreach(name IN LISTS names)
+  string(MAKE_C_IDENTIFIER "${name}" key)
+  median("${times_${key}}" median_time_${key})
+  from_fixed(${median_time_${key}} ${TIME_DIGITS} time)
+  set(entry "    {\n      \"name\": \"${name}\",\n      \"real_time\": ${time}")
+  if(DEFINED allocations_${key})
+    median("${allocations_${key}}" median_allocations_${key})
+    from_fixed(${median_allocations_${key}} ${ALLOCATION_DIGITS} allocations)
+    string(APPEND entry ",\n      \"allocations_per_item\": ${allocations}")
+  endif()
+  list(APPEND entries "${entry}\n    }")
+endforeach()
+string(REPLACE ";" ",\n" entries "${entries}")
+string(TIMESTAMP date "%Y-%m-%dT%H:%M:%S")
+set(medians
+    "{\n  \"context\": {\n    \"date\": \"${date}\",\n    \"repetitions\": ${REPETITIONS}\n  },\n"
+    "  \"benchmarks\": [\n${entries}\n  ]\n}\n")
+file(WRITE "${CURRENT}" ${medians})
+
+if(UPDATE)
+  file(WRITE "${BASELINE}" ${medians})
+  message(STATUS "[PERF] Baseline written to ${BASELINE}")
+  return()
+endif()
+if(NOT EXISTS "${BASELINE}")
+  message(STATUS "[PERF] No baseline ${BASELINE}, the medians are in ${CURRENT}")
+  return()
+endif()
+
+#
+# Compare every benchmark of the baseline.
+#
+to_fixed(${ALLOCATION_TOLERANCE} ${ALLOCATION_DIGITS} allocation_tolerance)
+file(READ "${BASELINE}" baseline)
+string(JSON count LENGTH "${baseline}" benchmarks)
+math(EXPR last "${count} - 1")
+set(failures 0)
+foreach(i RANGE ${last})
+  string(JSON name GET "${baseline}" benchmarks ${i} name)
+  string(MAKE_C_IDENTIFIER "${name}" key)
+  if(NOT DEFINED median_time_${key})
+    message(STATUS "[PERF] ${name}: missing from the results")
+    math(EXPR failures "${failures} + 1")
+    continue()
+  endif()
+
+  string(JSON time GET "${baseline}" benchmarks ${i} real_time)
+  to_fixed(${time} ${TIME_DIGITS} base_time)
+  set(current ${median_time_${key}})
+  # change in tenths of a percent, printed with one decimal
+  math(EXPR change "(${current} - ${base_time}) * 1000 / (${base_time} + 1)")
+  set(sign "+")
+  if(change LESS 0)
+    set(sign "-")
+    math(EXPR change "-${change}")
+  endif()
+  math(EXPR change_integer "${change} / 10")
+  math(EXPR change_fraction "${change} % 10")
+  from_fixed(${current} ${TIME_DIGITS} current_str)
+  from_fixed(${base_time} ${TIME_DIGITS} base_str)
+  set(line "${name}: ${current_str} ns (baseline ${base_str}, ${sign}${change_integer}.${change_fraction}%)")
+  math(EXPR limit "${base_time} * (100 + ${TOLERANCE}) / 100")
+  if(current GREATER limit)
+    string(APPEND line " SLOWER")
+    math(EXPR failures "${failures} + 1")
+  endif()
+
+  string(JSON allocations ERROR_VARIABLE missing GET "${baseline}" benchmarks ${i}
+         allocations_per_item)
+  if(NOT missing AND DEFINED median_allocations_${key})
+    to_fixed(${allocations} ${ALLOCATION_DIGITS} base_allocations)
+    from_fixed(${median_allocations_${key}} ${ALLOCATION_DIGITS} current_str)
+    from_fixed(${base_allocations} ${ALLOCATION_DIGITS} base_str)
+    string(APPEND line ", ${current_str} allocations (baseline ${base_str})")
+    math(EXPR limit "${base_allocations} + ${allocation_tolerance}")
+    if(median_allocations_${key} GREATER limit)
+      string(APPEND line " MORE ALLOCATIONS")
+      math(EXPR failures "${failures} + 1")
+    endif()
+  endif()
+  message(STATUS "[PERF] ${line}")
+endforeach()
+
+if(failures GREATER 0)
+  message(FATAL_ERROR "[PERF] ${failures} regressions beyond ${TOLERANCE}% or "
+                      "${ALLOCATION_TOLERANCE} allocations, medians in ${CURRENT}")
+endif()
@@ -0,0 +1,212 @@
+# Builds a release of pinger with profile guided and link time optimization, in stages.
+#
+#   1. A plain Release build in OUTPUT_DIR/baseline, which also provides pinger-gen.
+#   2. The training corpus: the test captures and floods written by pinger-gen.
+#   3. An instrumented Release build in OUTPUT_DIR/build, which replays every capture of the corpus
+#      through bench_replay to record the profile in OUTPUT_DIR/profile.
+#   4. The same build reconfigured with the profile, LTO and -fno-plt. It is rebuilt in the same
+#      directory since GCC finds the profile of an object by its path.
+#   5. bench_layers and bench_replay of both builds compared by perf.cmake, the lines are also
+#      written to OUTPUT_DIR/report.txt.
+#
+# The following variables have to be defined to run this script:
+#   SOURCE_DIR..........................Source directory of the project.
+#   OUTPUT_DIR..........................Directory of the builds, the corpus and the profile.
+#   GENERATOR...........................CMake generator of the builds.
+#   CXX_COMPILER........................Compiler of the builds.
+#   COMPILER_ID.........................GNU or Clang.
+#
+# The following variables can to be defined to control the behavior:
+#   COMPILER_VERSION....................Version of the compiler, selects the flags available.
+#   LLVM_PROFDATA.......................llvm-profdata of the compiler, required for Clang.
+#   PCAP_INCLUDE_DIR, PCAP_LIBRARY......libpcap to use instead of searching for it.
+#   TRAINING_SECONDS....................Replay time per training capture (default: 1).
+#   REPORT_REPETITIONS..................Runs the benchmark medians are taken over (default: 3).
+cmake_minimum_required(VERSION 3.19)
+
+foreach(variable SOURCE_DIR OUTPUT_DIR GENERATOR CXX_COMPILER COMPILER_ID)
+  if(NOT ${variable})
+    message(FATAL_ERROR "[PGO] ${variable} has to be defined (-D)")
+  endif()
+endforeach()
+if(COMPILER_ID STREQUAL Clang AND NOT LLVM_PROFDATA)
+  message(FATAL_ERROR "[PGO] LLVM_PROFDATA has to be defined for Clang (-D)")
+elseif(NOT COMPILER_ID STREQUAL GNU AND NOT COMPILER_ID STREQUAL Clang)
+  message(FATAL_ERROR "[PGO] Unsupported compiler ${COMPILER_ID}")
+endif()
+if(NOT TRAINING_SECONDS)
+  set(TRAINING_SECONDS 1)
+endif()
+if(NOT REPORT_REPETITIONS)
+  set(REPORT_REPETITIONS 3)
+endif()
+
+set(baseline_dir "${OUTPUT_DIR}/baseline")
+set(build_dir "${OUTPUT_DIR}/build")
+set(profile_dir "${OUTPUT_DIR}/profile")
+set(corpus_dir "${OUTPUT_DIR}/corpus")
+set(report "${OUTPUT_DIR}/report.txt")
+
+include(ProcessorCount)
+ProcessorCount(jobs)
+if(jobs EQUAL 0)
+  set(jobs 1)
+endif()
+
+# Set flags replace the sanitizers of the default flags, the warnings are kept.
+set(warnings "-Wall -Wextra")
+set(configure_args -G "${GENERATOR}" -D CMAKE_BUILD_TYPE=Release
+                   -D "CMAKE_CXX_COMPILER=${CXX_COMPILER}")
+foreach(variable PCAP_INCLUDE_DIR PCAP_LIBRARY)
+  if(${variable})
+    list(APPEND configure_args -D "${variable}=${${variable}}")
+  endif()
+endforeach()
+
+if(COMPILER_ID STREQUAL GNU)
+  set(generate_flags "-fprofile-generate=${profile_dir}")
+  # code the training does not reach, like the live capture, is optimized as usual, not for size
+  set(use_flags "-fprofile-use=${profile_dir} -fprofile-correction -Wno-missing-profile")
+  if(COMPILER_VERSION VERSION_GREATER_EQUAL 10)
+    string(APPEND use_flags " -fprofile-partial-training")
+  endif()
+else()
+  set(generate_flags "-fprofile-generate=${profile_dir}")
+  set(use_flags "-fprofile-use=${profile_dir}/pinger.profdata")
+  string(APPEND use_flags " -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date")
+endif()
+
+# Configure dir with flags and the further arguments and build the binaries of the pipeline.
+function(stage name dir flags)
+  message(STATUS "[PGO] ${name} build in ${dir}")
+  execute_process(COMMAND "${CMAKE_COMMAND}" -S "${SOURCE_DIR}" -B "${dir}" ${configure_args}
+                          -D "CMAKE_CXX_FLAGS=${flags}" ${ARGN}
+                  RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "[PGO] Configuring the ${name} build failed:\n${output}")
+  endif()
+  execute_process(COMMAND "${CMAKE_COMMAND}" --build "${dir}" -j ${jobs}
+                          --target pinger pinger-gen bench_layers bench_replay
+                  RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "[PGO] The ${name} build failed:\n${output}")
+  endif()
+endfunction()
+
+# Run a command and stop on failure.
+function(run)
+  execute_process(COMMAND ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output
+                  ERROR_VARIABLE output)
+  if(NOT result EQUAL 0)
+    string(REPLACE ";" " " command "${ARGN}")
+    message(FATAL_ERROR "[PGO] \"${command}\" failed: ${result}\n${output}")
+  endif()
+endfunction()
+
+#
+# 1. Baseline
+#
+stage(Baseline "${baseline_dir}" "${warnings}" -D CMAKE_INTERPROCEDURAL_OPTIMIZATION=OFF)
+
+#
+# 2. Training corpus, the test captures and floods of one kind from many peers
+#
+file(MAKE_DIRECTORY "${corpus_dir}")
+set(floods mixed echo arp syn udp)
+set(flood_mixed -n 50000 --sources 4096 --sizes 0,56,512,1472
+    --mix arp=2,echo=70,foreign=4,vlan=4,fragment=4,malformed=6,udp=5,syn=5)
+set(flood_echo -n 50000 --sources 65536 --sizes 56,1472 --mix echo=1)
+set(flood_arp -n 20000 --sources 65536 --mix arp=1)
+set(flood_syn -n 50000 --sources 65536 --mix syn=1)
+set(flood_udp -n 50000 --sources 65536 --sizes 64,512 --mix udp=1)
+set(generated)
+foreach(name IN LISTS floods)
+  set(capture "${corpus_dir}/${name}.pcapng")
+  run("${baseline_dir}/pinger-gen" -o "${capture}" ${flood_${name}})
+  list(APPEND generated "${capture}")
+endforeach()
+file(GLOB captures "${SOURCE_DIR}/tests/*.pcapng")
+list(APPEND captures ${generated})
+
+# the services of the tests, so that UDP, TCP and HTTP are trained too
+set(replay_args --udp-echo 7 --http-inspect 80)
+
+#
+# 3. Instrumented build and training
+#
+stage(Instrumented "${build_dir}" "${warnings} ${generate_flags}"
+      -D CMAKE_INTERPROCEDURAL_OPTIMIZATION=OFF -D CMAKE_EXE_LINKER_FLAGS=)
+file(REMOVE_RECURSE "${profile_dir}")
+file(MAKE_DIRECTORY "${profile_dir}")
+list(LENGTH captures count)
+message(STATUS "[PGO] Training on ${count} captures, ${TRAINING_SECONDS} s each")
+foreach(capture IN LISTS captures)
+  run("${build_dir}/bench_replay" "${capture}" --seconds ${TRAINING_SECONDS} ${replay_args})
+endforeach()
+
+if(COMPILER_ID STREQUAL Clang)
+  file(GLOB raw_profiles "${profile_dir}/*.profraw")
+  run("${LLVM_PROFDATA}" merge "-output=${profile_dir}/pinger.profdata" ${raw_profiles})
+endif()
+
+#
+# 4. Optimized build
+#
+stage(Optimized "${build_dir}" "${warnings} ${use_flags} -fno-plt"
+      -D CMAKE_INTERPROCEDURAL_OPTIMIZATION=ON
+      # calls through the GOT without a PLT are resolved at load time
+      -D "CMAKE_EXE_LINKER_FLAGS=-Wl,-z,now")
+
+#
+# 5. Benchmark deltas
+#
+set(reports layers replay.test)
+set(report_layers bench_layers --min-time 0.05 --repetitions 1)
+set(report_replay.test bench_replay "${SOURCE_DIR}/tests/arp.req+3xicmp_echo.pcapng"
+    --seconds 0.5)
+foreach(name IN LISTS floods)
+  list(APPEND reports replay.${name})
+  set(report_replay.${name} bench_replay "${corpus_dir}/${name}.pcapng" --seconds 0.5
+      ${replay_args})
+endforeach()
+
+file(WRITE "${report}" "")
+set(slower 0)
+foreach(name IN LISTS reports)
+  set(arguments ${report_${name}})
+  list(POP_FRONT arguments program)
+  foreach(variant baseline build)
+    if(variant STREQUAL baseline)
+      set(update ON)
+    else()
+      set(update OFF)
+    endif()
+    execute_process(COMMAND "${CMAKE_COMMAND}"
+                            -D "PROGRAM:STRING=${${variant}_dir}/${program};${arguments}"
+                            -D "BASELINE:STRING=${OUTPUT_DIR}/${name}.baseline.json"
+                            -D "CURRENT:STRING=${OUTPUT_DIR}/${name}.${variant}.json"
+                            -D "REPETITIONS:STRING=${REPORT_REPETITIONS}"
+                            -D "UPDATE:BOOL=${update}"
+                            -P "${CMAKE_CURRENT_LIST_DIR}/perf.cmake"
+                    RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+    if(NOT update)
+      # only the lines of the comparison, without the "-- [PERF] " prefix
+      string(REGEX MATCHALL "\\[PERF\\] [^\n]+: [^\n]+ ns \\(baseline[^\n]*" lines "${output}")
+      foreach(line IN LISTS lines)
+        string(REPLACE "[PERF] " "" line "${line}")
+        message(STATUS "[PGO] ${line}")
+        file(APPEND "${report}" "${line}\n")
+      endforeach()
+      if(NOT result EQUAL 0)
+        math(EXPR slower "${slower} + 1")
+      endif()
+    elseif(NOT result EQUAL 0)
+      message(FATAL_ERROR "[PGO] Benchmarking the baseline failed:\n${output}")
+    endif()
+  endforeach()
+endforeach()
+
+if(slower GREATER 0)
+  message(WARNING "[PGO] ${slower} suites have benchmarks slower than the baseline, see ${report}")
+endif()
+message(STATUS "[PGO] Optimized binaries in ${build_dir}, benchmark deltas in ${report}")
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef> // size_t
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Fixed pool of equally sized packet buffers.
+//
+// Frames that outlive the capture callback are copied into a buffer once. Upper layers then hand
+// out pointers into that buffer and build replies in place, using the headroom in front of the
+// payload for the protocol headers.
+class BufferPool {
+public:
+  static constexpr size_t BUFFER_SIZE = 2048;
+
+  BufferPool(size_t count) : storage(new uint8_t[count * BUFFER_SIZE]) {
+    free_list.reserve(count);
+    for (size_t i = count; i > 0; i--)
+      free_list.push_back(i - 1);
+  }
+
+  // Returns the index of a free buffer or -1 if the pool is exhausted.
+  int32_t alloc() {
+    if (free_list.empty())
+      return -1;
+    int32_t index = free_list.back();
+    free_list.pop_back();
+    return index;
+  }
+
+  void free(int32_t index) { free_list.push_back(index); }
+
+  uint8_t *data(int32_t index) { return storage.get() + (size_t)index * BUFFER_SIZE; }
+
+  size_t available() const { return free_list.size(); }
+
+private:
+  std::unique_ptr<uint8_t[]> storage;
+  std::vector<int32_t> free_list;
+};
@@ -0,0 +1,3 @@
+#include "clock.h"
+
+thread_local uint64_t Clock::packet_time = 0;
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <ctime> // clock_gettime
+
+namespace Clock {
+// Capture timestamp of the frame that is currently being handled, in nanoseconds since the epoch.
+// Protocols use it instead of the system clock so that replaying a capture behaves the same way
+// as handling it live.
+extern thread_local uint64_t packet_time;
+
+constexpr uint64_t NS_PER_SEC = 1000000000;
+
+inline uint64_t monotonic() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Same time base as the capture timestamps of a live interface.
+inline uint64_t realtime() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+} // namespace Clock
@@ -0,0 +1,120 @@
+#include "counters.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Counters;
+
+constexpr uint32_t Segment::MAGIC;
+constexpr uint32_t Segment::VERSION;
+constexpr size_t Segment::NAME_SIZE;
+
+const char *const Counters::NAMES[COUNTERS + GAUGES] = {
+#define VALUE_NAME(id, name) name,
+    COUNTER_LIST(VALUE_NAME) GAUGE_LIST(VALUE_NAME)
+#undef VALUE_NAME
+};
+
+// counts of code running outside of a stack instance end up here
+static Block unattached;
+
+thread_local Block *Counters::local = &unattached;
+
+BlockPtr Counters::allocate() {
+  return BlockPtr(static_cast<Block *>(Fixed::allocate(sizeof(Block), alignof(Block))));
+}
+
+// distance of the blocks of a segment with count values each
+static size_t block_stride(size_t count) {
+  return (count * sizeof(uint64_t) + alignof(Block) - 1) & ~(alignof(Block) - 1);
+}
+
+static void segment_path(long pid, char *path, size_t len) {
+  snprintf(path, len, "/dev/shm/pinger.%ld", pid);
+}
+
+Segment::Segment(void *memory, size_t size, size_t offset, bool owner, const char *path)
+    : memory(memory), size(size), offset(offset), owner(owner) {
+  snprintf(this->path, sizeof(this->path), "%s", path);
+}
+
+Segment::~Segment() {
+  munmap(memory, size);
+  if (owner)
+    unlink(path);
+}
+
+std::unique_ptr<Segment> Segment::create(size_t blocks) {
+  size_t offset = sizeof(Header) + (COUNTERS + GAUGES) * NAME_SIZE;
+  offset = (offset + alignof(Block) - 1) & ~(alignof(Block) - 1);
+  size_t size = offset + blocks * sizeof(Block);
+
+  char path[64];
+  segment_path(getpid(), path, sizeof(path));
+  // the name is predictable and the directory world writable: a file left by an earlier process
+  // of this pid is removed, anything that still or again is there, like a planted symlink, fails
+  unlink(path);
+  int fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return nullptr;
+  void *memory = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    unlink(path);
+    return nullptr;
+  }
+
+  // the file is zero filled, write the names and publish the header last
+  for (size_t i = 0; i < COUNTERS + GAUGES; i++)
+    strncpy((char *)memory + sizeof(Header) + i * NAME_SIZE, NAMES[i], NAME_SIZE - 1);
+  Header header = {0, VERSION, (uint32_t)COUNTERS, (uint32_t)GAUGES, (uint32_t)blocks,
+                   (uint64_t)getpid(), offset};
+  memcpy(memory, &header, sizeof(header));
+  __atomic_store_n(static_cast<uint32_t *>(memory), MAGIC, __ATOMIC_RELEASE);
+
+  return std::unique_ptr<Segment>(new Segment(memory, size, offset, true, path));
+}
+
+std::unique_ptr<Segment> Segment::open(long pid) {
+  char path[64];
+  segment_path(pid, path, sizeof(path));
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  void *memory = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+    memory = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    return nullptr;
+
+  std::unique_ptr<Segment> segment(new Segment(memory, st.st_size, 0, false, path));
+  const Header &header = segment->header();
+  if (__atomic_load_n(&header.magic, __ATOMIC_ACQUIRE) != MAGIC || header.version != VERSION ||
+      header.block_offset + header.blocks * block_stride(header.counters + header.gauges) >
+          (size_t)st.st_size ||
+      sizeof(Header) + (header.counters + header.gauges) * NAME_SIZE > header.block_offset)
+    return nullptr;
+  segment->offset = header.block_offset;
+  return segment;
+}
+
+uint64_t Segment::total(size_t i) const {
+  uint64_t sum = 0;
+  auto blocks = reinterpret_cast<const uint8_t *>(memory) + offset;
+  size_t stride = block_stride(header().counters + header().gauges);
+  for (size_t block = 0; block < header().blocks; block++) {
+    auto value = reinterpret_cast<const uint64_t *>(blocks + block * stride) + i;
+    sum += __atomic_load_n(value, __ATOMIC_RELAXED);
+  }
+  return sum;
+}
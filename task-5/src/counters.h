@@ -0,0 +1,179 @@
+#pragma once
+// Packet counters and gauges of the protocol stack.
+//
+// Every stack instance counts into a block of its own which only the thread running the instance
+// writes, so counting is a plain increment without read-modify-write atomics or syscalls. Gauges
+// (pool and ring occupancy) are stored into the same block whenever the services are polled.
+// Blocks are cache line aligned so that instances on different cores never share a line. A
+// Segment publishes the blocks of a process in /dev/shm/pinger.<pid>, where pinger-stat reads and
+// sums them while the process runs.
+#include "fixed_tables.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// X(id, name): every counter and the name it is published under.
+// clang-format off
+#define COUNTER_LIST(X)                                    \
+  X(ETH_RX_FRAMES,      "ethernet.rx.frames")              \
+  X(ETH_RX_BYTES,       "ethernet.rx.bytes")               \
+  X(ETH_RX_IPV4,        "ethernet.rx.ipv4")                \
+  X(ETH_RX_ARP,         "ethernet.rx.arp")                 \
+  X(ETH_RX_OTHER,       "ethernet.rx.other")               \
+  X(ETH_DROP_SHORT,     "ethernet.drop.short")             \
+  X(ETH_DROP_NOT_OURS,  "ethernet.drop.not_ours")          \
+  X(ETH_TX_FRAMES,      "ethernet.tx.frames")              \
+  X(ETH_TX_BYTES,       "ethernet.tx.bytes")               \
+  X(ARP_RX_REQUESTS,    "arp.rx.requests")                 \
+  X(ARP_RX_REPLIES,     "arp.rx.replies")                  \
+  X(ARP_TX_REQUESTS,    "arp.tx.requests")                 \
+  X(ARP_TX_REPLIES,     "arp.tx.replies")                  \
+  X(ARP_DROP_INVALID,   "arp.drop.invalid")                \
+  X(ARP_DROP_DENIED,    "arp.drop.denied")                 \
+  X(ARP_EVICTED,        "arp.evicted")                     \
+  X(IPV4_RX_PACKETS,    "ipv4.rx.packets")                 \
+  X(IPV4_RX_ICMP,       "ipv4.rx.icmp")                    \
+  X(IPV4_RX_UDP,        "ipv4.rx.udp")                     \
+  X(IPV4_RX_TCP,        "ipv4.rx.tcp")                     \
+  X(IPV4_DROP_SHORT,    "ipv4.drop.short")                 \
+  X(IPV4_DROP_VERSION,  "ipv4.drop.version")               \
+  X(IPV4_DROP_NOT_OURS, "ipv4.drop.not_ours")              \
+  X(IPV4_DROP_PROTOCOL, "ipv4.drop.protocol")              \
+  X(IPV4_DROP_LENGTH,   "ipv4.drop.length")                \
+  X(IPV4_TX_PACKETS,    "ipv4.tx.packets")                 \
+  X(IPV4_TX_NO_ROUTE,   "ipv4.tx.no_route")                \
+  X(IPV4_TX_UNRESOLVED, "ipv4.tx.unresolved")              \
+  X(IPV4_TX_HEADER_HITS, "ipv4.tx.header_hits")            \
+  X(IPV4_TX_HEADER_MISSES, "ipv4.tx.header_misses")        \
+  X(ICMP_RX_PINGS,      "icmp.rx.pings")                   \
+  X(ICMP_RX_PONGS,      "icmp.rx.pongs")                   \
+  X(ICMP_TX_PONGS,      "icmp.tx.pongs")                   \
+  X(ICMP_DROP_SHORT,    "icmp.drop.short")                 \
+  X(ICMP_DROP_LIMIT,    "icmp.drop.rate_limit")            \
+  X(ICMP_DROP_TYPE,     "icmp.drop.type")                  \
+  X(ICMP_DROP_DENIED,   "icmp.drop.denied")                \
+  X(UDP_RX_DATAGRAMS,   "udp.rx.datagrams")                \
+  X(UDP_TX_DATAGRAMS,   "udp.tx.datagrams")                \
+  X(UDP_DROP_MALFORMED, "udp.drop.malformed")              \
+  X(UDP_DROP_CHECKSUM,  "udp.drop.checksum")               \
+  X(UDP_DROP_NO_PORT,   "udp.drop.no_port")                \
+  X(UDP_DROP_REFLECTOR, "udp.drop.reflector")              \
+  X(UDP_DROP_TOO_LARGE, "udp.drop.too_large")              \
+  X(UDP_DROP_QUEUE,     "udp.drop.queue_full")             \
+  X(TCP_RX_SEGMENTS,    "tcp.rx.segments")                 \
+  X(TCP_TX_SEGMENTS,    "tcp.tx.segments")                 \
+  X(TCP_TX_RESETS,      "tcp.tx.resets")                   \
+  X(TCP_ACCEPTED,       "tcp.accepted")                    \
+  X(TCP_EXPIRED,        "tcp.expired")                     \
+  X(TCP_DROP_MALFORMED, "tcp.drop.malformed")              \
+  X(TCP_DROP_CHECKSUM,  "tcp.drop.checksum")              \
+  X(FLOWS_CREATED,      "flows.created")                   \
+  X(FLOWS_EXPIRED,      "flows.expired")                   \
+  X(FLOWS_DROP_FULL,    "flows.drop.full")                 \
+  X(FLOOD_ALERTS,       "flood.alerts")
+
+// X(id, name): every gauge, stored behind the counters.
+#define GAUGE_LIST(X)                                      \
+  X(ARP_NEIGHBOURS,     "arp.neighbours")                  \
+  X(UDP_BUFFERS_USED,   "udp.buffers_used")                \
+  X(TCP_CONNECTIONS,    "tcp.connections")                 \
+  X(HTTP_PARSERS_USED,  "http.parsers_used")               \
+  X(FLOWS_ACTIVE,       "flows.active")                    \
+  X(RING_RX_USED,       "pipeline.rx_ring_used")           \
+  X(RING_TX_USED,       "pipeline.tx_ring_used")
+// clang-format on
+
+namespace Counters {
+enum Counter : size_t {
+#define COUNTER_ENUM(id, name) id,
+  COUNTER_LIST(COUNTER_ENUM)
+#undef COUNTER_ENUM
+      COUNTERS
+};
+
+enum Gauge : size_t {
+#define GAUGE_ENUM(id, name) id,
+  GAUGE_LIST(GAUGE_ENUM)
+#undef GAUGE_ENUM
+      GAUGES
+};
+
+// names of the counters followed by those of the gauges
+extern const char *const NAMES[COUNTERS + GAUGES];
+
+struct alignas(64) Block {
+  uint64_t values[COUNTERS + GAUGES];
+};
+
+// block of the instance running on this thread, see Stack
+extern thread_local Block *local;
+
+// Only the owning thread writes, so a relaxed load and store suffice for readers on other threads
+// to see whole values. On x86 this is the same plain add.
+inline void count(Counter counter, uint64_t n = 1) {
+  uint64_t *value = &local->values[counter];
+  __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+inline void set(Gauge gauge, uint64_t value) {
+  __atomic_store_n(&local->values[COUNTERS + gauge], value, __ATOMIC_RELAXED);
+}
+
+// Value i of a block (counters, then gauges) as seen from another thread.
+inline uint64_t load(const Block &block, size_t i) {
+  return __atomic_load_n(&block.values[i], __ATOMIC_RELAXED);
+}
+
+using BlockPtr = std::unique_ptr<Block, Fixed::FreeDeleter>;
+
+// A zeroed block outside of any segment.
+BlockPtr allocate();
+
+// Memory layout of /dev/shm/pinger.<pid>: the header, the names of the counters and gauges
+// (NAME_SIZE bytes each, NUL-terminated) and the blocks at block_offset. A reader has to check
+// magic and version. The values are written without synchronisation, aligned 64-bit loads still
+// see whole values.
+class Segment {
+public:
+  static constexpr uint32_t MAGIC = 0x676e6970; // "ping"
+  static constexpr uint32_t VERSION = 2;
+  static constexpr size_t NAME_SIZE = 32;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t counters;
+    uint32_t gauges;
+    uint32_t blocks;
+    uint64_t pid;
+    uint64_t block_offset;
+  };
+
+  // Create the segment of the calling process. Returns nullptr if it cannot be created.
+  static std::unique_ptr<Segment> create(size_t blocks);
+
+  // Map the segment of another process read-only. Returns nullptr if there is none or it has an
+  // unknown layout.
+  static std::unique_ptr<Segment> open(long pid);
+
+  ~Segment();
+
+  const Header &header() const { return *reinterpret_cast<const Header *>(memory); }
+  const char *name(size_t i) const { return (const char *)memory + sizeof(Header) + i * NAME_SIZE; }
+  Block *block(size_t i) { return reinterpret_cast<Block *>((uint8_t *)memory + offset) + i; }
+
+  // Sum of value i (a counter or a gauge) over all blocks, safe to call while the owner is
+  // counting.
+  uint64_t total(size_t i) const;
+
+private:
+  void *memory;
+  size_t size;
+  size_t offset;
+  bool owner;
+  char path[64];
+
+  Segment(void *memory, size_t size, size_t offset, bool owner, const char *path);
+};
+} // namespace Counters
@@ -0,0 +1,26 @@
+#include "fixed_tables.h"
+
+#include <cstring>
+#include <new>
+#include <random>
+
+#include <sys/mman.h> // madvise
+
+static constexpr size_t HUGE_PAGE = 2 << 20;
+
+void *Fixed::allocate(size_t size, size_t align) {
+  if (size >= HUGE_PAGE)
+    align = std::max(align, HUGE_PAGE);
+  void *memory;
+  if (posix_memalign(&memory, align, size))
+    throw std::bad_alloc();
+  if (size >= HUGE_PAGE)
+    madvise(memory, size, MADV_HUGEPAGE); // only a hint
+  memset(memory, 0, size);
+  return memory;
+}
+
+uint64_t Fixed::random_seed() {
+  std::random_device random;
+  return (uint64_t)random() << 32 | random();
+}
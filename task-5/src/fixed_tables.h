@@ -0,0 +1,40 @@
+#pragma once
+// Building blocks of the tables the stack allocates once and never grows: the neighbour cache, the
+// rate limit buckets, the flow table, the flood and traffic sketches and the counter blocks.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib> // free
+#include <memory>
+
+namespace Fixed {
+constexpr size_t CACHE_LINE = 64;
+
+struct FreeDeleter {
+  void operator()(void *p) const { free(p); }
+};
+
+template <typename T> using Array = std::unique_ptr<T[], FreeDeleter>;
+
+// size zero filled bytes aligned to align, released with free. Memory spanning a huge page is
+// asked to be backed by huge pages: the tables are read at random, so with small pages almost
+// every lookup of a large one misses the TLB on top of the caches.
+void *allocate(size_t size, size_t align);
+
+// count zero filled elements, each at least cache line aligned if T is.
+template <typename T> Array<T> allocate(size_t count) {
+  return Array<T>(static_cast<T *>(allocate(count * sizeof(T), std::max(alignof(T), CACHE_LINE))));
+}
+
+// The finalizer of MurmurHash3, every input bit affects every output bit.
+inline uint64_t mix(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccd;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53;
+  return key ^ (key >> 33);
+}
+
+// A seed for hashing keys taken from packets, so that spoofed sources cannot aim at one bucket.
+uint64_t random_seed();
+} // namespace Fixed
@@ -0,0 +1,110 @@
+#include "flood.h"
+#include "counters.h"
+#include "logging.h"
+
+#include <algorithm>
+
+using namespace Flood;
+
+constexpr size_t Detector::KINDS;
+constexpr size_t Detector::DEPTH;
+constexpr size_t Detector::WIDTH_LOG2;
+constexpr size_t Detector::SETS_LOG2;
+constexpr size_t Detector::WAYS;
+
+static_assert(Detector::DEPTH * Detector::WIDTH_LOG2 + Detector::SETS_LOG2 <= 64,
+              "the rows and the set are indexed by separate bits of one hash");
+
+Detector::Detector(uint64_t window, const uint32_t (&thresholds)[KINDS], uint64_t deny)
+    : cells(Fixed::allocate<Cell>(DEPTH << WIDTH_LOG2)),
+      sets(Fixed::allocate<Set>((size_t)1 << SETS_LOG2)), window(window),
+      deny_windows((deny + window - 1) / window), seed(Fixed::random_seed()) {
+  std::copy(thresholds, thresholds + KINDS, this->thresholds);
+}
+
+void Detector::advance(uint64_t now) {
+  if (!current) {
+    begin = now - now % window;
+    current = 1;
+    return;
+  }
+  if (now < begin + window)
+    return;
+
+  uint64_t windows = (now - begin) / window;
+  current += windows;
+  begin += windows * window;
+}
+
+void Detector::rotate(Cell &cell) const {
+  if (cell.window == current)
+    return;
+  // the window counted becomes the previous one, after a longer gap both are empty
+  cell.previous = cell.window + 1 == current ? cell.current : 0;
+  cell.current = 0;
+  cell.window = current;
+}
+
+Detector::Entry *Detector::find(uint32_t src_ip, Kind kind, uint64_t hash, bool insert) {
+  Set &set = sets[(hash >> (DEPTH * WIDTH_LOG2)) & (((size_t)1 << SETS_LOG2) - 1)];
+  // the entry alerted or denied longest ago gives way
+  auto age = [](const Entry &entry) { return std::max(entry.alerted, entry.deny_until); };
+  Entry *oldest = &set.entries[0];
+  for (Entry &entry : set.entries) {
+    if (entry.alerted && entry.src_ip == src_ip && entry.kind == kind)
+      return &entry;
+    if (age(entry) < age(*oldest))
+      oldest = &entry;
+  }
+  if (!insert)
+    return nullptr;
+  *oldest = {src_ip, kind, 0, 0};
+  return oldest;
+}
+
+bool Detector::check(Kind kind, uint32_t src_ip, uint64_t now) {
+  uint32_t threshold = thresholds[kind];
+  if (!threshold)
+    return true;
+  advance(now);
+
+  // share of the previous window the sliding one still covers, in 1/65536
+  uint64_t elapsed = std::min(now > begin ? now - begin : 0, window);
+  uint64_t weight = ((window - elapsed) << 16) / window;
+
+  uint64_t hash = Fixed::mix(((uint64_t)kind << 32 | src_ip) ^ seed);
+  uint64_t estimate = UINT64_MAX;
+  for (size_t row = 0; row < DEPTH; row++) {
+    size_t column = (hash >> (row * WIDTH_LOG2)) & (((size_t)1 << WIDTH_LOG2) - 1);
+    Cell &cell = cells[row << WIDTH_LOG2 | column];
+    rotate(cell);
+    if (cell.current != UINT32_MAX)
+      cell.current++;
+    estimate = std::min(estimate, cell.current + (cell.previous * weight >> 16));
+  }
+
+  if (estimate >= threshold) {
+    Entry *entry = find(src_ip, kind, hash, true);
+    if (entry->alerted != current) {
+      entry->alerted = current;
+      if (deny_windows) {
+        entry->deny_until = current + deny_windows;
+        last_deny = std::max(last_deny, entry->deny_until);
+      }
+      alert_count++;
+      Counters::count(Counters::FLOOD_ALERTS);
+      IPv4::Address src = {src_ip};
+      log_flood_alert(kind == ARP_REQUEST ? "ARP" : "ICMP", &src, estimate, threshold,
+                      deny_windows != 0);
+    }
+  }
+
+  // most of the time nobody is denied and the set is not even looked at
+  if (current > last_deny)
+    return true;
+  Entry *entry = find(src_ip, kind, hash, false);
+  if (!entry || current > entry->deny_until)
+    return true;
+  denied_count++;
+  return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "fixed_tables.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Flood {
+// Sources sending ARP or ICMP echo requests at a rate above a threshold, like scanners and
+// flooding hosts.
+//
+// Requests are counted per source in a count-min sketch: DEPTH rows of counters, each indexed by
+// another part of one hash of the source, and the lowest of its counters is an estimate that is
+// never too low. Every counter holds the requests of the current and of the previous window. The
+// estimate is those of the current window plus the share of the previous one that a window
+// sliding along with the capture time still covers, so the count decays smoothly instead of
+// dropping to zero at every window boundary. Counters remember the window they were last counted
+// in and move on to the current one when they are next used, so a new window costs nothing.
+//
+// A source whose estimate reaches the threshold of its kind is alerted once per window. With a
+// deny time its requests of that kind are refused for that long, rounded up to whole windows.
+// Refused requests are still counted, so a source that keeps flooding is alerted again and stays
+// denied. Alerted sources are kept in a fixed number of sets of four like the buckets of
+// ICMP::RateLimiter, so a flood of spoofed sources only ever evicts entries.
+class Detector {
+public:
+  enum Kind { ARP_REQUEST = 0, ECHO_REQUEST };
+  static constexpr size_t KINDS = 2;
+
+  static constexpr size_t DEPTH = 4;
+  static constexpr size_t WIDTH_LOG2 = 11;
+  static constexpr size_t SETS_LOG2 = 8;
+  static constexpr size_t WAYS = 4;
+
+  // Thresholds in requests per window for each kind, 0 does not check that kind. Sources stay
+  // denied for deny nanoseconds after their last alert, none are with 0.
+  Detector(uint64_t window, const uint32_t (&thresholds)[KINDS], uint64_t deny);
+
+  // Count a request of kind from src_ip (network byte order) at now, alert if it crosses the
+  // threshold. Returns false if the request is to be refused.
+  bool check(Kind kind, uint32_t src_ip, uint64_t now);
+
+  uint64_t alerts() const { return alert_count; }
+  uint64_t denied() const { return denied_count; }
+
+private:
+  struct Cell {
+    uint32_t window; // that current counts
+    uint32_t current;
+    uint32_t previous;
+  };
+
+  struct Entry {
+    uint32_t src_ip; // network byte order
+    uint32_t kind;
+    uint32_t alerted;    // window of the last alert, 0 for unused entries
+    uint32_t deny_until; // window
+  };
+
+  struct alignas(64) Set {
+    Entry entries[WAYS];
+  };
+  static_assert(sizeof(Set) == 64, "a set should fill exactly one cache line");
+
+  Fixed::Array<Cell> cells; // DEPTH rows
+  Fixed::Array<Set> sets;
+  uint64_t window;
+  uint32_t thresholds[KINDS];
+  uint32_t deny_windows;  // after the window of an alert
+  uint64_t begin = 0;     // of the current window
+  uint32_t current = 0;   // window, counted from 1
+  uint32_t last_deny = 0; // window, no source is denied after it
+  uint64_t seed;
+  uint64_t alert_count = 0;
+  uint64_t denied_count = 0;
+
+  void advance(uint64_t now);
+  void rotate(Cell &cell) const;
+  Entry *find(uint32_t src_ip, Kind kind, uint64_t hash, bool insert);
+};
+} // namespace Flood
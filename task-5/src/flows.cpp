@@ -0,0 +1,288 @@
+#include "flows.h"
+#include "counters.h"
+#include "header_view.h"
+#include "logging.h"
+#include "icmp/icmp.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <netinet/in.h> // IPPROTO_*
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Flows;
+
+constexpr size_t Table::GROUP;
+constexpr size_t Table::BATCH;
+
+// Control bytes of empty and deleted slots, full ones hold 7 bits of the hash of their key. Free
+// slots are the ones with the sign bit set.
+static constexpr int8_t EMPTY = -128;
+static constexpr int8_t DELETED = -2;
+
+
+// source and destination port, the same in UDP and TCP
+using SourcePort = HeaderView::Field<0, uint16_t>;
+using DestinationPort = HeaderView::Field<2, uint16_t>;
+
+namespace {
+// The control bytes of a group, matches return a mask with bit i set for slot i.
+struct Group {
+#ifdef __SSE2__
+  __m128i control;
+
+  explicit Group(const int8_t *p) : control(_mm_load_si128(reinterpret_cast<const __m128i *>(p))) {}
+
+  uint32_t match(int8_t bits) const {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(bits), control));
+  }
+  uint32_t free() const { return _mm_movemask_epi8(control); }
+#else
+  const int8_t *control;
+
+  explicit Group(const int8_t *p) : control(p) {}
+
+  uint32_t match(int8_t bits) const {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < Table::GROUP; i++)
+      mask |= uint32_t(control[i] == bits) << i;
+    return mask;
+  }
+  uint32_t free() const {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < Table::GROUP; i++)
+      mask |= uint32_t(control[i] < 0) << i;
+    return mask;
+  }
+#endif
+  uint32_t empty() const { return match(EMPTY); }
+  uint32_t full() const { return ~free() & 0xffff; }
+};
+} // namespace
+
+// at most 7/8 of the slots are used or deleted, so every probe finds an empty slot
+static size_t load_limit(size_t slots) { return slots - slots / 8; }
+
+// at most 25/32 of the slots hold flows, the rest is room for deleted ones
+static size_t max_load(size_t slots) { return slots / 32 * 25; }
+
+Table::Table(size_t max_flows, uint64_t timeout) : max_flows(max_flows), timeout(timeout) {
+  slots = 2 * GROUP;
+  while (max_load(slots) < max_flows)
+    slots *= 2;
+  allocate();
+  seed = Fixed::random_seed();
+}
+
+void Table::allocate() {
+  control = Fixed::allocate<int8_t>(slots);
+  memset(control.get(), EMPTY, slots);
+  flows = Fixed::allocate<Flow>(slots);
+}
+
+uint64_t Table::hash(const Key &key) const {
+  uint64_t a, b;
+  memcpy(&a, &key, sizeof(a));
+  memcpy(&b, reinterpret_cast<const uint8_t *>(&key) + sizeof(a), sizeof(b));
+  uint64_t h = (a ^ seed) * 0x9e3779b97f4a7c15;
+  h = (h ^ (h >> 32) ^ b) * 0xbf58476d1ce4e5b9;
+  return h ^ (h >> 31);
+}
+
+// The groups a hash probes, quadratically: with a power of two groups the triangular steps visit
+// every group once.
+#define FOR_EACH_GROUP(hash, group)                                                               \
+  for (size_t mask = slots / GROUP - 1, group = ((hash) >> 7) & mask, step = 1;;                  \
+       group = (group + step++) & mask)
+
+size_t Table::find_slot(const Key &key, uint64_t hash) const {
+  int8_t bits = hash & 0x7f;
+  FOR_EACH_GROUP(hash, group) {
+    Group g(&control[group * GROUP]);
+    for (uint32_t match = g.match(bits); match; match &= match - 1) {
+      size_t slot = group * GROUP + __builtin_ctz(match);
+      if (memcmp(&flows[slot].key, &key, sizeof(Key)) == 0)
+        return slot;
+    }
+    if (g.empty())
+      return slots;
+  }
+}
+
+size_t Table::insert_slot(uint64_t hash) const {
+  FOR_EACH_GROUP(hash, group) {
+    uint32_t free = Group(&control[group * GROUP]).free();
+    if (free)
+      return group * GROUP + __builtin_ctz(free);
+  }
+}
+
+bool Table::update(const Key &key, size_t bytes, uint64_t now) {
+  return update(key, hash(key), bytes, now);
+}
+
+size_t Table::update(const Packet *packets, size_t n) {
+  size_t dropped = 0;
+  uint64_t hashes[BATCH];
+  for (size_t start = 0; start < n; start += BATCH) {
+    const Packet *batch = packets + start;
+    size_t count = std::min(n - start, BATCH);
+
+    size_t mask = slots / GROUP - 1;
+    for (size_t i = 0; i < count; i++) {
+      hashes[i] = hash(batch[i].key);
+      __builtin_prefetch(&control[(hashes[i] >> 7 & mask) * GROUP]);
+    }
+    // the flow of the first match in the first group, which is the one almost always
+    for (size_t i = 0; i < count; i++) {
+      size_t group = hashes[i] >> 7 & mask;
+      uint32_t match = Group(&control[group * GROUP]).match(hashes[i] & 0x7f);
+      if (match) {
+        const Flow *flow = &flows[group * GROUP + __builtin_ctz(match)];
+        __builtin_prefetch(flow);
+        __builtin_prefetch(reinterpret_cast<const uint8_t *>(flow + 1) - 1);
+      }
+    }
+    for (size_t i = 0; i < count; i++)
+      dropped += !update(batch[i].key, hashes[i], batch[i].bytes, batch[i].time);
+  }
+  return dropped;
+}
+
+bool Table::update(const Key &key, uint64_t h, size_t bytes, uint64_t now) {
+  latest = std::max(latest, now);
+  size_t slot = find_slot(key, h);
+  if (slot == slots) {
+    if (used >= max_flows) {
+      Counters::count(Counters::FLOWS_DROP_FULL);
+      return false;
+    }
+    if (used + deleted >= load_limit(slots))
+      rehash();
+    slot = insert_slot(h);
+    if (control[slot] == DELETED)
+      deleted--;
+    control[slot] = h & 0x7f;
+    flows[slot] = {key, {0, 0, now, now}};
+    used++;
+    Counters::count(Counters::FLOWS_CREATED);
+  }
+
+  Stats &stats = flows[slot].stats;
+  stats.packets++;
+  stats.bytes += bytes;
+  stats.last_seen = std::max(stats.last_seen, now);
+  return true;
+}
+
+void Table::record(uint32_t src_ip, uint32_t dst_ip, uint8_t protocol, const uint8_t *payload,
+                   size_t payload_len, size_t bytes, uint64_t now) {
+  Key key = {src_ip, dst_ip, 0, 0, protocol};
+  if (protocol == IPPROTO_UDP || protocol == IPPROTO_TCP) {
+    if (payload_len >= DestinationPort::END) {
+      key.src_port = HeaderView::get<SourcePort>(payload);
+      key.dst_port = HeaderView::get<DestinationPort>(payload);
+    }
+  } else if (protocol == IPPROTO_ICMP && payload_len >= sizeof(ICMP::Header)) {
+    if (HeaderView::matches<ICMP::Fields::EchoRequest>(payload) ||
+        HeaderView::matches<ICMP::Fields::EchoReply>(payload))
+      key.src_port = HeaderView::get<ICMP::Fields::Identifier>(payload);
+  }
+  pending[pending_count++] = {key, (uint32_t)bytes, now};
+  if (pending_count == BATCH)
+    flush();
+}
+
+void Table::flush() {
+  update(pending, pending_count);
+  pending_count = 0;
+}
+
+const Stats *Table::find(const Key &key) const {
+  size_t slot = find_slot(key, hash(key));
+  return slot == slots ? nullptr : &flows[slot].stats;
+}
+
+void Table::erase(size_t slot) {
+  // a group with an empty slot ends every probe reaching it, so no key was placed behind it and
+  // the slot can become empty too
+  if (Group(&control[slot / GROUP * GROUP]).empty()) {
+    control[slot] = EMPTY;
+  } else {
+    control[slot] = DELETED;
+    deleted++;
+  }
+  used--;
+}
+
+// drop_deletes_without_resize of Abseil: deleted slots become empty and full ones are marked
+// deleted, then every flow so marked goes to the first free slot of its probe, swapping places
+// with another marked flow if need be
+void Table::rehash() {
+  for (size_t slot = 0; slot < slots; slot++)
+    control[slot] = control[slot] < 0 ? EMPTY : DELETED;
+  for (size_t slot = 0; slot < slots; slot++) {
+    while (control[slot] == DELETED) {
+      uint64_t h = hash(flows[slot].key);
+      size_t to = insert_slot(h);
+      if (to / GROUP == slot / GROUP) {
+        // the probe finds no room in an earlier group, the flow stays
+        control[slot] = h & 0x7f;
+      } else if (control[to] == EMPTY) {
+        flows[to] = flows[slot];
+        control[to] = h & 0x7f;
+        control[slot] = EMPTY;
+      } else {
+        // the flow from there has yet to be placed, it takes this slot
+        std::swap(flows[to], flows[slot]);
+        control[to] = h & 0x7f;
+      }
+    }
+  }
+  deleted = 0;
+}
+
+void Table::expire(uint64_t now, size_t groups) {
+  latest = std::max(latest, now);
+  if (now < timeout)
+    return;
+  uint64_t cutoff = now - timeout;
+  size_t count = slots / GROUP;
+  for (size_t i = 0; i < groups && i < count; i++) {
+    size_t group = next_expire;
+    next_expire = (next_expire + 1) & (count - 1);
+    for (uint32_t full = Group(&control[group * GROUP]).full(); full; full &= full - 1) {
+      size_t slot = group * GROUP + __builtin_ctz(full);
+      if (flows[slot].stats.last_seen < cutoff) {
+        erase(slot);
+        Counters::count(Counters::FLOWS_EXPIRED);
+      }
+    }
+  }
+}
+
+void Table::snapshot(std::vector<Flow> &out) const {
+  for (size_t slot = 0; slot < slots; slot++) {
+    if (control[slot] >= 0 && flows[slot].stats.last_seen + timeout >= latest)
+      out.push_back(flows[slot]);
+  }
+}
+
+void Flows::report(const std::vector<const Table *> &tables) {
+  std::vector<Flow> flows;
+  for (const Table *table : tables)
+    table->snapshot(flows);
+  // the table order depends on the seed, this one does not
+  std::sort(flows.begin(), flows.end(), [](const Flow &a, const Flow &b) {
+    if (a.stats.packets != b.stats.packets)
+      return a.stats.packets > b.stats.packets;
+    if (a.stats.first_seen != b.stats.first_seen)
+      return a.stats.first_seen < b.stats.first_seen;
+    return memcmp(&a.key, &b.key, sizeof(Key)) < 0;
+  });
+  for (const Flow &flow : flows)
+    log_flow(flow);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "fixed_tables.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Flows {
+// Identity of a flow. The ports are those of UDP and TCP, ICMP echo messages carry their
+// identifier in src_port. Everything else has 0 there.
+struct Key {
+  uint32_t src_ip; // network byte order
+  uint32_t dst_ip;
+  uint16_t src_port; // host byte order
+  uint16_t dst_port;
+  uint32_t protocol;
+};
+static_assert(sizeof(Key) == 16, "keys are compared as two words");
+
+struct Stats {
+  uint64_t packets;
+  uint64_t bytes; // IPv4 total lengths
+  uint64_t first_seen; // capture timestamps, nanoseconds since the epoch
+  uint64_t last_seen;
+};
+
+struct Flow {
+  Key key;
+  Stats stats;
+};
+
+// A packet to count.
+struct Packet {
+  Key key;
+  uint32_t bytes;
+  uint64_t time;
+};
+
+// Packet and byte counts per flow, in an open addressing hash table laid out like Abseil's
+// SwissTable.
+//
+// Next to the flows there is one control byte per slot: empty, deleted or 7 bits of the hash of
+// the key in it. A lookup starts at a group of 16 slots picked by the rest of the hash and
+// compares all of their control bytes with one SSE2 compare, so only the few slots whose bits
+// match have their key compared, usually one. A group with an empty slot ends the probe. Groups
+// are probed quadratically.
+//
+// The table is allocated once for max_flows, new flows beyond that are dropped. Flows idle for
+// longer than the timeout are removed by expire, a few groups per call, so that aging never stalls
+// the packet path. Removed flows leave deleted slots behind where an empty one would cut probes
+// short. When too many have piled up they are dropped in place like Abseil does, and as flows fill
+// at most 25/32 of the slots, that frees at least 3/32 of them before it is needed again.
+//
+// Packets are counted in batches: the groups and then the flows of all keys in a batch are
+// prefetched before the first is counted, so that the cache misses of a large table overlap
+// instead of adding up.
+class Table {
+public:
+  static constexpr size_t GROUP = 16;
+  static constexpr size_t BATCH = 32;
+
+  Table(size_t max_flows, uint64_t timeout);
+
+  // Count a packet of key with bytes at now. Returns false if the flow is new and the table full.
+  bool update(const Key &key, size_t bytes, uint64_t now);
+
+  // Count n packets. Returns how many were dropped as their flow is new and the table full.
+  size_t update(const Packet *packets, size_t n);
+
+  // Queue an IPv4 packet with the given L4 payload, the ports are taken from the payload. It is
+  // counted with the next full batch or flush.
+  void record(uint32_t src_ip, uint32_t dst_ip, uint8_t protocol, const uint8_t *payload,
+              size_t payload_len, size_t bytes, uint64_t now);
+
+  // Count the queued packets.
+  void flush();
+
+  const Stats *find(const Key &key) const;
+
+  // Remove the flows idle since now - timeout in the next groups, continuing where the previous
+  // call stopped.
+  void expire(uint64_t now, size_t groups);
+
+  // Flows not idle for longer than the timeout at the latest time seen.
+  void snapshot(std::vector<Flow> &flows) const;
+
+  size_t size() const { return used; }
+  size_t capacity() const { return slots; }
+
+private:
+  Fixed::Array<int8_t> control; // per slot
+  Fixed::Array<Flow> flows;
+  size_t slots;
+  size_t max_flows;
+  size_t used = 0;
+  size_t deleted = 0;
+  size_t next_expire = 0; // group
+  uint64_t timeout;
+  uint64_t latest = 0; // time
+  uint64_t seed;
+  Packet pending[BATCH];
+  size_t pending_count = 0;
+
+  uint64_t hash(const Key &key) const;
+  size_t find_slot(const Key &key, uint64_t hash) const; // slots if there is none
+  size_t insert_slot(uint64_t hash) const;
+  bool update(const Key &key, uint64_t hash, size_t bytes, uint64_t now);
+  void erase(size_t slot);
+  void rehash();
+  void allocate();
+};
+
+// Log the flows of tables, the busiest first.
+void report(const std::vector<const Table *> &tables);
+} // namespace Flows
@@ -0,0 +1,112 @@
+#pragma once
+// Typed access to protocol headers inside a packet buffer.
+//
+// A header is described by field descriptors, types carrying the offset and width of a field as
+// compile-time constants. get and set copy a field with memcpy, which is defined for any alignment
+// and compiles to a single load or store, and convert between network and host byte order with a
+// byte swap picked by the width of the field. Nothing is cast onto the buffer, so the compiler may
+// assume nothing about its alignment and the call sites see host order values only.
+//
+// A Pattern compares several fields within the first eight bytes of a header at once: one
+// unaligned 64-bit load, a mask and a compare, with mask and value folded at compile time.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace HeaderView {
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+inline uint8_t swap(uint8_t value) { return value; }
+inline uint16_t swap(uint16_t value) { return __builtin_bswap16(value); }
+inline uint32_t swap(uint32_t value) { return __builtin_bswap32(value); }
+inline uint64_t swap(uint64_t value) { return __builtin_bswap64(value); }
+#else
+template <typename T> inline T swap(T value) { return value; }
+#endif
+
+// Unsigned integer of type T at Offset, in network byte order.
+template <size_t Offset, typename T> struct Field {
+  using Type = T;
+  static constexpr size_t END = Offset + sizeof(T);
+
+  static T get(const uint8_t *header) {
+    T value;
+    memcpy(&value, header + Offset, sizeof(T));
+    return swap(value);
+  }
+  static void set(uint8_t *header, T value) {
+    value = swap(value);
+    memcpy(header + Offset, &value, sizeof(T));
+  }
+
+  // position in the first eight bytes read as one big-endian word, see Pattern
+  static constexpr uint64_t word_mask() {
+    return (sizeof(T) == 8 ? ~uint64_t(0) : (uint64_t(1) << sizeof(T) * 8) - 1) << word_shift();
+  }
+  static constexpr unsigned word_shift() { return (8 - END) * 8; }
+};
+
+// Width bits of the byte at Offset, starting at bit Shift (0 is the least significant).
+template <size_t Offset, unsigned Shift, unsigned Width> struct Bits {
+  using Type = uint8_t;
+  static constexpr size_t END = Offset + 1;
+  static constexpr uint8_t MASK = ((1u << Width) - 1) << Shift;
+
+  static uint8_t get(const uint8_t *header) { return (header[Offset] & MASK) >> Shift; }
+  static void set(uint8_t *header, uint8_t value) {
+    header[Offset] = (header[Offset] & ~MASK) | ((value << Shift) & MASK);
+  }
+
+  static constexpr uint64_t word_mask() { return uint64_t(MASK) << (8 - END) * 8; }
+  static constexpr unsigned word_shift() { return (8 - END) * 8 + Shift; }
+};
+
+// Bytes at Offset copied as they are, like addresses which stay in network byte order. T is a
+// type of their size.
+template <size_t Offset, typename T> struct Raw {
+  using Type = T;
+  static constexpr size_t END = Offset + sizeof(T);
+
+  static T get(const uint8_t *header) {
+    T value;
+    memcpy(&value, header + Offset, sizeof(T));
+    return value;
+  }
+  static void set(uint8_t *header, const T &value) { memcpy(header + Offset, &value, sizeof(T)); }
+};
+
+template <typename F> inline typename F::Type get(const uint8_t *header) { return F::get(header); }
+
+template <typename F> inline void set(uint8_t *header, const typename F::Type &value) {
+  F::set(header, value);
+}
+
+// Field F holding Value, a part of a Pattern.
+template <typename F, uint64_t Value> struct Is {
+  static_assert(F::END <= 8, "patterns cover the first eight bytes of a header");
+  static constexpr uint64_t mask() { return F::word_mask(); }
+  static constexpr uint64_t value() { return Value << F::word_shift(); }
+};
+
+// All checks at once. The header has to be at least eight bytes long.
+template <typename... Checks> struct Pattern;
+
+template <> struct Pattern<> {
+  static constexpr uint64_t mask() { return 0; }
+  static constexpr uint64_t value() { return 0; }
+};
+
+template <typename Check, typename... Checks> struct Pattern<Check, Checks...> {
+  static constexpr uint64_t mask() { return Check::mask() | Pattern<Checks...>::mask(); }
+  static constexpr uint64_t value() { return Check::value() | Pattern<Checks...>::value(); }
+
+  static bool matches(const uint8_t *header) {
+    static_assert((value() & ~mask()) == 0, "a value does not fit its field");
+    uint64_t word;
+    memcpy(&word, header, sizeof(word));
+    return (swap(word) & mask()) == value();
+  }
+};
+
+template <typename P> inline bool matches(const uint8_t *header) { return P::matches(header); }
+} // namespace HeaderView
@@ -0,0 +1,44 @@
+#include "histogram.h"
+
+#include <cmath>
+#include <cstring>
+
+constexpr unsigned Histogram::SUB_BUCKET_BITS;
+constexpr size_t Histogram::SUB_BUCKETS;
+constexpr size_t Histogram::SIZE;
+
+uint64_t Histogram::highest_value(size_t index) {
+  if (index < SUB_BUCKETS)
+    return index;
+  // inverse of index(): the first half bucket of every shift is shared with the one below
+  size_t shift = index / (SUB_BUCKETS / 2) - 1;
+  uint64_t sub_bucket = index - shift * SUB_BUCKETS / 2;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+uint64_t Histogram::percentile(double percent) const {
+  if (!total)
+    return 0;
+  uint64_t rank = (uint64_t)std::ceil(percent / 100 * total);
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < SIZE; i++) {
+    seen += counts[i];
+    if (seen >= rank)
+      return highest_value(i);
+  }
+  return highest_value(SIZE - 1);
+}
+
+void Histogram::add(const Histogram &other) {
+  for (size_t i = 0; i < SIZE; i++)
+    counts[i] += other.counts[i];
+  total += other.total;
+}
+
+void Histogram::reset() {
+  memset(counts, 0, sizeof(counts));
+  total = 0;
+}
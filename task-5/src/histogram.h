@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram in the style of HdrHistogram.
+//
+// Values below 2^SUB_BUCKET_BITS are counted exactly. Above, every power of two is split into
+// 2^(SUB_BUCKET_BITS - 1) linear sub-buckets, so a recorded value is off by less than 1/64
+// (~1.6%) over the whole uint64_t range. Recording is a count leading zeros, a shift and an
+// increment.
+class Histogram {
+public:
+  static constexpr unsigned SUB_BUCKET_BITS = 7;
+  static constexpr size_t SUB_BUCKETS = (size_t)1 << SUB_BUCKET_BITS;
+  static constexpr size_t SIZE = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS / 2 + SUB_BUCKETS / 2;
+
+  void record(uint64_t value, uint64_t count = 1) {
+    counts[index(value)] += count;
+    total += count;
+  }
+
+  // Highest value equivalent to the value at the given percentile (0 to 100), 0 if empty.
+  uint64_t percentile(double percent) const;
+
+  uint64_t count() const { return total; }
+
+  void add(const Histogram &other);
+  void reset();
+
+  // Bucket of a value and the highest value of a bucket, for callers keeping their own counts.
+  static size_t index(uint64_t value) {
+    if (value < SUB_BUCKETS)
+      return value;
+    unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS + 1;
+    return shift * SUB_BUCKETS / 2 + (value >> shift);
+  }
+
+  static uint64_t highest_value(size_t index);
+
+private:
+  uint64_t counts[SIZE] = {};
+  uint64_t total = 0;
+};
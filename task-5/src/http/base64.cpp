@@ -0,0 +1,139 @@
+#include "base64.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// 6 bit value of every character, 0xff for characters outside of the alphabet
+static const uint8_t DECODE_TABLE[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 62,   0xff, 0xff, 0xff, 63,
+    52,   53,   54,   55,   56,   57,   58,   59,   60,   61,   0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0,    1,    2,    3,    4,    5,    6,    7,    8,    9,    10,   11,   12,   13,   14,
+    15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25,   0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+    41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51,   0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+ssize_t Base64::decode_scalar(const char *src, size_t len, uint8_t *dst) {
+  auto *in = reinterpret_cast<const uint8_t *>(src);
+
+  // strip up to two padding characters, the remainder decides the size of the last group
+  if (len % 4 == 0 && len >= 4 && in[len - 1] == '=')
+    len -= in[len - 2] == '=' ? 2 : 1;
+  if (len % 4 == 1)
+    return -1;
+
+  uint8_t *out = dst;
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    uint32_t a = DECODE_TABLE[in[i]], b = DECODE_TABLE[in[i + 1]];
+    uint32_t c = DECODE_TABLE[in[i + 2]], d = DECODE_TABLE[in[i + 3]];
+    if ((a | b | c | d) & 0x80)
+      return -1;
+    uint32_t bits = a << 18 | b << 12 | c << 6 | d;
+    *out++ = bits >> 16;
+    *out++ = bits >> 8;
+    *out++ = bits;
+  }
+
+  size_t rest = len - i;
+  if (rest) {
+    uint32_t a = DECODE_TABLE[in[i]], b = DECODE_TABLE[in[i + 1]];
+    uint32_t c = rest == 3 ? DECODE_TABLE[in[i + 2]] : 0;
+    if ((a | b | c) & 0x80)
+      return -1;
+    uint32_t bits = a << 18 | b << 12 | c << 6;
+    *out++ = bits >> 16;
+    if (rest == 3)
+      *out++ = bits >> 8;
+  }
+
+  return out - dst;
+}
+
+#ifdef HAVE_X86_SIMD
+// Decode blocks of 32 characters into 24 bytes each until the input is exhausted or a block
+// contains a character outside of the alphabet (including padding). Returns the number of
+// characters consumed. Lookup and packing follow W. Mula and D. Lemire, "Faster Base64 Encoding
+// and Decoding using AVX2 Instructions" (2018).
+__attribute__((target("avx2"))) static size_t decode_avx2(const char *src, size_t len,
+                                                          uint8_t *&dst) {
+  // classify characters by their nibbles: lo & hi is non-zero for invalid characters
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b,
+      0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b,
+      0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10);
+  // offset from the ASCII code to the 6 bit value, selected by the high nibble
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+                                            0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+  const __m256i pack_shuffle =
+      _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4,
+                       10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i pack_permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+  size_t i = 0;
+  for (; len - i >= 32; i += 32) {
+    __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+
+    const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+    const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+      break;
+
+    const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+    const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+
+    // merge four 6 bit values into 24 bits and move them to the front
+    const __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    __m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(out, pack_shuffle);
+    out = _mm256_permutevar8x32_epi32(out, pack_permute);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm256_castsi256_si128(out));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 16), _mm256_extracti128_si256(out, 1));
+    dst += 24;
+  }
+  return i;
+}
+
+static bool have_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+ssize_t Base64::decode(const char *src, size_t len, uint8_t *dst) {
+  uint8_t *out = dst;
+#ifdef HAVE_X86_SIMD
+  static const bool avx2 = have_avx2();
+  if (avx2) {
+    size_t consumed = decode_avx2(src, len, out);
+    src += consumed;
+    len -= consumed;
+  }
+#endif
+  ssize_t tail = decode_scalar(src, len, out);
+  if (tail < 0)
+    return -1;
+  return out - dst + tail;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h> // ssize_t
+
+namespace Base64 {
+// Upper bound for the decoded size of len characters.
+inline size_t decoded_size(size_t len) { return (len + 3) / 4 * 3; }
+
+// Decode standard base64 (RFC 4648), padding is optional. dst needs room for decoded_size(len)
+// bytes. Returns the number of decoded bytes or -1 if the input is not valid base64.
+//
+// Blocks of 32 characters are decoded with AVX2 if the CPU supports it, the rest falls back to
+// decode_scalar.
+ssize_t decode(const char *src, size_t len, uint8_t *dst);
+
+// Table based reference implementation.
+ssize_t decode_scalar(const char *src, size_t len, uint8_t *dst);
+} // namespace Base64
@@ -0,0 +1,239 @@
+#include "http.h"
+#include "base64.h"
+#include "scan.h"
+#include "../logging.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <strings.h> // strncasecmp
+
+using namespace HTTP;
+
+bool View::equals_nocase(const char *str) const {
+  return strlen(str) == len && strncasecmp(data, str, len) == 0;
+}
+
+static View trim(const char *begin, const char *end) {
+  while (begin < end && (*begin == ' ' || *begin == '\t'))
+    begin++;
+  while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+    end--;
+  return {begin, (size_t)(end - begin)};
+}
+
+// The end of the line at begin, with next set to the line after it. Returns nullptr if the line
+// is not complete yet, or if a CR is not followed by an LF, which ends the inspection.
+const char *Parser::line_end(const char *begin, const char *end, const char *&next) {
+  const char *eol = find_any(begin, end, '\r', '\n');
+  if (eol == end || (*eol == '\r' && eol + 1 == end))
+    return nullptr;
+
+  next = eol + 1;
+  if (*eol == '\r') {
+    if (*next != '\n') {
+      state = STATE_IGNORE;
+      return nullptr;
+    }
+    next++;
+  }
+  return eol;
+}
+
+void Parser::feed(Handler &handler, const uint8_t *data, size_t len) {
+  const char *p = reinterpret_cast<const char *>(data);
+  const char *end = p + len;
+
+  // finish a line that started in an earlier segment, by the same rules as one within a segment
+  if (carry_len && state != STATE_IGNORE) {
+    const char *lf = find(p, end, '\n');
+    size_t n = lf - p + (lf < end);
+    if (carry_len + n > CARRY_SIZE) {
+      state = STATE_IGNORE;
+      return;
+    }
+    memcpy(carry + carry_len, p, n);
+    carry_len += n;
+    p += n;
+
+    const char *next;
+    const char *eol = line_end(carry, carry + carry_len, next);
+    if (!eol)
+      return;
+    carry_len = 0;
+    line(handler, carry, eol);
+  }
+
+  while (p < end) {
+    if (state == STATE_IGNORE)
+      return;
+
+    if (state == STATE_BODY) {
+      size_t skip = std::min(body_remaining, (size_t)(end - p));
+      p += skip;
+      body_remaining -= skip;
+      if (!body_remaining)
+        state = STATE_START_LINE;
+      continue;
+    }
+
+    const char *next;
+    const char *eol = line_end(p, end, next);
+    if (!eol) {
+      if (state == STATE_IGNORE)
+        return;
+      // keep the incomplete line until the rest arrives
+      size_t n = end - p;
+      if (n > CARRY_SIZE) {
+        state = STATE_IGNORE;
+        return;
+      }
+      memcpy(carry, p, n);
+      carry_len = n;
+      return;
+    }
+
+    line(handler, p, eol);
+    p = next;
+  }
+}
+
+void Parser::line(Handler &handler, const char *begin, const char *end) {
+  if (state == STATE_START_LINE) {
+    // tolerate empty lines between messages (RFC 7230, section 3.5)
+    if (begin != end)
+      start_line(handler, begin, end);
+    return;
+  }
+
+  if (begin != end) {
+    header_line(handler, begin, end);
+    return;
+  }
+
+  // end of the header section
+  if (chunked)
+    state = STATE_IGNORE;
+  else if (body_remaining)
+    state = STATE_BODY;
+  else
+    state = STATE_START_LINE;
+}
+
+void Parser::start_line(Handler &handler, const char *begin, const char *end) {
+  const char *sp1 = find(begin, end, ' ');
+  const char *sp2 = sp1 < end ? find(sp1 + 1, end, ' ') : end;
+
+  if (end - begin >= 5 && memcmp(begin, "HTTP/", 5) == 0) {
+    // status line: HTTP-version SP status-code SP reason-phrase
+    if (sp1 == end) {
+      state = STATE_IGNORE;
+      return;
+    }
+    handler.response({sp1 + 1, (size_t)(sp2 - sp1 - 1)});
+  } else {
+    // request line: method SP request-target SP HTTP-version
+    if (sp2 == end) {
+      state = STATE_IGNORE;
+      return;
+    }
+    handler.request({begin, (size_t)(sp1 - begin)}, {sp1 + 1, (size_t)(sp2 - sp1 - 1)});
+  }
+
+  state = STATE_HEADERS;
+  chunked = false;
+  body_remaining = 0;
+}
+
+void Parser::header_line(Handler &handler, const char *begin, const char *end) {
+  const char *colon = find(begin, end, ':');
+  if (colon == end)
+    return;
+
+  View name = {begin, (size_t)(colon - begin)};
+  View value = trim(colon + 1, end);
+  handler.header(name, value);
+
+  if (name.equals_nocase("Content-Length")) {
+    body_remaining = 0;
+    for (size_t i = 0; i < value.len && value.data[i] >= '0' && value.data[i] <= '9'; i++) {
+      size_t digit = value.data[i] - '0';
+      // a length that does not fit cannot be skipped either
+      if (body_remaining > (SIZE_MAX - digit) / 10) {
+        state = STATE_IGNORE;
+        return;
+      }
+      body_remaining = body_remaining * 10 + digit;
+    }
+  } else if (name.equals_nocase("Transfer-Encoding")) {
+    static const char CHUNKED[] = "chunked";
+    for (size_t i = 0; i + sizeof(CHUNKED) - 1 <= value.len; i++) {
+      if (strncasecmp(value.data + i, CHUNKED, sizeof(CHUNKED) - 1) == 0)
+        chunked = true;
+    }
+  }
+}
+
+Inspector::Inspector() : parsers(MAX_CONNECTIONS) {
+  for (size_t i = MAX_CONNECTIONS; i > 0; i--)
+    free_parsers.push_back(i - 1);
+}
+
+void Inspector::accept(TCP::Connection &conn) {
+  // connections beyond the parser pool are not inspected
+  if (free_parsers.empty()) {
+    conn.app = NO_PARSER;
+    return;
+  }
+  conn.app = free_parsers.back();
+  free_parsers.pop_back();
+  parsers[conn.app].reset();
+}
+
+void Inspector::receive(TCP::Connection &conn, const uint8_t *data, size_t len) {
+  if (conn.app == NO_PARSER)
+    return;
+  Parser &parser = parsers[conn.app];
+  parser.feed(*this, data, len);
+  // the rest of the connection is not inspected, another one can have the parser
+  if (parser.done()) {
+    free_parsers.push_back(conn.app);
+    conn.app = NO_PARSER;
+  }
+}
+
+void Inspector::close(TCP::Connection &conn) {
+  if (conn.app != NO_PARSER)
+    free_parsers.push_back(conn.app);
+}
+
+void Inspector::request(const View &method, const View &path) { log_http_request(method, path); }
+
+void Inspector::response(const View &status_code) { log_http_response(status_code); }
+
+void Inspector::header(const View &name, const View &value) {
+  if (name.equals_nocase("Host"))
+    log_http_request_host(value);
+  else if (name.equals_nocase("Cookie"))
+    log_http_request_cookie(value);
+  else if (name.equals_nocase("Authorization"))
+    authorization(value);
+}
+
+void Inspector::authorization(const View &value) {
+  // auth-scheme is case-insensitive (RFC 7235, section 2.1)
+  static const char BASIC[] = "Basic ";
+  if (value.len < sizeof(BASIC) - 1 || strncasecmp(value.data, BASIC, sizeof(BASIC) - 1) != 0)
+    return;
+  View credentials = trim(value.data + sizeof(BASIC) - 1, value.data + value.len);
+
+  // decode straight from the segment, the buffer only ever grows
+  static thread_local std::vector<uint8_t> decoded;
+  if (decoded.size() < Base64::decoded_size(credentials.len))
+    decoded.resize(Base64::decoded_size(credentials.len));
+
+  ssize_t len = Base64::decode(credentials.data, credentials.len, decoded.data());
+  if (len < 0)
+    return;
+  log_http_request_auth({reinterpret_cast<const char *>(decoded.data()), (size_t)len});
+}
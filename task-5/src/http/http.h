@@ -0,0 +1,98 @@
+#pragma once
+#include "../tcp/tcp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace HTTP {
+
+// Non-owning reference to a string inside a packet (or the parser's carry buffer).
+struct View {
+  const char *data;
+  size_t len;
+
+  bool equals_nocase(const char *str) const;
+};
+
+// Receiver of parser events. Views are only valid for the duration of the call.
+class Handler {
+public:
+  virtual ~Handler() = default;
+  virtual void request(const View &method, const View &path) = 0;
+  virtual void response(const View &status_code) = 0;
+  virtual void header(const View &name, const View &value) = 0;
+};
+
+// Incremental HTTP/1.1 request and response parser working directly on TCP payload.
+//
+// Complete lines are reported as views into the segment. Only a line that is split across
+// segments is copied into the carry buffer until its end arrives. Bodies with a Content-Length are
+// skipped, so pipelined messages are parsed as well. Chunked bodies end the inspection of the
+// connection.
+class Parser {
+public:
+  static constexpr size_t CARRY_SIZE = 4096;
+
+  void reset() {
+    state = STATE_START_LINE;
+    carry_len = 0;
+    body_remaining = 0;
+  }
+
+  void feed(Handler &handler, const uint8_t *data, size_t len);
+
+  // Nothing more of the connection will be parsed.
+  bool done() const { return state == STATE_IGNORE; }
+
+private:
+  enum State : uint8_t {
+    STATE_START_LINE,
+    STATE_HEADERS,
+    STATE_BODY,
+    STATE_IGNORE, // parse error or a body we cannot delimit
+  };
+
+  State state = STATE_START_LINE;
+  bool chunked = false;
+  size_t body_remaining = 0;
+  size_t carry_len = 0;
+  char carry[CARRY_SIZE];
+
+  const char *line_end(const char *begin, const char *end, const char *&next);
+  void line(Handler &handler, const char *begin, const char *end);
+  void start_line(Handler &handler, const char *begin, const char *end);
+  void header_line(Handler &handler, const char *begin, const char *end);
+};
+
+// TCP application which parses the connections of a port and logs requests and responses.
+// Credentials of Basic authentication are logged decoded.
+//
+// A connection holds one of the MAX_CONNECTIONS parsers until it closes, its inspection ends or it
+// is idle for longer than the TCP idle timeout (TCP::Protocol::set_idle_timeout), so idle
+// connections only keep later ones from being inspected for that long.
+class Inspector : public TCP::Application, private Handler {
+public:
+  static constexpr size_t MAX_CONNECTIONS = 256;
+
+  Inspector();
+
+  void accept(TCP::Connection &conn) override;
+  void receive(TCP::Connection &conn, const uint8_t *data, size_t len) override;
+  void close(TCP::Connection &conn) override;
+
+  size_t parsers_used() const { return MAX_CONNECTIONS - free_parsers.size(); }
+
+private:
+  static constexpr uint16_t NO_PARSER = 0xffff;
+
+  std::vector<Parser> parsers;
+  std::vector<uint16_t> free_parsers;
+
+  void request(const View &method, const View &path) override;
+  void response(const View &status_code) override;
+  void header(const View &name, const View &value) override;
+
+  void authorization(const View &value);
+};
+} // namespace HTTP
@@ -0,0 +1,64 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+using namespace HTTP;
+
+static const char *find_any_scalar(const char *p, const char *end, char a, char b) {
+  for (; p < end; p++) {
+    if (*p == a || *p == b)
+      return p;
+  }
+  return end;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) static const char *find_any_sse2(const char *p, const char *end,
+                                                                   char a, char b) {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return find_any_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2"))) static const char *find_any_avx2(const char *p, const char *end,
+                                                                   char a, char b) {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return find_any_sse2(p, end, a, b);
+}
+#endif
+
+using find_any_fn = const char *(*)(const char *, const char *, char, char);
+
+static find_any_fn select_find_any() {
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return find_any_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return find_any_sse2;
+#endif
+  return find_any_scalar;
+}
+
+static const find_any_fn find_any_impl = select_find_any();
+
+const char *HTTP::find_any(const char *begin, const char *end, char a, char b) {
+  return find_any_impl(begin, end, a, b);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+
+namespace HTTP {
+// Returns the first byte in [begin, end) that equals a or b, or end if there is none.
+//
+// This is the inner loop of the parser, so it compares 32 (AVX2) or 16 (SSE2) bytes at a time.
+// The widest implementation supported by the CPU is selected at startup.
+const char *find_any(const char *begin, const char *end, char a, char b);
+
+inline const char *find(const char *begin, const char *end, char c) {
+  return find_any(begin, end, c, c);
+}
+} // namespace HTTP
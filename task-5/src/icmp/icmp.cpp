@@ -1,4 +1,7 @@
 #include "icmp.h"
+#include "ping.h"
+#include "../clock.h"
+#include "../counters.h"
 #include "../logging.h"
 #include <cstring>
 
@@ -8,30 +11,54 @@ void Protocol::handle_packet(const Ethernet::Address &src_mac, const IPv4::Addre
                              const IPv4::Address &dst_ip, const uint8_t *buffer,
                              size_t buffer_len) {
                         
-  if (buffer_len < sizeof(Header)) return;
-
-  auto *icmp = reinterpret_cast<const Header * > (buffer);
+  if (buffer_len < sizeof(Header)) {
+    Counters::count(Counters::ICMP_DROP_SHORT);
+    return;
+  }
 
-  if (icmp->type == ICMP_ECHO && icmp->code == 0)
+  if (HeaderView::matches<Fields::EchoRequest>(buffer))
   {
     log_icmp_ping();
+    Counters::count(Counters::ICMP_RX_PINGS);
+
+    // drop floods before spending anything on the reply
+    if (flood && !flood->check(Flood::Detector::ECHO_REQUEST, src_ip.s_addr, Clock::packet_time)) {
+      Counters::count(Counters::ICMP_DROP_DENIED);
+      return;
+    }
+    if (limiter) {
+      RateLimiter::Verdict verdict = limiter->check(src_ip.s_addr, Clock::packet_time);
+      if (verdict != RateLimiter::PASS) {
+        log_icmp_drop(verdict == RateLimiter::DROP_SOURCE ? "source" : "global");
+        Counters::count(Counters::ICMP_DROP_LIMIT);
+        return;
+      }
+    }
 
     //preparing reply  (same size as request)
     std::vector<uint8_t> reply_buf(buffer_len);
     memcpy(reply_buf.data(), buffer, buffer_len);
 
-    auto *reply = reinterpret_cast<Header *>(reply_buf.data());
-    reply->type = ICMP_ECHOREPLY;
-    reply->code = 0;
-    reply->checksum = 0;
+    uint8_t *reply = reply_buf.data();
+    HeaderView::set<Fields::Type>(reply, ICMP_ECHOREPLY);
+    HeaderView::set<Fields::Code>(reply, 0);
+    HeaderView::set<Fields::Checksum>(reply, 0);
 
     // calc new checksum
-    reply->checksum = IPv4::Protocol::checksum(reply_buf.data(), buffer_len); 
+    HeaderView::set<Fields::Checksum>(reply, IPv4::Protocol::checksum(reply, buffer_len));
 
     log_icmp_pong();
+    Counters::count(Counters::ICMP_TX_PONGS);
 
     // send repli 
     send(reinterpret_cast<Frame *>(reply_buf.data()), buffer_len, src_mac, src_ip);
+  } else if (HeaderView::matches<Fields::EchoReply>(buffer)) {
+    Counters::count(Counters::ICMP_RX_PONGS);
+    if (client)
+      client->receive(HeaderView::get<Fields::Identifier>(buffer),
+                      HeaderView::get<Fields::Sequence>(buffer), Clock::packet_time);
+  } else {
+    Counters::count(Counters::ICMP_DROP_TYPE);
   }
 }
 
@@ -40,3 +67,11 @@ void Protocol::send(const Frame *req_frame, size_t frame_len, const Ethernet::Ad
 
   ipv4_handler->send(dst_mac, dst_ip, IPPROTO_ICMP, (uint8_t *)req_frame, frame_len);
 }
+
+bool Protocol::send(Frame *frame, size_t frame_len, const IPv4::Address &dst_ip) {
+  auto *header = reinterpret_cast<uint8_t *>(frame);
+  HeaderView::set<Fields::Checksum>(header, 0);
+  HeaderView::set<Fields::Checksum>(header, IPv4::Protocol::checksum(header, frame_len));
+  return ipv4_handler->send_in_place(dst_ip, IPPROTO_ICMP, reinterpret_cast<uint8_t *>(frame),
+                                     frame_len);
+}
@@ -1,6 +1,10 @@
 #pragma once
 #include "../layer_link/ethernet.h"
 #include "../layer_internet/ipv4.h"
+#include "ratelimit.h"
+#include "../flood.h"
+
+#include <memory>
 
 namespace ICMP {
 struct Header {
@@ -19,16 +23,50 @@ struct Frame {
 #define ICMP_ECHOREPLY 0 /* Echo Reply			*/
 #define ICMP_ECHO 8      /* Echo Request			*/
 
+// Fields of the header, for HeaderView::get and HeaderView::set.
+namespace Fields {
+using Type = HeaderView::Field<0, uint8_t>;
+using Code = HeaderView::Field<1, uint8_t>;
+using Checksum = HeaderView::Raw<2, uint16_t>; // as IPv4::Protocol::checksum computes it
+using Identifier = HeaderView::Field<4, uint16_t>;
+using Sequence = HeaderView::Field<6, uint16_t>;
+
+using EchoRequest = HeaderView::Pattern<HeaderView::Is<Type, ICMP_ECHO>, HeaderView::Is<Code, 0>>;
+using EchoReply =
+    HeaderView::Pattern<HeaderView::Is<Type, ICMP_ECHOREPLY>, HeaderView::Is<Code, 0>>;
+} // namespace Fields
+
+class PingClient;
+
 class Protocol {
 private:
   IPv4::Protocol *ipv4_handler;
+  std::unique_ptr<RateLimiter> limiter; // answer every request if not set
+  PingClient *client = nullptr;         // receives echo replies
+  Flood::Detector *flood = nullptr;     // shared with ARP, requests are not checked if not set
 
 public:
   Protocol(IPv4::Protocol *handler) { ipv4_handler = handler; };
+
+  // Limit echo replies per source and in total, in requests per second (0 means unlimited). The
+  // total may be taken from a bucket shared with other instances instead.
+  void set_rate_limit(uint32_t source_rate, uint32_t global_rate, GlobalBucket *shared = nullptr) {
+    limiter = std::make_unique<RateLimiter>(source_rate, global_rate, shared);
+  }
+  const RateLimiter *rate_limiter() const { return limiter.get(); }
+
+  void set_ping_client(PingClient *ping) { client = ping; }
+
+  void set_flood_detector(Flood::Detector *detector) { flood = detector; }
+
   void handle_packet(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
                      const IPv4::Address &dst_ip, const uint8_t *buffer, size_t buffer_len);
 
   void send(const Frame *req_frame, size_t frame_len, const Ethernet::Address &dst_mac,
             const IPv4::Address &dst_ip);
+
+  // Originate a message, the checksum is filled in. The frame has to be preceded by
+  // IPv4::Protocol::HEADROOM bytes. Returns false if dst_ip cannot be reached (yet).
+  bool send(Frame *frame, size_t frame_len, const IPv4::Address &dst_ip);
 };
 } // namespace ICMP
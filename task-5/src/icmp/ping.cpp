@@ -0,0 +1,140 @@
+#include "ping.h"
+#include "../logging.h"
+
+#include <algorithm>
+
+using namespace ICMP;
+
+constexpr size_t PingClient::RING_SIZE;
+constexpr size_t PingClient::MAX_PAYLOAD;
+constexpr size_t PingClient::BATCH;
+
+// wait for ARP before trying a target with an unresolved next hop again
+#define RETRY_NS (Clock::NS_PER_SEC / 10)
+
+PingClient::PingClient(Protocol *icmp, const Options &opts, uint16_t id)
+    : icmp_handler(icmp), options(opts), identifier(id), send_time(RING_SIZE),
+      retry_at(opts.targets.size()),
+      interval_ns(std::max<uint64_t>(Clock::NS_PER_SEC / std::max<uint32_t>(opts.rate, 1), 1)) {
+  options.payload_size = std::min(options.payload_size, MAX_PAYLOAD);
+
+  // the payload never changes, only the header is rewritten for every request
+  uint8_t *payload = tx_buffer + IPv4::Protocol::HEADROOM + sizeof(Header);
+  for (size_t i = 0; i < options.payload_size; i++)
+    payload[i] = i;
+}
+
+void PingClient::poll(uint64_t now) {
+  if (!next_send) {
+    next_send = now;
+    next_report = now + options.interval;
+  }
+
+  expire(now);
+
+  // do not catch up on a stall with a burst
+  if (now > next_send + Clock::NS_PER_SEC)
+    next_send = now;
+
+  uint8_t *header = tx_buffer + IPv4::Protocol::HEADROOM;
+  for (size_t n = 0; n < BATCH && next_send <= now && !options.targets.empty(); n++) {
+    if (options.count && total.sent >= options.count)
+      break;
+
+    size_t target = next_target;
+    next_target = (next_target + 1) % options.targets.size();
+    next_send += interval_ns;
+    if (retry_at[target] > now) {
+      interval.unresolved++;
+      total.unresolved++;
+      continue;
+    }
+
+    // a full ring means the oldest request is given up
+    uint16_t sequence = next_sequence;
+    if (in_ring == RING_SIZE) {
+      if (send_time[sequence]) {
+        send_time[sequence] = 0;
+        interval.lost++;
+        total.lost++;
+      }
+      oldest_sequence++;
+      in_ring--;
+    }
+
+    HeaderView::set<Fields::Type>(header, ICMP_ECHO);
+    HeaderView::set<Fields::Code>(header, 0);
+    HeaderView::set<Fields::Identifier>(header, identifier);
+    HeaderView::set<Fields::Sequence>(header, sequence);
+    if (!icmp_handler->send(reinterpret_cast<Frame *>(header),
+                            sizeof(Header) + options.payload_size, options.targets[target])) {
+      retry_at[target] = now + RETRY_NS;
+      interval.unresolved++;
+      total.unresolved++;
+      continue;
+    }
+
+    send_time[sequence] = now;
+    next_sequence++;
+    in_ring++;
+    last_send = now;
+    interval.sent++;
+    total.sent++;
+  }
+
+  if (now >= next_report) {
+    report(false, interval, interval_rtt);
+    interval = Counters();
+    interval_rtt.reset();
+    next_report = std::max(next_report + options.interval, now);
+  }
+}
+
+void PingClient::receive(uint16_t id, uint16_t sequence, uint64_t now) {
+  if (id != identifier)
+    return;
+
+  // late replies of requests already counted as lost are ignored, as are duplicates
+  uint64_t sent = send_time[sequence];
+  if (!sent)
+    return;
+  send_time[sequence] = 0;
+
+  uint64_t rtt = now > sent ? now - sent : 0;
+  interval_rtt.record(rtt);
+  total_rtt.record(rtt);
+  interval.received++;
+  total.received++;
+}
+
+void PingClient::expire(uint64_t now) {
+  // the sequence numbers wrap, with all slots in use the oldest one equals the next one
+  while (in_ring) {
+    uint64_t &sent = send_time[oldest_sequence];
+    if (sent) {
+      if (sent + options.timeout > now)
+        break;
+      sent = 0;
+      interval.lost++;
+      total.lost++;
+    }
+    oldest_sequence++;
+    in_ring--;
+  }
+}
+
+bool PingClient::done() const {
+  return options.count && total.sent >= options.count && !in_ring;
+}
+
+void PingClient::finish() {
+  // nothing is received anymore, the requests that did not time out yet will never be answered
+  expire(UINT64_MAX);
+  report(false, interval, interval_rtt);
+  report(true, total, total_rtt);
+}
+
+void PingClient::report(bool summary, const Counters &counters, const Histogram &rtt) {
+  log_ping_report(summary, counters.sent, counters.received, counters.lost, counters.unresolved,
+                  rtt.percentile(50), rtt.percentile(99), rtt.percentile(99.9));
+}
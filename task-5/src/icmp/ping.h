@@ -0,0 +1,80 @@
+#pragma once
+#include "../clock.h"
+#include "../histogram.h"
+#include "../layer_internet/ipv4.h"
+#include "icmp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ICMP {
+// Sends echo requests at a fixed rate to one or more targets (round robin) and measures the round
+// trip times of the replies.
+//
+// Send times are kept in a ring indexed by the 16 bit sequence number, so a reply is matched with
+// a single load. A request counts as lost once it is older than the timeout or its slot is reused.
+// Round trip times are taken from the capture timestamp of the reply, which shares its time base
+// with Clock::realtime(). A replay passes capture times instead.
+class PingClient {
+public:
+  static constexpr size_t RING_SIZE = 1 << 16;
+  static constexpr size_t MAX_PAYLOAD = 1472 - sizeof(Header);
+  static constexpr size_t BATCH = 64; // requests sent per poll at most
+
+  struct Options {
+    std::vector<IPv4::Address> targets;
+    uint32_t rate = 1;                   // requests per second
+    uint64_t count = 0;                  // total number of requests, 0 for no limit
+    size_t payload_size = 56;
+    uint64_t interval = Clock::NS_PER_SEC; // between reports, in nanoseconds
+    uint64_t timeout = Clock::NS_PER_SEC;  // until a request counts as lost
+  };
+
+  PingClient(Protocol *icmp, const Options &options, uint16_t identifier);
+
+  // Send the requests that are due and report the interval if it has passed.
+  void poll(uint64_t now);
+
+  // Called by ICMP::Protocol for every echo reply.
+  void receive(uint16_t identifier, uint16_t sequence, uint64_t now);
+
+  // All requests were sent and answered or timed out.
+  bool done() const;
+
+  // Report the last interval and totals. Requests still waiting for a reply count as lost.
+  void finish();
+
+private:
+  struct Counters {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    uint64_t unresolved = 0; // no route or next hop not resolved yet
+  };
+
+  Protocol *icmp_handler;
+  Options options;
+  uint16_t identifier;
+
+  std::vector<uint64_t> send_time; // per sequence number, 0 if not outstanding
+  uint16_t next_sequence = 0;
+  uint16_t oldest_sequence = 0;    // first slot that may still be outstanding
+  size_t in_ring = 0;              // slots from the oldest on, up to all of them
+  size_t next_target = 0;
+  std::vector<uint64_t> retry_at;  // per target, while ARP resolves the next hop
+
+  uint64_t interval_ns;            // between two requests
+  uint64_t next_send = 0;
+  uint64_t next_report = 0;
+  uint64_t last_send = 0;
+
+  Counters interval, total;
+  Histogram interval_rtt, total_rtt;
+
+  uint8_t tx_buffer[IPv4::Protocol::HEADROOM + sizeof(Header) + MAX_PAYLOAD];
+
+  void expire(uint64_t now);
+  void report(bool summary, const Counters &counters, const Histogram &rtt);
+};
+} // namespace ICMP
@@ -0,0 +1,87 @@
+#include "ratelimit.h"
+#include "../clock.h"
+
+#include <algorithm>
+
+using namespace ICMP;
+
+constexpr size_t RateLimiter::VERDICTS;
+constexpr size_t RateLimiter::SETS_LOG2;
+constexpr size_t RateLimiter::WAYS;
+
+// every bucket can hold one second of requests
+#define CAPACITY Clock::NS_PER_SEC
+
+static uint32_t cost(uint32_t rate) { return rate ? std::max<uint64_t>(CAPACITY / rate, 1) : 0; }
+
+GlobalBucket::GlobalBucket(uint32_t rate) : cost(::cost(rate)) {}
+
+bool GlobalBucket::take(uint64_t now) {
+  uint64_t full = full_at.load(std::memory_order_relaxed);
+  for (;;) {
+    uint64_t start = std::max(full, now);
+    if (start - now > CAPACITY - cost)
+      return false;
+    if (full_at.compare_exchange_weak(full, start + cost, std::memory_order_relaxed))
+      return true;
+  }
+}
+
+RateLimiter::RateLimiter(uint32_t source_rate, uint32_t global_rate, GlobalBucket *shared)
+    : sets(Fixed::allocate<Set>((size_t)1 << SETS_LOG2)), source_cost(cost(source_rate)),
+      global(shared) {
+  if (!global && global_rate) {
+    own_global = std::make_unique<GlobalBucket>(global_rate);
+    global = own_global.get();
+  }
+}
+
+void RateLimiter::refill(Bucket &bucket, uint64_t now) {
+  // capture timestamps may step backwards, that only delays the refill
+  if (now > bucket.updated) {
+    uint64_t elapsed = std::min<uint64_t>(now - bucket.updated, CAPACITY);
+    bucket.credit = std::min<uint64_t>(bucket.credit + elapsed, CAPACITY);
+    bucket.updated = now;
+  }
+}
+
+RateLimiter::Bucket &RateLimiter::lookup(uint32_t src_ip, uint64_t now) {
+  uint32_t hash = src_ip * 0x9e3779b1u;
+  Set &set = sets[hash >> (32 - SETS_LOG2)];
+
+  Bucket *oldest = &set.buckets[0];
+  for (Bucket &bucket : set.buckets) {
+    if (bucket.updated && bucket.src_ip == src_ip)
+      return bucket;
+    if (bucket.updated < oldest->updated)
+      oldest = &bucket;
+  }
+
+  // new sources start with a full bucket
+  oldest->src_ip = src_ip;
+  oldest->credit = CAPACITY;
+  oldest->updated = std::max<uint64_t>(now, 1);
+  return *oldest;
+}
+
+RateLimiter::Verdict RateLimiter::check(uint32_t src_ip, uint64_t now) {
+  Bucket *source = nullptr;
+  if (source_cost) {
+    source = &lookup(src_ip, now);
+    refill(*source, now);
+    if (source->credit < source_cost) {
+      counters[DROP_SOURCE]++;
+      return DROP_SOURCE;
+    }
+  }
+
+  if (global && !global->take(now)) {
+    counters[DROP_GLOBAL]++;
+    return DROP_GLOBAL;
+  }
+
+  if (source)
+    source->credit -= source_cost;
+  counters[PASS]++;
+  return PASS;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "../fixed_tables.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace ICMP {
+// The global bucket, which may be shared by the stacks of several threads so that together they
+// answer no more than the global rate.
+//
+// It is the same token bucket written as the time at which it would be full again: a request
+// passes if that lies less than the capacity minus its cost ahead, and pushes it back by the
+// cost. That is a single word, so threads take tokens with a compare and swap and never wait.
+// Threads whose capture times lag behind the others see an emptier bucket, never a fuller one.
+class GlobalBucket {
+public:
+  explicit GlobalBucket(uint32_t rate);
+
+  bool take(uint64_t now);
+
+private:
+  std::atomic<uint64_t> full_at{0};
+  uint64_t cost;
+};
+
+// Token buckets per source address plus one global bucket.
+//
+// Tokens are kept as nanoseconds of credit: a bucket gains one nanosecond per elapsed nanosecond
+// and a request costs NS_PER_SEC / rate. The credit is topped up lazily whenever the bucket is
+// used, so no timer is involved and no precision is lost to integer division.
+//
+// The per source buckets live in a fixed number of sets of four, one cache line each. A source
+// hashes to one set and replaces its least recently used bucket if it has none there yet, so a
+// flood of spoofed sources only ever evicts buckets and never allocates.
+class RateLimiter {
+public:
+  enum Verdict { PASS = 0, DROP_SOURCE, DROP_GLOBAL };
+  static constexpr size_t VERDICTS = 3;
+
+  static constexpr size_t SETS_LOG2 = 12;
+  static constexpr size_t WAYS = 4;
+
+  // Requests per second of a single source and of all sources together. Both buckets hold up to
+  // one second worth of requests. A rate of 0 disables that limit. A shared global bucket
+  // replaces the global rate.
+  RateLimiter(uint32_t source_rate, uint32_t global_rate, GlobalBucket *shared = nullptr);
+
+  // Consumes a token from the bucket of src_ip (network byte order) and the global bucket if both
+  // have one.
+  Verdict check(uint32_t src_ip, uint64_t now);
+
+  uint64_t count(Verdict verdict) const { return counters[verdict]; }
+
+private:
+  struct Bucket {
+    uint32_t src_ip;  // network byte order
+    uint32_t credit;  // in nanoseconds
+    uint64_t updated; // time of the last refill, 0 for unused buckets
+  };
+
+  struct alignas(64) Set {
+    Bucket buckets[WAYS];
+  };
+  static_assert(sizeof(Set) == 64, "a set should fill exactly one cache line");
+
+  Fixed::Array<Set> sets;
+  uint32_t source_cost; // credit one request takes, 0 if unlimited
+  std::unique_ptr<GlobalBucket> own_global;
+  GlobalBucket *global; // unlimited if not set
+  uint64_t counters[VERDICTS] = {};
+
+  Bucket &lookup(uint32_t src_ip, uint64_t now);
+
+  static void refill(Bucket &bucket, uint64_t now);
+};
+} // namespace ICMP
@@ -1,51 +1,162 @@
 #include "arp.h"
 #include "../layer_link/ethernet.h"
 #include "../layer_internet/ipv4.h"
+#include "../clock.h"
+#include "../counters.h"
 #include "../logging.h"
 
-#define ARPPRO_IP 2048
+#include <cstring>
 
 using namespace ARP;
 
+constexpr size_t Neighbours::SETS_LOG2;
+constexpr size_t Neighbours::WAYS;
+
+Neighbours::Neighbours() : sets(Fixed::allocate<Set>((size_t)1 << SETS_LOG2)) {}
+
+Neighbours::Learned Neighbours::learn(uint32_t ip, const Ethernet::Address &mac) {
+  // the stamp only orders the entries of a set, skip 0 when it wraps
+  if (!++stamp)
+    stamp = 1;
+
+  Entry *oldest = nullptr;
+  for (Entry &entry : set(ip).entries) {
+    if (entry.learned && entry.ip == ip) {
+      entry.learned = stamp;
+      if (memcmp(&entry.mac, &mac, sizeof(mac)) == 0)
+        return KNOWN;
+      entry.mac = mac;
+      return CHANGED;
+    }
+    if (!oldest || entry.learned < oldest->learned)
+      oldest = &entry;
+  }
+
+  Learned learned = oldest->learned ? EVICTED : ADDED;
+  if (learned == ADDED)
+    used++;
+  *oldest = {ip, mac, stamp};
+  return learned;
+}
+
+bool Neighbours::find(uint32_t ip, Ethernet::Address &mac) const {
+  for (const Entry &entry : set(ip).entries) {
+    if (entry.learned && entry.ip == ip) {
+      mac = entry.mac;
+      return true;
+    }
+  }
+  return false;
+}
+
 void Protocol::handle_packet(const uint8_t *buffer, size_t buffer_len) {
   
-if (buffer_len < sizeof(Packet)) return;
+if (buffer_len < sizeof(Packet)) { Counters::count(Counters::ARP_DROP_INVALID); return; }
 
-    auto *arp = reinterpret_cast<const Packet * >(buffer);
+    if (!HeaderView::matches<Fields::EthernetIpv4>(buffer))
+    {
+        Counters::count(Counters::ARP_DROP_INVALID);
+        return;
+    }
 
-    if (ntohs(arp->hdr.ar_hrd) != ARPHRD_ETHER) return;
-    if (ntohs(arp->hdr.ar_pro) != ARPPRO_IP) return;
+    uint16_t op = HeaderView::get<Fields::Operation>(buffer);
+    Ethernet::Address src_mac = HeaderView::get<Fields::SenderMac>(buffer);
+    IPv4::Address src_ip = HeaderView::get<Fields::SenderIp>(buffer);
+    Ethernet::Address dst_mac = HeaderView::get<Fields::TargetMac>(buffer);
+    IPv4::Address dst_ip = HeaderView::get<Fields::TargetIp>(buffer);
 
-    if (ntohs(arp->hdr.ar_op) == ARPOP_REQUEST)
+    if (op == ARPOP_REQUEST)
     {
+        Counters::count(Counters::ARP_RX_REQUESTS);
+
         // log every request 
-        log_arp_request(&arp->src_mac, &arp->src_ip, &arp->dst_mac, &arp->dst_ip);
+        log_arp_request(&src_mac, &src_ip, &dst_mac, &dst_ip);
+
+        // scanning and flooding sources are neither learned nor answered
+        if (flood && !flood->check(Flood::Detector::ARP_REQUEST, src_ip.s_addr, Clock::packet_time))
+        {
+            Counters::count(Counters::ARP_DROP_DENIED);
+            return;
+        }
 
         // check if for me
-        if (ipv4_handler->isOwnIpAddress(arp->dst_ip))
+        if (ipv4_handler->isOwnIpAddress(dst_ip))
+        {
+            learn(src_ip, src_mac);
+            send(ethernet_handler->mac, dst_ip, src_mac, src_ip);
+        }
+    }
+    else if (op == ARPOP_REPLY)
+    {
+        Counters::count(Counters::ARP_RX_REPLIES);
+
+        // answers to our own requests
+        if (ipv4_handler->isOwnIpAddress(dst_ip))
         {
-            send(ethernet_handler->mac, arp->dst_ip, arp->src_mac, arp->src_ip);
+            learn(src_ip, src_mac);
         }
     }
 }
 
+void Protocol::learn(const IPv4::Address &ip, const Ethernet::Address &mac) {
+  switch (neighbours.learn(ip.s_addr, mac)) {
+  case Neighbours::CHANGED:
+    ipv4_handler->invalidate_headers(ip);
+    break;
+  case Neighbours::EVICTED:
+    // nothing to invalidate, cached headers only match the hardware address they were built for
+    Counters::count(Counters::ARP_EVICTED);
+    break;
+  default:
+    break;
+  }
+}
+
+void Protocol::observe(const uint8_t *buffer, size_t buffer_len) {
+  if (buffer_len < sizeof(Packet) || !HeaderView::matches<Fields::EthernetIpv4>(buffer))
+    return;
+
+  // the same entries handle_packet learns, requests for us and replies to us
+  uint16_t op = HeaderView::get<Fields::Operation>(buffer);
+  if ((op == ARPOP_REQUEST || op == ARPOP_REPLY) &&
+      ipv4_handler->isOwnIpAddress(HeaderView::get<Fields::TargetIp>(buffer)))
+    learn(HeaderView::get<Fields::SenderIp>(buffer), HeaderView::get<Fields::SenderMac>(buffer));
+}
+
 void Protocol::send(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
                     const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip) {
-                        
-  Packet reply;
+  log_arp_reply(&src_mac, &src_ip, &dst_mac, &dst_ip);
+  Counters::count(Counters::ARP_TX_REPLIES);
+
+  send(ARPOP_REPLY, src_mac, src_ip, dst_mac, dst_ip, dst_mac);
+}
 
-  reply.hdr.ar_hrd = htons(ARPHRD_ETHER);
-  reply.hdr.ar_pro = htons(ARPPRO_IP);
-  reply.hdr.ar_hln = ETH_ALEN;
-  reply.hdr.ar_pln = 4;
-  reply.hdr.ar_op = htons(ARPOP_REPLY);
+void Protocol::request(const IPv4::Address &ip) {
+  const Ethernet::Address unknown = {{0, 0, 0, 0, 0, 0}};
+  const Ethernet::Address broadcast = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+  IPv4::Address src_ip = ipv4_handler->address();
 
-  reply.src_mac  = src_mac;
-  reply.src_ip = src_ip;  
-  reply.dst_mac = dst_mac;
-  reply.dst_ip = dst_ip;
+  log_arp_request(&ethernet_handler->mac, &src_ip, &unknown, &ip);
+  Counters::count(Counters::ARP_TX_REQUESTS);
 
-  log_arp_reply(&src_mac, &src_ip, &dst_mac, &dst_ip);
+  send(ARPOP_REQUEST, ethernet_handler->mac, src_ip, unknown, ip, broadcast);
+}
+
+void Protocol::send(uint16_t op, const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+                    const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip,
+                    const Ethernet::Address &eth_dst) {
+  uint8_t packet[sizeof(Packet)];
+
+  HeaderView::set<Fields::HardwareType>(packet, ARPHRD_ETHER);
+  HeaderView::set<Fields::ProtocolType>(packet, Ethernet::TYPE_IP);
+  HeaderView::set<Fields::HardwareLength>(packet, ETH_ALEN);
+  HeaderView::set<Fields::ProtocolLength>(packet, 4);
+  HeaderView::set<Fields::Operation>(packet, op);
+
+  HeaderView::set<Fields::SenderMac>(packet, src_mac);
+  HeaderView::set<Fields::SenderIp>(packet, src_ip);
+  HeaderView::set<Fields::TargetMac>(packet, dst_mac);
+  HeaderView::set<Fields::TargetIp>(packet, dst_ip);
 
-  ethernet_handler->send(dst_mac, ETHERTYPE_ARP, (uint8_t *)&reply, sizeof(Packet));
+  ethernet_handler->send(eth_dst, ETHERTYPE_ARP, packet, sizeof(packet));
 }
@@ -1,7 +1,11 @@
 #pragma once
 #include "../layer_link/ethernet.h"
 #include "../layer_internet/ipv4.h"
+#include "../fixed_tables.h"
+#include "../flood.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 #include <net/if_arp.h> // struct arphdr
@@ -34,10 +38,78 @@ struct Packet {
   IPv4::Address dst_ip;
 } __attribute__((packed));
 
+// Fields of the packet, for HeaderView::get and HeaderView::set.
+namespace Fields {
+using HardwareType = HeaderView::Field<0, uint16_t>;
+using ProtocolType = HeaderView::Field<2, uint16_t>;
+using HardwareLength = HeaderView::Field<4, uint8_t>;
+using ProtocolLength = HeaderView::Field<5, uint8_t>;
+using Operation = HeaderView::Field<6, uint16_t>;
+using SenderMac = HeaderView::Raw<8, Ethernet::Address>;
+using SenderIp = HeaderView::Raw<14, IPv4::Address>;
+using TargetMac = HeaderView::Raw<18, Ethernet::Address>;
+using TargetIp = HeaderView::Raw<24, IPv4::Address>;
+
+// Ethernet and IPv4 addresses, the only kind the stack speaks
+using EthernetIpv4 = HeaderView::Pattern<HeaderView::Is<HardwareType, ARPHRD_ETHER>,
+                                         HeaderView::Is<ProtocolType, Ethernet::TYPE_IP>,
+                                         HeaderView::Is<HardwareLength, ETH_ALEN>,
+                                         HeaderView::Is<ProtocolLength, 4>>;
+} // namespace Fields
+
+// Neighbour cache in constant memory, keyed by IPv4 address in network byte order.
+//
+// Neighbours live in a fixed number of sets of four, one cache line each, like the buckets of
+// ICMP::RateLimiter. A neighbour hashes to one set and replaces the one learned longest ago if the
+// set is full, so learning never allocates and a flood of spoofed requests only evicts.
+class Neighbours {
+public:
+  static constexpr size_t SETS_LOG2 = 8;
+  static constexpr size_t WAYS = 4;
+
+  enum Learned { ADDED = 0, KNOWN, CHANGED, EVICTED };
+
+  Neighbours();
+
+  // Add or refresh ip, EVICTED if another neighbour had to make room.
+  Learned learn(uint32_t ip, const Ethernet::Address &mac);
+
+  bool find(uint32_t ip, Ethernet::Address &mac) const;
+
+  size_t size() const { return used; }
+
+private:
+  struct Entry {
+    uint32_t ip;
+    Ethernet::Address mac;
+    uint32_t learned; // stamp of the last learn, 0 for unused entries
+  };
+
+  struct alignas(64) Set {
+    Entry entries[WAYS];
+  };
+  static_assert(sizeof(Set) == 64, "a set should fill exactly one cache line");
+
+  Fixed::Array<Set> sets;
+  uint32_t stamp = 0;
+  size_t used = 0;
+
+  Set &set(uint32_t ip) const { return sets[(ip * 0x9e3779b1u) >> (32 - SETS_LOG2)]; }
+};
+
 class Protocol {
 private:
   Ethernet::Protocol *ethernet_handler;
   IPv4::Protocol *ipv4_handler;
+  Flood::Detector *flood = nullptr; // shared with ICMP, requests are not checked if not set
+
+  Neighbours neighbours;
+
+  void learn(const IPv4::Address &ip, const Ethernet::Address &mac);
+
+  void send(uint16_t op, const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+            const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip,
+            const Ethernet::Address &eth_dst);
 
 public:
   void set_ethernet_handler(const std::unique_ptr<Ethernet::Protocol> &handler) {
@@ -48,9 +120,24 @@ public:
     ipv4_handler = handler.get();
   }
 
+  void set_flood_detector(Flood::Detector *detector) { flood = detector; }
+
   void handle_packet(const uint8_t *buffer, size_t buffer_len);
 
+  // Learn from a packet another stack instance handles, without logging or answering it.
+  void observe(const uint8_t *buffer, size_t buffer_len);
+
   void send(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
             const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip);
+
+  // Look up the hardware address of a neighbour learned from earlier ARP traffic.
+  bool resolve(const IPv4::Address &ip, Ethernet::Address &mac) const {
+    return neighbours.find(ip.s_addr, mac);
+  }
+
+  size_t neighbour_count() const { return neighbours.size(); }
+
+  // Broadcast a request for the hardware address of ip.
+  void request(const IPv4::Address &ip);
 };
 } // namespace ARP
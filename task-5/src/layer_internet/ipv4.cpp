@@ -1,7 +1,15 @@
 #include "ipv4.h"
 #include "../layer_link/ethernet.h"
+#include "../layer_internet/arp.h"
+#include "../layer_internet/route.h"
 #include "../icmp/icmp.h"
+#include "../tcp/tcp.h"
+#include "../udp/udp.h"
+#include "../clock.h"
+#include "../counters.h"
+#include "../flows.h"
 #include "../logging.h"
+#include "../trace.h"
 
 #include <algorithm>
 #include <cstring>
@@ -10,66 +18,182 @@ using namespace IPv4;
 
 Protocol::Protocol(const Address &address) : ipAddress(address) {
   icmp_handler = std::make_unique<ICMP::Protocol>(this);
+  udp_handler = std::make_unique<UDP::Protocol>(this);
+  tcp_handler = std::make_unique<TCP::Protocol>(this);
 }
 
+Protocol::~Protocol() = default;
+
 void Protocol::handle_packet(const Ethernet::Address &src_mac, const uint8_t *buffer,
                              size_t buffer_len) {
                               
-  if (buffer_len < sizeof(Header))  return;
-
-  auto *ip = reinterpret_cast<const Header *>(buffer);
-
-  if (ip->ip_v != 4) return;
-
-  Address src_ip = ip->ip_src; 
-  Address dst_ip = ip->ip_dst;
+  if (buffer_len < sizeof(Header)) {
+    Counters::count(Counters::IPV4_DROP_SHORT);
+    return;
+  }
+
+  // almost every packet has no options, which is checked together with the version
+  uint32_t header_len = sizeof(Header);
+  if (!HeaderView::matches<Fields::Plain>(buffer)) {
+    if (HeaderView::get<Fields::Version>(buffer) != 4) {
+      Counters::count(Counters::IPV4_DROP_VERSION);
+      return;
+    }
+    header_len = HeaderView::get<Fields::HeaderLength>(buffer) * 4;
+  }
+  Counters::count(Counters::IPV4_RX_PACKETS);
+
+  Address src_ip = HeaderView::get<Fields::Source>(buffer);
+  Address dst_ip = HeaderView::get<Fields::Destination>(buffer);
 
   log_ip_packet(&src_ip, &dst_ip);
 
   // only mine
-  if (!isOwnIpAddress(dst_ip)) return;
-
-  // only ICMP  
-  if (ip->ip_p != IPPROTO_ICMP) return;
-
-  uint32_t header_len = ip->ip_hl * 4;
-  if (header_len > buffer_len) return;
-
-  const uint8_t *icmp_start = buffer + header_len;
-  size_t icmp_len = buffer_len - header_len;
-
-  icmp_handler->handle_packet(src_mac, src_ip, dst_ip, icmp_start, icmp_len); 
+  if (!isOwnIpAddress(dst_ip)) {
+    Counters::count(Counters::IPV4_DROP_NOT_OURS);
+    return;
+  }
+
+  // only ICMP, UDP and TCP
+  uint8_t protocol = HeaderView::get<Fields::Protocol>(buffer);
+  if (protocol != IPPROTO_ICMP && protocol != IPPROTO_UDP && protocol != IPPROTO_TCP) {
+    Counters::count(Counters::IPV4_DROP_PROTOCOL);
+    return;
+  }
+
+  if (header_len > buffer_len) {
+    Counters::count(Counters::IPV4_DROP_LENGTH);
+    return;
+  }
+
+  // ignore the Ethernet padding of short frames
+  size_t total_len = HeaderView::get<Fields::TotalLength>(buffer);
+  if (total_len >= header_len && total_len < buffer_len) buffer_len = total_len;
+
+  const uint8_t *payload = buffer + header_len;
+  size_t payload_len = buffer_len - header_len;
+
+  if (flows)
+    flows->record(src_ip.s_addr, dst_ip.s_addr, protocol, payload, payload_len, buffer_len,
+                  Clock::packet_time);
+
+  switch (protocol) {
+  case IPPROTO_ICMP:
+    Counters::count(Counters::IPV4_RX_ICMP);
+    TRACE_POINT(POINT_ICMP);
+    icmp_handler->handle_packet(src_mac, src_ip, dst_ip, payload, payload_len);
+    break;
+  case IPPROTO_UDP:
+    Counters::count(Counters::IPV4_RX_UDP);
+    TRACE_POINT(POINT_UDP);
+    udp_handler->handle_packet(src_mac, src_ip, dst_ip, payload, payload_len);
+    break;
+  case IPPROTO_TCP:
+    Counters::count(Counters::IPV4_RX_TCP);
+    TRACE_POINT(POINT_TCP);
+    tcp_handler->handle_packet(src_mac, src_ip, dst_ip, payload, payload_len);
+    break;
+  }
+}
 
+void Protocol::write_headers(uint8_t *frame, const Ethernet::Address &dst_mac,
+                             const Address &dst_ip, uint8_t protocol, size_t total_len) {
+  HeaderCache::Entry &entry = header_cache.slot(dst_ip);
+  if (header_cache.matches(entry, dst_mac, dst_ip)) {
+    Counters::count(Counters::IPV4_TX_HEADER_HITS);
+  } else {
+    Counters::count(Counters::IPV4_TX_HEADER_MISSES);
+    entry.valid = true;
+    entry.ip = dst_ip;
+    entry.mac = dst_mac;
+
+    HeaderView::set<Ethernet::Fields::Destination>(entry.header, dst_mac);
+    HeaderView::set<Ethernet::Fields::Source>(entry.header, ethernet_handler->mac);
+    HeaderView::set<Ethernet::Fields::Type>(entry.header, Ethernet::TYPE_IP);
+
+    // the partial sum is taken while the varying words are still zero
+    uint8_t *ip = entry.header + Ethernet::Protocol::HEADROOM;
+    memset(ip, 0, sizeof(Header));
+    HeaderView::set<Fields::Version>(ip, 4);
+    HeaderView::set<Fields::HeaderLength>(ip, 5);
+    HeaderView::set<Fields::Source>(ip, ipAddress);
+    HeaderView::set<Fields::Destination>(ip, dst_ip);
+    entry.partial = static_cast<uint16_t>(~checksum(ip, sizeof(Header)));
+    HeaderView::set<Fields::TTL>(ip, 64);
+  }
+
+  memcpy(frame, entry.header, HeaderCache::SIZE);
+  uint8_t *ip = frame + Ethernet::Protocol::HEADROOM;
+  HeaderView::set<Fields::TotalLength>(ip, total_len);
+  HeaderView::set<Fields::Protocol>(ip, protocol);
+  // the words as they are stored, like checksum sums them
+  uint16_t words[5];
+  memcpy(words, ip, sizeof(words));
+  uint32_t sum = entry.partial + words[1] + words[4];
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum += sum >> 16;
+  HeaderView::set<Fields::Checksum>(ip, static_cast<uint16_t>(~sum));
 }
 
 void Protocol::send(const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip,
                     const uint16_t protocol, uint8_t *payload, size_t payload_len) {
+  size_t total_len = sizeof(Header) + payload_len;
+  std::vector<uint8_t> frame(Ethernet::Protocol::HEADROOM + total_len);
+  write_headers(frame.data(), dst_mac, dst_ip, protocol, total_len);
+  memcpy(frame.data() + HeaderCache::SIZE, payload, payload_len);
 
-  size_t ip_header_len = sizeof(Header);
-  size_t total_len = ip_header_len + payload_len;
+  log_ip_packet(&ipAddress, &dst_ip);
+  Counters::count(Counters::IPV4_TX_PACKETS);
 
-  std::vector<uint8_t> packet(total_len);
-  auto *ip = reinterpret_cast<Header *>(packet.data());
+  ethernet_handler->send_frame(frame.data(), frame.size());
+}
 
-  memset(ip, 0, ip_header_len);
+void Protocol::send_in_place(const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip,
+                             const uint16_t protocol, uint8_t *payload, size_t payload_len) {
+  uint8_t *frame = payload - HeaderCache::SIZE;
+  write_headers(frame, dst_mac, dst_ip, protocol, sizeof(Header) + payload_len);
 
-  ip->ip_v = 4;
-  ip->ip_hl = 5;
-  ip->ip_tos = 0;
-  ip->ip_len = htons(total_len);
-  ip->ip_id  = 0;
-  ip->ip_off = 0;
-  ip->ip_ttl = 64;
-  ip->ip_p = protocol;
-  ip->ip_src  = ipAddress;
-  ip->ip_dst = dst_ip;
+  log_ip_packet(&ipAddress, &dst_ip);
+  Counters::count(Counters::IPV4_TX_PACKETS);
 
-  ip->ip_sum = 0;
-  ip->ip_sum = checksum(ip, ip_header_len);
+  ethernet_handler->send_frame(frame, HeaderCache::SIZE + payload_len);
+}
 
-  memcpy(packet.data() + ip_header_len, payload, payload_len);
+bool Protocol::next_hop_mac(const IPv4::Address &dst_ip, Ethernet::Address &dst_mac) {
+  Route::NextHop next_hop;
+  if (!router || !router->snapshot()->lookup(dst_ip, next_hop)) {
+    Counters::count(Counters::IPV4_TX_NO_ROUTE);
+    return false;
+  }
+
+  // on-link destinations are resolved directly
+  Address neighbour = next_hop.gateway.s_addr ? next_hop.gateway : dst_ip;
+
+  if (!arp_handler || !arp_handler->resolve(neighbour, dst_mac)) {
+    Counters::count(Counters::IPV4_TX_UNRESOLVED);
+    if (arp_handler)
+      arp_handler->request(neighbour);
+    return false;
+  }
+  return true;
+}
 
-  log_ip_packet(&ipAddress, &dst_ip);
+bool Protocol::send(const IPv4::Address &dst_ip, const uint16_t protocol, uint8_t *payload,
+                    size_t payload_len) {
+  Ethernet::Address dst_mac;
+  if (!next_hop_mac(dst_ip, dst_mac))
+    return false;
+
+  send(dst_mac, dst_ip, protocol, payload, payload_len);
+  return true;
+}
+
+bool Protocol::send_in_place(const IPv4::Address &dst_ip, const uint16_t protocol,
+                             uint8_t *payload, size_t payload_len) {
+  Ethernet::Address dst_mac;
+  if (!next_hop_mac(dst_ip, dst_mac))
+    return false;
 
-  ethernet_handler->send(dst_mac, Ethernet::TYPE_IP, packet.data(), packet.size());
+  send_in_place(dst_mac, dst_ip, protocol, payload, payload_len);
+  return true;
 }
@@ -7,14 +7,31 @@ struct Address {
 };
 } // namespace IPv4
 
+#include "../header_view.h"
 #include "../icmp/icmp.h"
 
+#include <cstring>
 #include <map>
 #include <memory>
 
 namespace ICMP {
 class Protocol;
 }
+namespace UDP {
+class Protocol;
+}
+namespace TCP {
+class Protocol;
+}
+namespace ARP {
+class Protocol;
+}
+namespace Route {
+class Router;
+}
+namespace Flows {
+class Table;
+}
 
 namespace IPv4 {
 
@@ -44,26 +61,132 @@ struct Frame {
   uint8_t payload[];
 } __attribute__((__packed__));
 
+// Fields of the header, for HeaderView::get and HeaderView::set.
+namespace Fields {
+using Version = HeaderView::Bits<0, 4, 4>;
+using HeaderLength = HeaderView::Bits<0, 0, 4>; // in 32-bit words
+using TotalLength = HeaderView::Field<2, uint16_t>;
+using Identification = HeaderView::Field<4, uint16_t>;
+using FragmentOffset = HeaderView::Field<6, uint16_t>; // with the flags
+using TTL = HeaderView::Field<8, uint8_t>;
+using Protocol = HeaderView::Field<9, uint8_t>;
+using Checksum = HeaderView::Raw<10, uint16_t>; // as Protocol::checksum computes it
+using Source = HeaderView::Raw<12, Address>;
+using Destination = HeaderView::Raw<16, Address>;
+
+// version 4 without options, the common case
+using Plain = HeaderView::Pattern<HeaderView::Is<Version, 4>, HeaderView::Is<HeaderLength, 5>>;
+} // namespace Fields
+
+// Prebuilt Ethernet and IPv4 headers of the packets to recent peers. Everything but the total
+// length, the protocol and the checksum is the same for every packet to a peer, so sending copies
+// the headers and completes the checksum from a partial sum over the constant words.
+//
+// Direct mapped by the IPv4 address of the peer, an entry is only used if the hardware address
+// matches too. A collision replaces the older peer.
+class HeaderCache {
+public:
+  static constexpr size_t SIZE = Ethernet::Protocol::HEADROOM + sizeof(Header);
+  static constexpr size_t ENTRIES = 256;
+
+  struct Entry {
+    bool valid = false;
+    Address ip;
+    Ethernet::Address mac;
+    // one's complement sum of the IPv4 header without the length, TTL/protocol and checksum words
+    uint32_t partial;
+    uint8_t header[SIZE];
+  };
+
+  Entry &slot(const Address &ip) { return entries[index(ip)]; }
+
+  bool matches(const Entry &entry, const Ethernet::Address &mac, const Address &ip) const {
+    return entry.valid && entry.ip.s_addr == ip.s_addr &&
+           memcmp(&entry.mac, &mac, sizeof(mac)) == 0;
+  }
+
+  // Forget the headers of ip, for example when its hardware address changes.
+  void invalidate(const Address &ip) {
+    Entry &entry = slot(ip);
+    if (entry.ip.s_addr == ip.s_addr)
+      entry.valid = false;
+  }
+
+private:
+  Entry entries[ENTRIES];
+
+  static size_t index(const Address &ip) { return (ip.s_addr * 0x9e3779b1u) >> 24; }
+};
+
 class Protocol {
 private:
   Address ipAddress;
   Ethernet::Protocol *ethernet_handler;
+  ARP::Protocol *arp_handler = nullptr;
+  Route::Router *router = nullptr;
   std::unique_ptr<ICMP::Protocol> icmp_handler;
+  std::unique_ptr<UDP::Protocol> udp_handler;
+  std::unique_ptr<TCP::Protocol> tcp_handler;
+  HeaderCache header_cache;
+  Flows::Table *flows = nullptr;
+
+  bool next_hop_mac(const IPv4::Address &dst_ip, Ethernet::Address &dst_mac);
+
+  // Write the Ethernet and IPv4 headers (HeaderCache::SIZE bytes) of a packet to frame.
+  void write_headers(uint8_t *frame, const Ethernet::Address &dst_mac, const Address &dst_ip,
+                     uint8_t protocol, size_t total_len);
 
 public:
   Protocol(const Address &address);
+  ~Protocol();
 
   bool isOwnIpAddress(const Address &address) { return ipAddress.s_addr == address.s_addr; }
 
+  const Address &address() const { return ipAddress; }
+
   void handle_packet(const Ethernet::Address &src_mac, const uint8_t *buffer, size_t buffer_len);
 
   void send(const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip, const uint16_t protocol,
             uint8_t *payload, size_t payload_len);
 
+  // Space a caller has to leave in front of a payload passed to send_in_place.
+  static constexpr size_t HEADROOM = Ethernet::Protocol::HEADROOM + sizeof(Header);
+
+  // Like send, but the IPv4 and Ethernet headers are written into the headroom in front of
+  // payload so that the packet is transmitted without copying.
+  void send_in_place(const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip,
+                     const uint16_t protocol, uint8_t *payload, size_t payload_len);
+
+  // Originate a packet: the next hop is taken from the routing table and resolved through ARP.
+  // Returns false if there is no route or the next hop is not resolved yet. In the latter case an
+  // ARP request is sent so that a retry can succeed.
+  bool send(const IPv4::Address &dst_ip, const uint16_t protocol, uint8_t *payload,
+            size_t payload_len);
+
+  // Routed variant of send_in_place, see above.
+  bool send_in_place(const IPv4::Address &dst_ip, const uint16_t protocol, uint8_t *payload,
+                     size_t payload_len);
+
   void set_ethernet_handler(const std::unique_ptr<Ethernet::Protocol> &handler) {
     ethernet_handler = handler.get();
   }
 
+  void set_arp_handler(const std::unique_ptr<ARP::Protocol> &handler) {
+    arp_handler = handler.get();
+  }
+
+  void set_router(Route::Router *routing) { router = routing; }
+
+  // Count the packets for us per flow in table, nullptr to stop.
+  void set_flow_table(Flows::Table *table) { flows = table; }
+
+  // The hardware address of ip changed, the prebuilt headers of packets to it are stale.
+  void invalidate_headers(const Address &ip) { header_cache.invalidate(ip); }
+
+  ICMP::Protocol *icmp() { return icmp_handler.get(); }
+  UDP::Protocol *udp() { return udp_handler.get(); }
+  TCP::Protocol *tcp() { return tcp_handler.get(); }
+
   static uint16_t checksum(void *data, size_t len) {
     auto p = reinterpret_cast<const uint16_t *>(data);
     uint32_t sum = 0;
@@ -80,5 +203,20 @@ public:
     }
     return static_cast<uint16_t>(~sum);
   }
+
+  // Checksum of a transport segment including the IPv4 pseudo header (RFC 768, RFC 793).
+  static uint16_t checksum(const Address &src, const Address &dst, uint8_t protocol,
+                           const void *data, size_t len) {
+    auto p = reinterpret_cast<const uint16_t *>(data);
+    uint64_t sum = (uint64_t)(src.s_addr & 0xffff) + (src.s_addr >> 16) + (dst.s_addr & 0xffff) +
+                   (dst.s_addr >> 16) + htons(protocol) + htons(len);
+    if (len & 1)
+      sum += reinterpret_cast<const uint8_t *>(p)[len - 1];
+    for (len /= 2; len; len--)
+      sum += *p++;
+    while (sum >> 16)
+      sum = (sum >> 16) + (sum & 0xffff);
+    return static_cast<uint16_t>(~sum);
+  }
 };
 } // namespace IPv4
@@ -0,0 +1,194 @@
+#include "route.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h> // inet_pton
+
+using namespace Route;
+
+constexpr uint16_t Table::NO_ROUTE;
+constexpr uint16_t Table::EXTENDED;
+
+bool Builder::add(const IPv4::Address &prefix, unsigned prefix_len, const IPv4::Address &gateway,
+                  uint16_t interface) {
+  if (prefix_len > 32)
+    return false;
+
+  // next hops are shared between routes, the index has to fit into 15 bits
+  uint64_t key = (uint64_t)interface << 32 | gateway.s_addr;
+  auto it = next_hop_index.find(key);
+  uint16_t index;
+  if (it != next_hop_index.end()) {
+    index = it->second;
+  } else {
+    if (next_hops.size() + 1 >= Table::EXTENDED)
+      return false;
+    next_hops.push_back({gateway, interface});
+    index = next_hops.size(); // 0 is reserved for "no route"
+    next_hop_index.emplace(key, index);
+  }
+
+  uint32_t mask = prefix_len ? ~0u << (32 - prefix_len) : 0;
+  routes.push_back({ntohl(prefix.s_addr) & mask, (uint8_t)prefix_len, index});
+  return true;
+}
+
+bool Builder::add(const char *prefix, const char *gateway, uint16_t interface) {
+  char addr[INET_ADDRSTRLEN];
+  const char *slash = strchr(prefix, '/');
+  size_t addr_len = slash ? (size_t)(slash - prefix) : strlen(prefix);
+  if (addr_len >= sizeof(addr))
+    return false;
+  memcpy(addr, prefix, addr_len);
+  addr[addr_len] = '\0';
+
+  unsigned prefix_len = 32;
+  if (slash) {
+    char *end;
+    prefix_len = strtoul(slash + 1, &end, 10);
+    if (end == slash + 1 || *end != '\0')
+      return false;
+  }
+
+  IPv4::Address prefix_addr, gateway_addr;
+  if (inet_pton(AF_INET, addr, &prefix_addr) != 1 || inet_pton(AF_INET, gateway, &gateway_addr) != 1)
+    return false;
+
+  return add(prefix_addr, prefix_len, gateway_addr, interface);
+}
+
+bool Builder::load(const char *filename) {
+  FILE *file = fopen(filename, "r");
+  if (!file)
+    return false;
+
+  char line[256];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file)) {
+    char prefix[64], gateway[64];
+    unsigned interface = 0;
+    int fields = sscanf(line, "%63s %63s %u", prefix, gateway, &interface);
+    if (fields <= 0 || prefix[0] == '#')
+      continue;
+    ok = fields >= 2 && add(prefix, gateway, interface);
+  }
+
+  fclose(file);
+  return ok;
+}
+
+std::unique_ptr<const Table> Builder::build() const {
+  auto table = std::make_unique<Table>();
+  table->route_count = routes.size();
+  if (routes.empty())
+    return table;
+
+  table->next_hops.reserve(next_hops.size() + 1);
+  table->next_hops.push_back({{0}, 0});
+  table->next_hops.insert(table->next_hops.end(), next_hops.begin(), next_hops.end());
+
+  // Keep the last route for every prefix and order them by start address with less specific
+  // prefixes first. Prefixes are either nested or disjoint, so a sweep over the address space with
+  // a stack of enclosing routes writes every tbl24 slot exactly once.
+  std::vector<Entry> sorted(routes.rbegin(), routes.rend());
+  std::stable_sort(sorted.begin(), sorted.end(), [](const Entry &a, const Entry &b) {
+    return a.prefix != b.prefix ? a.prefix < b.prefix : a.prefix_len < b.prefix_len;
+  });
+  sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                           [](const Entry &a, const Entry &b) {
+                             return a.prefix == b.prefix && a.prefix_len == b.prefix_len;
+                           }),
+               sorted.end());
+
+  auto &tbl24 = table->tbl24;
+  auto &tbl8 = table->tbl8;
+  tbl24.resize(1 << 24);
+
+  struct Enclosing {
+    size_t end;
+    uint16_t next_hop;
+  };
+  std::vector<Enclosing> stack;
+  size_t pos = 0;
+  auto fill_to = [&](size_t end) {
+    std::fill(tbl24.begin() + pos, tbl24.begin() + end,
+              stack.empty() ? Table::NO_ROUTE : stack.back().next_hop);
+    pos = end;
+  };
+
+  for (const auto &route : sorted) {
+    if (route.prefix_len > 24)
+      continue;
+    size_t first = route.prefix >> 8;
+    while (!stack.empty() && stack.back().end <= first) {
+      fill_to(stack.back().end);
+      stack.pop_back();
+    }
+    fill_to(first);
+    stack.push_back({first + ((size_t)1 << (24 - route.prefix_len)), route.next_hop});
+  }
+  while (!stack.empty()) {
+    fill_to(stack.back().end);
+    stack.pop_back();
+  }
+  fill_to(tbl24.size());
+
+  // Longer prefixes split their /24 into a tbl8 group which inherits the covering route. Within
+  // a group the routes are applied from less to more specific.
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Entry &a, const Entry &b) { return a.prefix_len < b.prefix_len; });
+
+  for (const auto &route : sorted) {
+    if (route.prefix_len <= 24)
+      continue;
+
+    uint16_t &entry = tbl24[route.prefix >> 8];
+    if (!(entry & Table::EXTENDED)) {
+      size_t group = tbl8.size() >> 8;
+      if (group >= Table::EXTENDED)
+        return nullptr;
+      tbl8.resize(tbl8.size() + 256, entry);
+      entry = Table::EXTENDED | group;
+    }
+
+    size_t first = (size_t)(entry & ~Table::EXTENDED) << 8 | (route.prefix & 0xff);
+    size_t count = (size_t)1 << (32 - route.prefix_len);
+    std::fill_n(tbl8.begin() + first, count, route.next_hop);
+  }
+
+  return table;
+}
+
+Router::Router() : table(new Table()) {}
+
+Router::~Router() { delete table.load(); }
+
+Router::Reader *Router::add_reader() {
+  std::lock_guard<std::mutex> lock(writer);
+  readers.emplace_back();
+  readers.back().epoch.store(epoch.load());
+  return &readers.back();
+}
+
+void Router::swap(std::unique_ptr<const Table> new_table) {
+  {
+    std::lock_guard<std::mutex> lock(writer);
+    // the epoch moves on after the new table is visible, a reader that saw it loads the new table
+    const Table *old = table.exchange(new_table.release());
+    retired.push_back({std::unique_ptr<const Table>(old), epoch.fetch_add(1) + 1});
+  }
+  reclaim();
+}
+
+void Router::reclaim() {
+  std::lock_guard<std::mutex> lock(writer);
+  uint64_t oldest = epoch.load();
+  for (const Reader &reader : readers)
+    oldest = std::min(oldest, reader.epoch.load(std::memory_order_acquire));
+  retired.erase(std::remove_if(retired.begin(), retired.end(),
+                               [oldest](const Retired &r) { return r.epoch <= oldest; }),
+                retired.end());
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "../layer_internet/ipv4.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h> // ntohl
+
+namespace Route {
+
+// Resolved forwarding decision for a destination. A gateway of 0.0.0.0 means the destination is
+// on-link and has to be resolved directly.
+struct NextHop {
+  IPv4::Address gateway;
+  uint16_t interface;
+};
+
+// DIR-24-8 longest-prefix-match table.
+//
+// The upper 24 bits of a destination index tbl24. Prefixes up to /24 are expanded into tbl24 so
+// that a lookup is a single memory access. Entries covered by a longer prefix point to a 256
+// entry group in tbl8 which is indexed by the lowest byte. Tables are immutable once built and
+// are replaced as a whole (see Router).
+class Table {
+public:
+  bool lookup(const IPv4::Address &dst, NextHop &next_hop) const {
+    if (tbl24.empty())
+      return false;
+
+    uint32_t addr = ntohl(dst.s_addr);
+    uint16_t entry = tbl24[addr >> 8];
+    if (entry & EXTENDED)
+      entry = tbl8[(size_t)(entry & ~EXTENDED) << 8 | (addr & 0xff)];
+    if (entry == NO_ROUTE)
+      return false;
+
+    next_hop = next_hops[entry];
+    return true;
+  }
+
+  size_t size() const { return route_count; }
+
+private:
+  friend class Builder;
+
+  static constexpr uint16_t NO_ROUTE = 0;
+  static constexpr uint16_t EXTENDED = 0x8000;
+
+  std::vector<uint16_t> tbl24;
+  std::vector<uint16_t> tbl8;
+  std::vector<NextHop> next_hops;
+  size_t route_count = 0;
+};
+
+// Collects routes and compiles them into a Table. Routes can be added one by one or bulk loaded
+// from a file with one "<prefix>/<length> <gateway> [<interface>]" entry per line.
+class Builder {
+public:
+  bool add(const IPv4::Address &prefix, unsigned prefix_len, const IPv4::Address &gateway,
+           uint16_t interface = 0);
+  bool add(const char *prefix, const char *gateway, uint16_t interface = 0);
+  bool load(const char *filename);
+
+  // Compile the routes into a new table. Returns nullptr if the prefixes longer than /24 fall into
+  // more distinct /24 networks than tbl8 can hold (32767).
+  std::unique_ptr<const Table> build() const;
+
+private:
+  struct Entry {
+    uint32_t prefix; // host byte order, masked
+    uint8_t prefix_len;
+    uint16_t next_hop;
+  };
+
+  std::vector<Entry> routes;
+  std::vector<NextHop> next_hops;
+  std::unordered_map<uint64_t, uint16_t> next_hop_index;
+};
+
+// Holds the active table, replaced as a whole while lookups go on, read-copy-update style.
+//
+// A lookup is a single acquire load of the table pointer, without a lock or a reference count.
+// A replaced table is retired instead of freed, and freed once every registered reader reported a
+// quiescent state after the swap, a point where it holds no table, like a stack between two polls.
+// A reader that never reports keeps the retired tables alive.
+class Router {
+public:
+  struct Reader {
+    std::atomic<uint64_t> epoch; // of the last quiescent state
+  };
+
+  Router();
+  ~Router();
+
+  // Valid until the next quiescent state of the reader.
+  const Table *snapshot() const { return table.load(std::memory_order_acquire); }
+
+  // Readers are registered for the lifetime of the router.
+  Reader *add_reader();
+
+  void quiescent(Reader *reader) const {
+    reader->epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  // Publish new_table and free the retired tables no reader can hold anymore.
+  void swap(std::unique_ptr<const Table> new_table);
+
+  void reclaim();
+
+private:
+  struct Retired {
+    std::unique_ptr<const Table> table;
+    uint64_t epoch; // of the swap that retired it
+  };
+
+  std::atomic<const Table *> table;
+  std::atomic<uint64_t> epoch{0};
+  std::mutex writer; // swap, reclaim and add_reader
+  std::deque<Reader> readers; // stable addresses
+  std::vector<Retired> retired;
+};
+} // namespace Route
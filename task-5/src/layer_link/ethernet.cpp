@@ -1,7 +1,9 @@
 #include "ethernet.h"
 #include "../layer_internet/arp.h"
 #include "../layer_internet/ipv4.h"
+#include "../counters.h"
 #include "../logging.h"
+#include "../trace.h"
 
 #include <cstring>
 #include <algorithm>
@@ -9,39 +11,78 @@
 using namespace Ethernet;
 
 void Protocol::handle_packet(const uint8_t *buffer, size_t buffer_len) {
-  if (buffer_len < sizeof(Frame))
+  if (buffer_len < sizeof(Frame)) {
+    Counters::count(Counters::ETH_DROP_SHORT);
     return;
+  }
+  Counters::count(Counters::ETH_RX_FRAMES);
+  Counters::count(Counters::ETH_RX_BYTES, buffer_len);
 
-  auto frame = reinterpret_cast<const Frame * >(buffer);
-  log_ethernet_frame(reinterpret_cast<const Address *>(frame->hdr.ether_shost),
-                     reinterpret_cast<const Address *>(frame->hdr.ether_dhost));
+  Address dst = HeaderView::get<Fields::Destination>(buffer);
+  Address src = HeaderView::get<Fields::Source>(buffer);
+  if (admission && !admission->admits(dst)) {
+    Counters::count(Counters::ETH_DROP_NOT_OURS);
+    if (log_dropped)
+      log_ethernet_frame(&src, &dst);
+    return;
+  }
+  log_ethernet_frame(&src, &dst);
 
-  uint16_t ether_type = ntohs(frame->hdr.ether_type);
+  uint16_t ether_type = HeaderView::get<Fields::Type>(buffer);
   const uint8_t *payload = buffer + sizeof(Header);
   size_t payload_len = buffer_len - sizeof(Header);
 
   if (ether_type == TYPE_IP)
   { 
-    ipv4_handler->handle_packet(*reinterpret_cast<const Address * >(frame->hdr.ether_shost), payload, payload_len);
+    Counters::count(Counters::ETH_RX_IPV4);
+    TRACE_POINT(POINT_IPV4);
+    ipv4_handler->handle_packet(src, payload, payload_len);
   }
   else if (ether_type == TYPE_ARP)
   {
+    Counters::count(Counters::ETH_RX_ARP);
+    TRACE_POINT(POINT_ARP);
     arp_handler->handle_packet(payload, payload_len);
   }
+  else
+  {
+    Counters::count(Counters::ETH_RX_OTHER);
+  }
 }
 
 void Protocol::send(const Address &dst, uint16_t ether_type, uint8_t *payload, size_t payload_len) {
   
   std::vector<uint8_t> packet(sizeof(Header) + payload_len);
 
-  auto *header = reinterpret_cast<Header * >(packet.data());
-  memcpy(header->ether_dhost, &dst, ETH_ALEN);
-  memcpy(header->ether_shost, &mac, ETH_ALEN);
-  header->ether_type = htons(ether_type); 
+  HeaderView::set<Fields::Destination>(packet.data(), dst);
+  HeaderView::set<Fields::Source>(packet.data(), mac);
+  HeaderView::set<Fields::Type>(packet.data(), ether_type);
 
   memcpy(packet.data() + sizeof(Header), payload, payload_len);
 
   log_ethernet_frame(&mac, &dst);
 
+  TRACE_POINT(POINT_TX);
   send((uint8_t *)packet.data(), packet.size());
 }
+
+void Protocol::send_in_place(const Address &dst, uint16_t ether_type, uint8_t *payload,
+                             size_t payload_len) {
+  uint8_t *header = payload - sizeof(Header);
+  HeaderView::set<Fields::Destination>(header, dst);
+  HeaderView::set<Fields::Source>(header, mac);
+  HeaderView::set<Fields::Type>(header, ether_type);
+
+  log_ethernet_frame(&mac, &dst);
+
+  TRACE_POINT(POINT_TX);
+  send(header, sizeof(Header) + payload_len);
+}
+
+void Protocol::send_frame(uint8_t *frame, size_t len) {
+  Address dst = HeaderView::get<Fields::Destination>(frame);
+  log_ethernet_frame(&mac, &dst);
+
+  TRACE_POINT(POINT_TX);
+  send(frame, len);
+}
@@ -1,5 +1,9 @@
 #pragma once
+#include "../counters.h"
+#include "../header_view.h"
+
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <vector>
 
@@ -35,10 +39,54 @@ struct Frame {
   uint8_t payload[];
 } __attribute__((__packed__));
 
+// Fields of the header, for HeaderView::get and HeaderView::set.
+namespace Fields {
+using Destination = HeaderView::Raw<0, Address>;
+using Source = HeaderView::Raw<6, Address>;
+using Type = HeaderView::Field<12, uint16_t>;
+} // namespace Fields
+
+// Destination addresses a stack admits, checked before a frame is parsed or logged. In promiscuous
+// mode most frames are unicast to other hosts, a 256 bit map indexed by a hash of the address turns
+// almost all of them away with a single bit test. The few addresses that hit a set bit are
+// compared with the admitted ones.
+class Admission {
+public:
+  void add(const Address &address) {
+    uint64_t key = to_key(address);
+    uint8_t bit = hash(key);
+    bitmap[bit >> 6] |= uint64_t(1) << (bit & 63);
+    keys.push_back(key);
+  }
+
+  bool admits(const Address &address) const {
+    uint64_t key = to_key(address);
+    uint8_t bit = hash(key);
+    if (!(bitmap[bit >> 6] >> (bit & 63) & 1))
+      return false;
+    for (uint64_t admitted : keys)
+      if (admitted == key)
+        return true;
+    return false;
+  }
+
+private:
+  uint64_t bitmap[4] = {};
+  std::vector<uint64_t> keys;
+
+  static uint64_t to_key(const Address &address) {
+    uint64_t key = 0;
+    memcpy(&key, &address, ETH_ALEN);
+    return key;
+  }
+  // the top byte of a multiplicative hash, all six octets influence it
+  static uint8_t hash(uint64_t key) { return (key * 0x9e3779b97f4a7c15) >> 56; }
+};
+
 class Protocol {
+public:
   using send_callback = void (*)(char *buf, size_t bufsiz);
 
-public:
   Address mac;
 
   Protocol(Address mac, const std::unique_ptr<IPv4::Protocol> &ipv4_handler,
@@ -48,16 +96,39 @@ public:
 
   void handle_packet(const uint8_t *buffer, size_t buffer_len);
 
+  // Drop frames to addresses admission does not admit, counted as ethernet.drop.not_ours. With
+  // log_dropped they are still logged, for debugging in promiscuous mode.
+  void set_admission(std::unique_ptr<Admission> admission, bool log_dropped) {
+    this->admission = std::move(admission);
+    this->log_dropped = log_dropped;
+  }
+
   void send(const Address &dst, uint16_t ether_type, uint8_t *payload, size_t payload_len);
 
+  // Space a caller has to leave in front of a payload passed to send_in_place.
+  static constexpr size_t HEADROOM = sizeof(Header);
+
+  // Like send, but the header is written into the headroom in front of payload so that the frame
+  // is transmitted without copying.
+  void send_in_place(const Address &dst, uint16_t ether_type, uint8_t *payload,
+                     size_t payload_len);
+
+  // Transmit a frame whose header the caller wrote already, for example from a template.
+  void send_frame(uint8_t *frame, size_t len);
+
 private:
   IPv4::Protocol *ipv4_handler;
   ARP::Protocol *arp_handler;
   send_callback send_bytes = nullptr;
+  std::unique_ptr<Admission> admission; // all frames are admitted without
+  bool log_dropped = false;
 
   void send(uint8_t *data, size_t data_len) {
-    if (send_bytes)
-      send_bytes((char *)data, data_len);
+    if (!send_bytes)
+      return;
+    Counters::count(Counters::ETH_TX_FRAMES);
+    Counters::count(Counters::ETH_TX_BYTES, data_len);
+    send_bytes((char *)data, data_len);
   }
 };
 } // namespace Ethernet
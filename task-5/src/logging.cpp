@@ -1,43 +1,128 @@
 #include "logging.h"
 
+#include <algorithm>
+#include <cstdarg>
 #include <cstdio>
+#include <vector>
 
 #include <arpa/inet.h>     // inet_ntop
 #include <netinet/ether.h> // ether_ntoa
 
 #define ETHERNET_ADDRSTRLEN 18
 
+// Talkers listed per traffic report.
+#define REPORT_TALKERS 10
+
 size_t log_format = 0;
+bool log_frames = true;
+
+static thread_local std::string *log_buffer = nullptr;
+
+void log_capture(std::string *buffer) { log_buffer = buffer; }
 
 // clang-format off
-static const char *LOG_FORMATS[2][12] = {
+static const char *LOG_FORMATS[2][21] = {
   {"\n[ETHERNET] frame  %s -> %s\n",
    "[IPv4    ] packet %s -> %s\n",
    "[TCP     ] segment port: %u -> %u, seq: %u, ack: %u, flags: [%s %s %s]\n",
    "[ARP     ] request: who has %s tell %s (%s)\n",
    "[ARP     ] reply: %s is at %s\n",
-   "[ICMP    ] PING",
-   "[ICMP    ] PONG",
-   "[HTTP    ] Response: code %s\n",
-   "[HTTP    ] Request: %s %s\n",
-   "[HTTP    ] Host: %s\n",
-   "[HTTP    ] Cookie: %s\n",
-   "[HTTP    ] Basic Auth (decoded): %s\n"},
+   "[ICMP    ] PING\n",
+   "[ICMP    ] PONG\n",
+   "[HTTP    ] Response: code %.*s\n",
+   "[HTTP    ] Request: %.*s %.*s\n",
+   "[HTTP    ] Host: %.*s\n",
+   "[HTTP    ] Cookie: %.*s\n",
+   "[HTTP    ] Basic Auth (decoded): %.*s\n",
+   "[UDP     ] datagram port: %u -> %u, length: %zu\n",
+   "[ICMP    ] dropped by %s rate limit\n",
+   "[PING    ] %s: sent: %lu, received: %lu, lost: %lu (%.2f%%), unresolved: %lu, rtt p50: %.1fus, p99: %.1fus, p99.9: %.1fus\n",
+   "[FLOW    ] %s %s:%u -> %s:%u, packets: %lu, bytes: %lu, first seen: %lu.%06lu, last seen: %lu.%06lu\n",
+   "[REPORT  ] %lu.%06lu - %lu.%06lu: frames: %lu, bytes: %lu, sources: %lu, payload p50: %lu, p90: %lu, p99: %lu\n%s%s%s",
+   "[REPORT  ]   type %s: frames: %lu, bytes: %lu\n",
+   "[REPORT  ]   protocol %s: frames: %lu, bytes: %lu\n",
+   "[REPORT  ]   talker %s: bytes: %lu, error: %lu\n",
+   "[FLOOD   ] %s requests from %s: %lu in the window, threshold: %u, %s\n"},
   {"ETHERNET;%s;%s\n",
    "IPv4;%s;%s\n",
    "TCP;%u;%u;%u,%u;%s;%s;%s\n",
    "ARP;request;%s;%s;%s\n",
    "ARP;reply;%s;%s\n",
-   "ICMP;PING",
-   "ICMP;PONG",
-   "HTTP;response;%s\n",
-   "HTTP;request;%s;%s\n",
-   "HTTP;Host;%s\n",
-   "HTTP;Cookie;%s\n",
-   "HTTP;Basic Auth;%s\n"}
+   "ICMP;PING\n",
+   "ICMP;PONG\n",
+   "HTTP;response;%.*s\n",
+   "HTTP;request;%.*s;%.*s\n",
+   "HTTP;Host;%.*s\n",
+   "HTTP;Cookie;%.*s\n",
+   "HTTP;Basic Auth;%.*s\n",
+   "UDP;%u;%u;%zu\n",
+   "ICMP;dropped;%s\n",
+   "PING;%s;%lu;%lu;%lu;%.2f;%lu;%.1f;%.1f;%.1f\n",
+   "FLOW;%s;%s;%u;%s;%u;%lu;%lu;%lu.%06lu;%lu.%06lu\n",
+   "REPORT;%lu.%06lu;%lu.%06lu;%lu;%lu;%lu;%lu;%lu;%lu;%s;%s;%s\n",
+   "%s:%lu:%lu",
+   "%s:%lu:%lu",
+   "%s:%lu:%lu",
+   "FLOOD;%s;%s;%lu;%u;%s\n"}
 };
 // clang-format on
 
+static void append(std::string &to, const char *format, va_list args) {
+  va_list copy;
+  va_copy(copy, args);
+  int len = vsnprintf(nullptr, 0, format, copy);
+  va_end(copy);
+  if (len > 0) {
+    size_t end = to.size();
+    to.resize(end + len + 1);
+    vsnprintf(&to[end], len + 1, format, args);
+    to.resize(end + len);
+  }
+}
+
+static void output(size_t format, size_t index, va_list args) {
+  if (log_buffer)
+    append(*log_buffer, LOG_FORMATS[format][index], args);
+  else
+    vprintf(LOG_FORMATS[format][index], args);
+}
+
+// Print message index of the selected format, nothing if logging is disabled.
+static void emit(size_t index, ...) {
+  if (log_format == LOG_FORMAT_NONE || !log_frames)
+    return;
+  va_list args;
+  va_start(args, index);
+  output(log_format, index, args);
+  va_end(args);
+}
+
+// Print an event that quiet runs and reports are kept for, human-readable if logging is disabled.
+static void emit_event(size_t index, ...) {
+  va_list args;
+  va_start(args, index);
+  output(log_format == LOG_FORMAT_NONE ? LOG_FORMAT_HUMAN_READABLE : log_format, index, args);
+  va_end(args);
+}
+
+// Append message index of format to a list, separated in CSV.
+static void append_item(std::string &to, size_t format, size_t index, ...) {
+  if (format == LOG_FORMAT_CSV && !to.empty())
+    to += ',';
+  va_list args;
+  va_start(args, index);
+  append(to, LOG_FORMATS[format][index], args);
+  va_end(args);
+}
+
+// nullptr for the protocols without a name here
+static const char *protocol_name(uint32_t protocol) {
+  return protocol == IPPROTO_ICMP  ? "ICMP"
+         : protocol == IPPROTO_UDP ? "UDP"
+         : protocol == IPPROTO_TCP ? "TCP"
+                                   : nullptr;
+}
+
 static char *ether_ntoa_r_custom(const Ethernet::Address *addr, char *buf) {
   sprintf(buf, "%02x:%02x:%02x:%02x:%02x:%02x", addr->ether_addr_octet[0],
           addr->ether_addr_octet[1], addr->ether_addr_octet[2], addr->ether_addr_octet[3],
@@ -50,7 +135,7 @@ void log_ethernet_frame(const Ethernet::Address *src, const Ethernet::Address *d
   char dest_str[ETHERNET_ADDRSTRLEN];
   ether_ntoa_r_custom(src, src_str);
   ether_ntoa_r_custom(dest, dest_str);
-  printf(LOG_FORMATS[log_format][0], src_str, dest_str);
+  emit(0, src_str, dest_str);
 }
 
 void log_ip_packet(const IPv4::Address *src, const IPv4::Address *dest) {
@@ -58,7 +143,15 @@ void log_ip_packet(const IPv4::Address *src, const IPv4::Address *dest) {
   char dest_str[INET_ADDRSTRLEN];
   inet_ntop(AF_INET, src, src_str, INET_ADDRSTRLEN);
   inet_ntop(AF_INET, dest, dest_str, INET_ADDRSTRLEN);
-  printf(LOG_FORMATS[log_format][1], src_str, dest_str);
+  emit(1, src_str, dest_str);
+}
+
+void log_tcp_segment(uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack,
+                     uint8_t flags) {
+  const char *syn_rst = flags & 0x02 ? "SYN" : flags & 0x04 ? "RST" : "-";
+  const char *ack_str = flags & 0x10 ? "ACK" : "-";
+  const char *fin = flags & 0x01 ? "FIN" : "-";
+  emit(2, src_port, dst_port, seq, ack, syn_rst, ack_str, fin);
 }
 
 void log_arp_request(const Ethernet::Address *src_mac, const IPv4::Address *src_ip,
@@ -67,30 +160,133 @@ void log_arp_request(const Ethernet::Address *src_mac, const IPv4::Address *src_
   char dest_str[INET_ADDRSTRLEN];
   inet_ntop(AF_INET, src_ip, src_str, INET_ADDRSTRLEN);
   inet_ntop(AF_INET, dest_ip, dest_str, INET_ADDRSTRLEN);
-  printf(LOG_FORMATS[log_format][3], dest_str, src_str, ether_ntoa((ether_addr *)src_mac));
+  char mac_str[ETHERNET_ADDRSTRLEN];
+  emit(3, dest_str, src_str, ether_ntoa_r((const ether_addr *)src_mac, mac_str));
 }
 
 void log_arp_reply(const Ethernet::Address *src_mac, const IPv4::Address *src_ip,
                    const Ethernet::Address * /*dest_mac*/, const IPv4::Address * /*dest_ip*/) {
   char src_str[INET_ADDRSTRLEN];
   inet_ntop(AF_INET, src_ip, src_str, INET_ADDRSTRLEN);
-  printf(LOG_FORMATS[log_format][4], src_str, ether_ntoa((ether_addr *)src_mac));
+  char mac_str[ETHERNET_ADDRSTRLEN];
+  emit(4, src_str, ether_ntoa_r((const ether_addr *)src_mac, mac_str));
 }
 
-void log_icmp_ping() { puts(LOG_FORMATS[log_format][5]); }
+void log_icmp_ping() { emit(5); }
 
-void log_icmp_pong() { puts(LOG_FORMATS[log_format][6]); }
+void log_icmp_pong() { emit(6); }
 
-void log_http_response(const char *status_code) { printf(LOG_FORMATS[log_format][7], status_code); }
+void log_icmp_drop(const char *limit) { emit(13, limit); }
 
-void log_http_request(const char *request_method, const char *resource_path) {
-  printf(LOG_FORMATS[log_format][8], request_method, resource_path);
+void log_ping_report(bool summary, uint64_t sent, uint64_t received, uint64_t lost,
+                     uint64_t unresolved, uint64_t p50, uint64_t p99, uint64_t p999) {
+  double loss = received + lost ? 100.0 * lost / (received + lost) : 0;
+  // reports are what a quiet run is for, they are always printed
+  size_t format = log_format == LOG_FORMAT_NONE ? LOG_FORMAT_HUMAN_READABLE : log_format;
+  printf(LOG_FORMATS[format][14], summary ? "total" : "interval", (unsigned long)sent,
+         (unsigned long)received, (unsigned long)lost, loss, (unsigned long)unresolved,
+         p50 / 1e3, p99 / 1e3, p999 / 1e3);
 }
 
-void log_http_request_host(const char *host) { printf(LOG_FORMATS[log_format][9], host); }
+void log_flood_alert(const char *kind, const IPv4::Address *src, uint64_t estimate,
+                     uint32_t threshold, bool denied) {
+  char src_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, src, src_str, INET_ADDRSTRLEN);
+  emit_event(20, kind, src_str, (unsigned long)estimate, threshold, denied ? "denied" : "alert");
+}
 
-void log_http_request_cookie(const char *cookie) { printf(LOG_FORMATS[log_format][10], cookie); }
+void log_flow(const Flows::Flow &flow) {
+  const char *protocol = protocol_name(flow.key.protocol);
+  if (!protocol)
+    protocol = "IP";
+  char src_str[INET_ADDRSTRLEN];
+  char dest_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &flow.key.src_ip, src_str, INET_ADDRSTRLEN);
+  inet_ntop(AF_INET, &flow.key.dst_ip, dest_str, INET_ADDRSTRLEN);
+  // seconds with the microseconds of the capture timestamps
+  const Flows::Stats &stats = flow.stats;
+  size_t format = log_format == LOG_FORMAT_NONE ? LOG_FORMAT_HUMAN_READABLE : log_format;
+  printf(LOG_FORMATS[format][15], protocol, src_str, flow.key.src_port, dest_str,
+         flow.key.dst_port, (unsigned long)stats.packets, (unsigned long)stats.bytes,
+         (unsigned long)(stats.first_seen / 1000000000),
+         (unsigned long)(stats.first_seen % 1000000000 / 1000),
+         (unsigned long)(stats.last_seen / 1000000000),
+         (unsigned long)(stats.last_seen % 1000000000 / 1000));
+}
+
+void log_traffic_report(uint64_t start, uint64_t end, const Traffic::Summary &summary) {
+  size_t format = log_format == LOG_FORMAT_NONE ? LOG_FORMAT_HUMAN_READABLE : log_format;
+
+  // the EtherTypes in numerical order, then the rest
+  std::vector<Traffic::Summary::Type> types;
+  for (size_t i = 0; i < summary.type_count(); i++)
+    types.push_back(summary.type(i));
+  std::sort(types.begin(), types.end(),
+            [](const Traffic::Summary::Type &a, const Traffic::Summary::Type &b) {
+              return a.type < b.type;
+            });
+  std::string type_list;
+  for (const Traffic::Summary::Type &type : types) {
+    char name[8];
+    snprintf(name, sizeof(name), "0x%04x", type.type);
+    append_item(type_list, format, 17, name, (unsigned long)type.totals.frames,
+                (unsigned long)type.totals.bytes);
+  }
+  if (summary.other_types().frames)
+    append_item(type_list, format, 17, "other", (unsigned long)summary.other_types().frames,
+                (unsigned long)summary.other_types().bytes);
+
+  std::string protocol_list;
+  for (size_t protocol = 0; protocol < 256; protocol++) {
+    const Traffic::Totals &totals = summary.protocol(protocol);
+    if (!totals.frames)
+      continue;
+    char number[4];
+    snprintf(number, sizeof(number), "%zu", protocol);
+    const char *name = protocol_name(protocol);
+    append_item(protocol_list, format, 18, name ? name : number, (unsigned long)totals.frames,
+                (unsigned long)totals.bytes);
+  }
+
+  std::string talker_list;
+  for (const Traffic::SpaceSaving::Entry &talker : summary.talkers().top(REPORT_TALKERS)) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &talker.key, address, INET_ADDRSTRLEN);
+    append_item(talker_list, format, 19, address, (unsigned long)talker.count,
+                (unsigned long)talker.error);
+  }
+
+  const Histogram &payload = summary.payload_sizes();
+  printf(LOG_FORMATS[format][16], (unsigned long)(start / 1000000000),
+         (unsigned long)(start % 1000000000 / 1000), (unsigned long)(end / 1000000000),
+         (unsigned long)(end % 1000000000 / 1000), (unsigned long)summary.total().frames,
+         (unsigned long)summary.total().bytes, (unsigned long)summary.distinct_sources(),
+         (unsigned long)payload.percentile(50), (unsigned long)payload.percentile(90),
+         (unsigned long)payload.percentile(99), type_list.c_str(), protocol_list.c_str(),
+         talker_list.c_str());
+}
+
+void log_http_response(const HTTP::View &status_code) {
+  emit(7, (int)status_code.len, status_code.data);
+}
+
+void log_http_request(const HTTP::View &request_method, const HTTP::View &resource_path) {
+  emit(8, (int)request_method.len, request_method.data, (int)resource_path.len,
+       resource_path.data);
+}
+
+void log_http_request_host(const HTTP::View &host) {
+  emit(9, (int)host.len, host.data);
+}
+
+void log_http_request_cookie(const HTTP::View &cookie) {
+  emit(10, (int)cookie.len, cookie.data);
+}
+
+void log_http_request_auth(const HTTP::View &decoded_login_data) {
+  emit(11, (int)decoded_login_data.len, decoded_login_data.data);
+}
 
-void log_http_request_auth(const char *decoded_login_data) {
-  printf(LOG_FORMATS[log_format][11], decoded_login_data);
+void log_udp_datagram(uint16_t src_port, uint16_t dst_port, size_t length) {
+  emit(12, src_port, dst_port, length);
 }
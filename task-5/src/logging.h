@@ -1,12 +1,23 @@
 #pragma once
 #include "layer_link/ethernet.h" // Ethernet::Address
 #include "layer_internet/ipv4.h"     // IPv4::Address
+#include "http/http.h"               // HTTP::View
+#include "flows.h"                   // Flows::Flow
+#include "traffic.h"                 // Traffic::Summary
 
 #include <cstddef> // size_t
+#include <string>
 
 #define LOG_FORMAT_HUMAN_READABLE 0
 #define LOG_FORMAT_CSV 1
+#define LOG_FORMAT_NONE 2
 extern size_t log_format;
+// per-frame messages, off when traffic is reported per interval instead
+extern bool log_frames;
+
+// Append the messages of the calling thread to buffer instead of printing them, nullptr to print
+// them again.
+void log_capture(std::string *buffer);
 
 // Ethernet
 void log_ethernet_frame(const Ethernet::Address *src, const Ethernet::Address *dst);
@@ -14,6 +25,10 @@ void log_ethernet_frame(const Ethernet::Address *src, const Ethernet::Address *d
 // IP
 void log_ip_packet(const IPv4::Address *src, const IPv4::Address *dst);
 
+// TCP
+void log_tcp_segment(uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack,
+                     uint8_t flags);
+
 // ARP
 void log_arp_request(const Ethernet::Address *src_mac, const IPv4::Address *src_ip,
                      const Ethernet::Address *dst_mac, const IPv4::Address *dst_ip);
@@ -22,10 +37,27 @@ void log_arp_reply(const Ethernet::Address *src_mac, const IPv4::Address *src_ip
 // ICMP
 void log_icmp_ping();
 void log_icmp_pong();
+void log_icmp_drop(const char *limit);
+// round trip times in nanoseconds, summary is set for the totals at exit
+void log_ping_report(bool summary, uint64_t sent, uint64_t received, uint64_t lost,
+                     uint64_t unresolved, uint64_t p50, uint64_t p99, uint64_t p999);
+
+// Sources above a request rate, kind is ARP or ICMP. Like the ping reports always printed.
+void log_flood_alert(const char *kind, const IPv4::Address *src, uint64_t estimate,
+                     uint32_t threshold, bool denied);
+
+// Flows, like the ping reports always printed
+void log_flow(const Flows::Flow &flow);
+
+// Traffic of the capture times from start to end, also always printed
+void log_traffic_report(uint64_t start, uint64_t end, const Traffic::Summary &summary);
+
+// UDP
+void log_udp_datagram(uint16_t src_port, uint16_t dst_port, size_t length);
 
-// HTTP
-void log_http_response(const char *status_code);
-void log_http_request(const char *request_method, const char *resource_path);
-void log_http_request_host(const char *host);
-void log_http_request_cookie(const char *cookie);
-void log_http_request_auth(const char *decoded_login_data);
+// HTTP (the views point into the packet and are not NUL-terminated)
+void log_http_response(const HTTP::View &status_code);
+void log_http_request(const HTTP::View &request_method, const HTTP::View &resource_path);
+void log_http_request_host(const HTTP::View &host);
+void log_http_request_cookie(const HTTP::View &cookie);
+void log_http_request_auth(const HTTP::View &decoded_login_data);
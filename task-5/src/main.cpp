@@ -1,16 +1,31 @@
-#include "layer_link/ethernet.h"
-#include "layer_internet/arp.h"
-#include "layer_internet/ipv4.h"
+#include "layer_internet/route.h"
+#include "icmp/ping.h"
+#include "pipeline/pipeline.h"
+#include "pipeline/replay.h"
+#include "pipeline/shards.h"
+#include "stack.h"
+#include "clock.h"
+#include "counters.h"
 #include "logging.h"
+#include "metrics.h"
+#include "trace.h"
 
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <arpa/inet.h>     // inet_aton
+#include <linux/if_packet.h> // PACKET_FANOUT
 #include <netinet/ether.h> // ether_aton_r
 #include <pcap/pcap.h>
+#include <poll.h>
+#include <sys/socket.h>    // setsockopt
+#include <unistd.h>        // getpid
 
 // Use unique_ptr as RAII wrapper for pcap types.
 // https://dev.krzaq.cc/post/you-dont-need-a-stateful-deleter-in-your-unique_ptr-usually/
@@ -24,6 +39,9 @@ using pcap_file_ptr = std::unique_ptr<pcap_t, function_caller<void(pcap_t *), &p
 using pcap_dumper_ptr =
     std::unique_ptr<pcap_dumper_t, function_caller<void(pcap_dumper_t *), &pcap_dump_close>>;
 
+// Number of frames handled before the services get to run.
+#define RX_BURST 32
+
 pcap_dumper_ptr pcap_outfile_dump;
 pcap_file_ptr pcap_device;
 
@@ -43,17 +61,246 @@ void send_bytes(char *buf, size_t bufsiz) {
   }
 }
 
+// Pipeline mode: the RX thread reads from pcap, the TX thread writes with send_bytes.
+class PcapSource : public Pipeline::Source {
+public:
+  PcapSource(pcap_t *handle, bool offline) : handle(handle), offline(offline) {}
+
+  int receive(Pipeline::Runner &runner, size_t max) override {
+    Trace::poll();
+    int received = pcap_dispatch(handle, max, dispatch, (u_char *)&runner);
+    if (received == PCAP_ERROR)
+      fprintf(stderr, "pcap_dispatch() failed: %s\n", pcap_geterr(handle));
+    if (received < 0 || (received == 0 && offline))
+      return -1;
+    return received;
+  }
+
+private:
+  pcap_t *handle;
+  bool offline;
+
+  static void dispatch(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
+    auto runner = reinterpret_cast<Pipeline::Runner *>(user);
+    runner->dispatch(bytes, h->caplen, h->ts.tv_sec * Clock::NS_PER_SEC + h->ts.tv_usec * 1000);
+  }
+};
+
+class PcapSink : public Pipeline::Sink {
+public:
+  void transmit(const uint8_t *frame, size_t len) override { send_bytes((char *)frame, len); }
+};
+
+// Sharded mode: each shard reads from pcap handles of its own. Offline, every shard reads the
+// whole file and keeps its share. Live, the shards form a fanout group so that the kernel steers
+// each flow to one of them, and every shard captures all ARP frames on a second handle.
+class PcapPort : public Pipeline::Port {
+public:
+  PcapPort(pcap_file_ptr handle, pcap_file_ptr arp_handle)
+      : handle(std::move(handle)), arp_handle(std::move(arp_handle)) {}
+
+  int receive(Pipeline::Shards &shards, size_t max) override {
+    if (!arp_handle)
+      return dispatch(handle.get(), shards, max, false, true);
+
+    int received = dispatch(handle.get(), shards, max, true, false);
+    int arp_received = dispatch(arp_handle.get(), shards, max, false, false);
+    if (received < 0 || arp_received < 0)
+      return -1;
+    if (received + arp_received == 0) {
+      pollfd fds[2] = {{pcap_get_selectable_fd(handle.get()), POLLIN, 0},
+                       {pcap_get_selectable_fd(arp_handle.get()), POLLIN, 0}};
+      poll(fds, 2, 100);
+    }
+    return received + arp_received;
+  }
+
+  void transmit(const uint8_t *frame, size_t len) override {
+    if (arp_handle && !pcap_outfile_dump) {
+      if (pcap_inject(handle.get(), frame, len) == -1)
+        fprintf(stderr, "Could not send packet on this interface: %s\n",
+                pcap_geterr(handle.get()));
+      return;
+    }
+    std::lock_guard<std::mutex> lock(output_mutex);
+    send_bytes((char *)frame, len);
+  }
+
+private:
+  struct Context {
+    Pipeline::Shards *shards;
+    bool steered;
+  };
+
+  pcap_file_ptr handle;
+  pcap_file_ptr arp_handle; // live capture only
+  static std::mutex output_mutex;
+
+  static int dispatch(pcap_t *p, Pipeline::Shards &shards, size_t max, bool steered,
+                      bool offline) {
+    Context context = {&shards, steered};
+    int received = pcap_dispatch(p, max, callback, (u_char *)&context);
+    if (received == PCAP_ERROR)
+      fprintf(stderr, "pcap_dispatch() failed: %s\n", pcap_geterr(p));
+    if (received < 0 || (received == 0 && offline))
+      return -1;
+    return received;
+  }
+
+  static void callback(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
+    auto context = reinterpret_cast<Context *>(user);
+    context->shards->dispatch(bytes, h->caplen,
+                              h->ts.tv_sec * Clock::NS_PER_SEC + h->ts.tv_usec * 1000,
+                              context->steered);
+  }
+};
+
+std::mutex PcapPort::output_mutex;
+
+// Filter expression of the frames the stack acts on: ARP and IPv4 to one of addresses. Without
+// addresses the stack only logs, so all frames pass. Without arp the expression is for a handle
+// next to one capturing ARP.
+static std::string capture_filter(const std::vector<IPv4::Address> &addresses, bool arp) {
+  if (addresses.empty())
+    return arp ? "" : "not arp";
+  std::string filter = arp ? "arp" : "";
+  for (const IPv4::Address &address : addresses) {
+    char text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address, text, sizeof(text));
+    filter += (filter.empty() ? "ip dst host " : " or ip dst host ") + std::string(text);
+  }
+  return filter;
+}
+
+// Compile filter into classic BPF and attach it, on a live capture the kernel runs it on the
+// socket and only the frames passing are copied up. An empty filter is not attached.
+static bool set_filter(pcap_t *handle, const std::string &filter, char *errbuf) {
+  if (filter.empty())
+    return true;
+  bpf_program program;
+  if (pcap_compile(handle, &program, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) == PCAP_ERROR) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filter.c_str(), pcap_geterr(handle));
+    return false;
+  }
+  int result = pcap_setfilter(handle, &program);
+  pcap_freecode(&program);
+  if (result == PCAP_ERROR) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filter.c_str(), pcap_geterr(handle));
+    return false;
+  }
+  return true;
+}
+
+// Open a capture of dev restricted by filter, non-blocking.
+static pcap_file_ptr open_live(const char *dev, const std::string &filter, char *errbuf) {
+  pcap_file_ptr handle{pcap_open_live(dev, BUFSIZ, 1, 1000, errbuf)};
+  if (!handle)
+    return nullptr;
+  if (!set_filter(handle.get(), filter, errbuf))
+    return nullptr;
+
+  if (pcap_setnonblock(handle.get(), 1, errbuf) == PCAP_ERROR)
+    return nullptr;
+  return handle;
+}
+
+static std::unique_ptr<Pipeline::Port> open_port(const char *infile, const char *dev,
+                                                 const std::vector<IPv4::Address> &addresses,
+                                                 size_t shards, char *errbuf) {
+  if (infile) {
+    pcap_file_ptr handle{pcap_open_offline(infile, errbuf)};
+    if (!handle)
+      return nullptr;
+    return std::make_unique<PcapPort>(std::move(handle), nullptr);
+  }
+
+  pcap_file_ptr handle = open_live(dev, capture_filter(addresses, false), errbuf);
+  if (!handle)
+    return nullptr;
+  // the kernel steers a flow to the socket that joined as the shard owning it, the same one
+  // flow_owner picks for the ARP exchange of its hosts
+  int fanout = (getpid() & 0xffff) | (PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_DEFRAG) << 16;
+  if (setsockopt(pcap_fileno(handle.get()), SOL_PACKET, PACKET_FANOUT, &fanout,
+                 sizeof(fanout)) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "joining the fanout group failed: %s", strerror(errno));
+    return nullptr;
+  }
+  std::vector<sock_filter> steering = Pipeline::flow_owner_program(shards);
+  sock_fprog program = {(unsigned short)steering.size(), steering.data()};
+  if (setsockopt(pcap_fileno(handle.get()), SOL_PACKET, PACKET_FANOUT_DATA, &program,
+                 sizeof(program)) == -1) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "setting the fanout program failed: %s", strerror(errno));
+    return nullptr;
+  }
+
+  pcap_file_ptr arp_handle = open_live(dev, "arp", errbuf);
+  if (!arp_handle)
+    return nullptr;
+  return std::make_unique<PcapPort>(std::move(handle), std::move(arp_handle));
+}
+
+// Parallel replay: records are read sequentially, the merged output goes to stdout and send_bytes.
+class PcapReader : public Pipeline::Replay::Reader {
+public:
+  PcapReader(pcap_t *handle) : handle(handle) {}
+
+  void read(Pipeline::Replay::Chunk &chunk, size_t max) override {
+    pcap_pkthdr *h;
+    const u_char *bytes;
+    int result = 0;
+    while (chunk.records.size() < max && (result = pcap_next_ex(handle, &h, &bytes)) == 1) {
+      chunk.records.push_back({chunk.data.size(), h->caplen,
+                               h->ts.tv_sec * Clock::NS_PER_SEC + h->ts.tv_usec * 1000});
+      chunk.data.insert(chunk.data.end(), bytes, bytes + h->caplen);
+    }
+    if (result == PCAP_ERROR)
+      fprintf(stderr, "pcap_next_ex() failed: %s\n", pcap_geterr(handle));
+  }
+
+private:
+  pcap_t *handle;
+};
+
+class PcapWriter : public Pipeline::Replay::Writer {
+public:
+  void log(const char *text, size_t len) override { fwrite(text, 1, len, stdout); }
+  void transmit(const uint8_t *frame, size_t len) override { send_bytes((char *)frame, len); }
+};
+
+// Parse a comma separated list of CPU numbers.
+static bool parse_cpus(const char *list, std::vector<int> &cpus) {
+  for (const char *p = list; *p;) {
+    char *end;
+    long cpu = strtol(p, &end, 10);
+    if (end == p || cpu < -1 || (*end && *end != ','))
+      return false;
+    cpus.push_back(cpu);
+    p = *end ? end + 1 : end;
+  }
+  return true;
+}
+
 int main(int argc, char **argv) {
   char errbuf[PCAP_ERRBUF_SIZE];
-  Ethernet::Address mac_addr;
-  IPv4::Address ip_addr;
-  ether_aton_r("00:00:00:00:00:00", (ether_addr *)&mac_addr);
-  inet_aton("127.0.0.1", (in_addr *)&ip_addr);
+  StackConfig config;
+  ether_aton_r("00:00:00:00:00:00", (ether_addr *)&config.mac);
+  inet_aton("127.0.0.1", (in_addr *)&config.ip);
 
   char *infile = nullptr;
   char *outfile = nullptr;
   char *dev = nullptr;
-  bool respond = false;
+  Route::Builder routes;
+  const char *syncookie_secret = nullptr;
+  ICMP::PingClient::Options ping_options;
+  int ping_identifier = -1; // of the process by default
+  Pipeline::Config pipeline;
+  bool pipelined = false;
+  size_t shard_count = 0;
+  size_t jobs = 0;
+  const char *metrics_endpoint = nullptr;
+  bool prefilter = true;
+  uint64_t flow_report_interval = 0; // only at exit
+  bool flow_options = false;
 
   // parse arguments
   for (int i = 1; i < argc; i++) {
@@ -68,13 +315,148 @@ int main(int argc, char **argv) {
       dev = argv[i + 1];
       i++;
     } else if (strcmp("--respond", argv[i]) == 0 && remaining > 2) {
-      ether_aton_r(argv[i + 1], (ether_addr *)&mac_addr);
-      inet_aton(argv[i + 2], (in_addr *)&ip_addr);
+      ether_aton_r(argv[i + 1], (ether_addr *)&config.mac);
+      inet_aton(argv[i + 2], (in_addr *)&config.ip);
 
-      respond = true;
+      config.respond = true;
+      i += 2;
+    } else if (strcmp("--route", argv[i]) == 0 && remaining > 2) {
+      if (!routes.add(argv[i + 1], argv[i + 2])) {
+        fprintf(stderr, "Invalid route: %s via %s\n", argv[i + 1], argv[i + 2]);
+        exit(-1);
+      }
       i += 2;
+    } else if (strcmp("--routes", argv[i]) == 0 && remaining > 1) {
+      if (!routes.load(argv[i + 1])) {
+        fprintf(stderr, "Could not load routes from file: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      i++;
+    } else if (strcmp("--udp-echo", argv[i]) == 0 && remaining > 1) {
+      config.udp_echo_port = atoi(argv[i + 1]);
+      i++;
+    } else if (strcmp("--tcp-listen", argv[i]) == 0 && remaining > 1) {
+      config.tcp_ports.push_back(atoi(argv[i + 1]));
+      i++;
+    } else if (strcmp("--tcp-timeout", argv[i]) == 0 && remaining > 1) {
+      config.tcp_idle_timeout = strtoull(argv[i + 1], nullptr, 10) * Clock::NS_PER_SEC;
+      if (!config.tcp_idle_timeout) {
+        fprintf(stderr, "Invalid TCP idle timeout: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      i++;
+    } else if (strcmp("--http-inspect", argv[i]) == 0 && remaining > 1) {
+      config.http_ports.push_back(atoi(argv[i + 1]));
+      i++;
+    } else if (strcmp("--icmp-rate", argv[i]) == 0 && remaining > 2) {
+      config.icmp_source_rate = strtoul(argv[i + 1], nullptr, 10);
+      config.icmp_global_rate = strtoul(argv[i + 2], nullptr, 10);
+      config.icmp_rate_limit = true;
+      i += 2;
+    } else if (strcmp("--flood-detect", argv[i]) == 0 && remaining > 3) {
+      config.flood_window = strtoull(argv[i + 1], nullptr, 10) * Clock::NS_PER_SEC;
+      if (!config.flood_window) {
+        fprintf(stderr, "Invalid flood detection window: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      config.flood_thresholds[Flood::Detector::ARP_REQUEST] = strtoul(argv[i + 2], nullptr, 10);
+      config.flood_thresholds[Flood::Detector::ECHO_REQUEST] = strtoul(argv[i + 3], nullptr, 10);
+      i += 3;
+    } else if (strcmp("--flood-deny", argv[i]) == 0 && remaining > 1) {
+      config.flood_deny = strtoull(argv[i + 1], nullptr, 10) * Clock::NS_PER_SEC;
+      i++;
+    } else if (strcmp("--ping", argv[i]) == 0 && remaining > 1) {
+      IPv4::Address target;
+      if (!inet_aton(argv[i + 1], (in_addr *)&target)) {
+        fprintf(stderr, "Invalid ping target: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      ping_options.targets.push_back(target);
+      i++;
+    } else if (strcmp("--ping-rate", argv[i]) == 0 && remaining > 1) {
+      ping_options.rate = strtoul(argv[i + 1], nullptr, 10);
+      i++;
+    } else if (strcmp("--ping-count", argv[i]) == 0 && remaining > 1) {
+      ping_options.count = strtoull(argv[i + 1], nullptr, 10);
+      i++;
+    } else if (strcmp("--ping-size", argv[i]) == 0 && remaining > 1) {
+      ping_options.payload_size = strtoul(argv[i + 1], nullptr, 10);
+      i++;
+    } else if (strcmp("--ping-id", argv[i]) == 0 && remaining > 1) {
+      ping_identifier = strtoul(argv[i + 1], nullptr, 0) & 0xffff;
+      i++;
+    } else if (strcmp("--syncookie-secret", argv[i]) == 0 && remaining > 1) {
+      syncookie_secret = argv[i + 1];
+      i++;
+    } else if (strcmp("--workers", argv[i]) == 0 && remaining > 1) {
+      pipeline.workers = strtoul(argv[i + 1], nullptr, 10);
+      if (!pipeline.workers) {
+        fprintf(stderr, "Invalid number of workers: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      pipelined = true;
+      i++;
+    } else if (strcmp("--shards", argv[i]) == 0 && remaining > 1) {
+      shard_count = strtoul(argv[i + 1], nullptr, 10);
+      if (!shard_count) {
+        fprintf(stderr, "Invalid number of shards: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      i++;
+    } else if (strcmp("--jobs", argv[i]) == 0 && remaining > 1) {
+      jobs = strtoul(argv[i + 1], nullptr, 10);
+      if (!jobs) {
+        fprintf(stderr, "Invalid number of jobs: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      i++;
+    } else if (strcmp("--cpus", argv[i]) == 0 && remaining > 1) {
+      if (!parse_cpus(argv[i + 1], pipeline.cpus)) {
+        fprintf(stderr, "Invalid CPU list: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      i++;
+    } else if (strcmp("--metrics", argv[i]) == 0 && remaining > 1) {
+      metrics_endpoint = argv[i + 1];
+      i++;
+    } else if (strcmp("--mac-filter", argv[i]) == 0) {
+      config.mac_filter = true;
+    } else if (strcmp("--mcast", argv[i]) == 0 && remaining > 1) {
+      Ethernet::Address group;
+      if (!ether_aton_r(argv[i + 1], (ether_addr *)&group) || !(group.ether_addr_octet[0] & 1)) {
+        fprintf(stderr, "Invalid multicast address: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      config.multicast.push_back(group);
+      i++;
+    } else if (strcmp("--promisc-log", argv[i]) == 0) {
+      config.log_dropped = true;
+    } else if (strcmp("--flows", argv[i]) == 0 && remaining > 1) {
+      config.max_flows = strtoul(argv[i + 1], nullptr, 10);
+      if (!config.max_flows) {
+        fprintf(stderr, "Invalid number of flows: %s\n", argv[i + 1]);
+        exit(-1);
+      }
+      i++;
+    } else if (strcmp("--flow-timeout", argv[i]) == 0 && remaining > 1) {
+      config.flow_timeout = strtoull(argv[i + 1], nullptr, 10) * Clock::NS_PER_SEC;
+      flow_options = true;
+      i++;
+    } else if (strcmp("--flow-report", argv[i]) == 0 && remaining > 1) {
+      flow_report_interval = strtoull(argv[i + 1], nullptr, 10) * Clock::NS_PER_SEC;
+      flow_options = true;
+      i++;
+    } else if (strcmp("--report", argv[i]) == 0 && remaining > 1) {
+      config.report_interval = strtoull(argv[i + 1], nullptr, 10) * Clock::NS_PER_SEC;
+      config.traffic_report = true;
+      log_frames = false;
+      i++;
+    } else if (strcmp("--no-prefilter", argv[i]) == 0) {
+      prefilter = false;
     } else if (strcmp("--csv", argv[i]) == 0) {
       log_format = LOG_FORMAT_CSV;
+    } else if (strcmp("--quiet", argv[i]) == 0) {
+      log_format = LOG_FORMAT_NONE;
     } else {
       fprintf(stderr, "Unknown or incomplete parameter: %s\n", argv[i]);
       exit(-1);
@@ -84,10 +466,64 @@ int main(int argc, char **argv) {
   if (!infile && !dev) {
     fprintf(stderr,
             "Usage: %s [-d <network device>] [-i <input file>] [--respond <mac "
-            "address> <ip address>] [-o <output file>] [--csv]\n",
+            "address> <ip address>] [-o <output file>] [--route <prefix>/<length> "
+            "<gateway>] [--routes <route file>] [--udp-echo <port>] [--tcp-listen <port>] "
+            "[--tcp-timeout <seconds>] [--http-inspect <port>] [--syncookie-secret <32 hex digits>] [--icmp-rate "
+            "<per source> <global>] [--flood-detect <window seconds> <ARP requests> <echo "
+            "requests>] [--flood-deny <seconds>] [--ping <ip address>] [--ping-rate <per "
+            "second>] [--ping-count <count>] [--ping-size <payload bytes>] [--ping-id "
+            "<identifier>] [--workers <count>] "
+            "[--shards <count>] [--jobs <count>] [--cpus <list>] [--metrics <port|socket "
+            "path>] [--mac-filter] [--mcast <mac address>] [--promisc-log] [--no-prefilter] "
+            "[--flows <max flows>] [--flow-timeout <seconds>] [--flow-report <seconds>] [--report "
+            "<seconds>] [--csv] [--quiet]\n",
             argv[0]);
     exit(-1);
   }
+  if ((!config.multicast.empty() || config.log_dropped) && !config.mac_filter) {
+    fprintf(stderr, "--mcast and --promisc-log require --mac-filter\n");
+    exit(-1);
+  }
+  if (config.flood_deny && !config.flood_window) {
+    fprintf(stderr, "--flood-deny requires --flood-detect\n");
+    exit(-1);
+  }
+  if (flow_options && !config.max_flows) {
+    fprintf(stderr, "--flow-timeout and --flow-report require --flows\n");
+    exit(-1);
+  }
+  if (flow_report_interval && (pipelined || shard_count || jobs > 1)) {
+    fprintf(stderr, "Periodic flow reports are not supported with --workers, --shards or --jobs, "
+                    "the flows are reported at exit\n");
+    flow_report_interval = 0;
+  }
+  if (config.report_interval && (pipelined || shard_count || jobs > 1)) {
+    fprintf(stderr, "Periodic traffic reports are not supported with --workers, --shards or "
+                    "--jobs, the traffic is reported at exit\n");
+    config.report_interval = 0;
+  }
+  if (!ping_options.targets.empty() && !config.respond) {
+    fprintf(stderr, "Sending pings requires --respond\n");
+    exit(-1);
+  }
+  if (!ping_options.targets.empty() && (pipelined || shard_count)) {
+    fprintf(stderr, "Sending pings is not supported with --workers or --shards\n");
+    exit(-1);
+  }
+  if ((pipelined && shard_count) || (jobs && (pipelined || shard_count))) {
+    fprintf(stderr, "Only one of --workers, --shards and --jobs can be used\n");
+    exit(-1);
+  }
+  if (jobs && !infile) {
+    fprintf(stderr, "--jobs replays an input file (-i)\n");
+    exit(-1);
+  }
+  // state shared by all flows has to see every packet in order
+  if (jobs > 1 && (config.icmp_rate_limit || !ping_options.targets.empty())) {
+    fprintf(stderr, "Replaying sequentially: the global ICMP rate limit and the ping client "
+                    "cannot be split\n");
+    jobs = 0;
+  }
 
   pcap_file_ptr pcap_infile;
   if (infile) {
@@ -112,33 +548,251 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (dev) {
+  // the traffic report describes all frames on the wire and --promisc-log the foreign ones, not
+  // only those the stack acts on
+  if (config.traffic_report || config.log_dropped)
+    prefilter = false;
+
+  // the addresses the kernel lets through in live mode, the stack has no others to act on
+  std::vector<IPv4::Address> addresses;
+  if (config.respond && prefilter)
+    addresses.push_back(config.ip);
+
+  // shards capture on handles of their own
+  if (dev && !(shard_count && !infile)) {
     pcap_device = pcap_file_ptr{pcap_open_live(dev, BUFSIZ, 1, 1000, errbuf)};
     if (!pcap_device.get()) {
       fprintf(stderr, "Could not open device %s: %s\n", dev, errbuf);
       exit(-1);
     }
+    if (!infile && !set_filter(pcap_device.get(), capture_filter(addresses, true), errbuf)) {
+      fprintf(stderr, "Could not set the capture filter of %s: %s\n", dev, errbuf);
+      exit(-1);
+    }
   }
 
   // Initialize the network stack
-  auto ipv4 = std::make_unique<IPv4::Protocol>(ip_addr);
-  auto arp = std::make_unique<ARP::Protocol>();
-  auto ethernet =
-      std::make_unique<Ethernet::Protocol>(mac_addr, ipv4, arp, respond ? send_bytes : nullptr);
-
-  arp->set_ethernet_handler(ethernet);
-  arp->set_ipv4_handler(ipv4);
-  ipv4->set_ethernet_handler(ethernet);
-
-  auto handle_bytes = [](u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
-    auto layer2 = reinterpret_cast<Ethernet::Protocol *>(user);
-    layer2->handle_packet(bytes, h->len);
-  };
+  Route::Router router;
+  auto routing_table = routes.build();
+  if (!routing_table) {
+    fprintf(stderr, "Too many prefixes longer than /24 in routing table\n");
+    exit(-1);
+  }
+  router.swap(std::move(routing_table));
+  config.router = &router;
+
+  // workers and shards answer echo requests from one global bucket
+  ICMP::GlobalBucket icmp_global_bucket(config.icmp_global_rate);
+  if (config.icmp_rate_limit && config.icmp_global_rate)
+    config.icmp_global_bucket = &icmp_global_bucket;
+
+  if (syncookie_secret) {
+    for (size_t i = 0; i < sizeof(config.syncookie_secret); i++) {
+      if (sscanf(syncookie_secret + 2 * i, "%2hhx", &config.syncookie_secret[i]) != 1) {
+        fprintf(stderr, "Invalid SYN cookie secret: %s\n", syncookie_secret);
+        exit(-1);
+      }
+    }
+    config.has_syncookie_secret = true;
+  }
+
+  // one stack per worker, shard or replay job in the multi-threaded modes
+  size_t stack_count = 1;
+  Ethernet::Protocol::send_callback stack_send = send_bytes;
+  if (pipelined) {
+    stack_count = pipeline.workers;
+    stack_send = Pipeline::Runner::send_bytes;
+  } else if (shard_count) {
+    stack_count = shard_count;
+    stack_send = Pipeline::Shards::send_bytes;
+  } else if (jobs > 1) {
+    stack_count = jobs;
+    stack_send = Pipeline::Replay::send_bytes;
+  }
+  std::vector<std::unique_ptr<Stack>> stacks;
+  for (size_t i = 0; i < stack_count; i++) {
+    stacks.push_back(Stack::create(config, stack_send));
+    if (!stacks.back()) {
+      fprintf(stderr, "Could not bind UDP port %d\n", config.udp_echo_port);
+      exit(-1);
+    }
+  }
+  std::vector<Stack *> instances;
+  for (auto &stack : stacks)
+    instances.push_back(stack.get());
+
+  // publish the counters of every instance for pinger-stat
+  auto counters = Counters::Segment::create(instances.size());
+  if (counters) {
+    for (size_t i = 0; i < instances.size(); i++)
+      instances[i]->set_counters(counters->block(i));
+  } else {
+    fprintf(stderr, "Could not create /dev/shm/pinger.%d, counters are not published\n",
+            (int)getpid());
+  }
+
+  Trace::init();
 
-  // call handle_bytes for all frames from the input source
   pcap_t *pcap_input_handle = infile ? pcap_infile.get() : pcap_device.get();
-  if (pcap_loop(pcap_input_handle, 0, handle_bytes, (u_char *)ethernet.get()) < 0) {
-    fprintf(stderr, "pcap_loop() failed: %s\n", pcap_geterr(pcap_input_handle));
+
+  std::unique_ptr<Pipeline::Runner> runner; // owns the stacks in pipeline mode
+  std::unique_ptr<Pipeline::Shards> shards; // and in sharded mode
+  std::unique_ptr<Pipeline::Replay> replay; // and in parallel replay
+
+  // serve the same blocks to Prometheus, declared after the owners of the stacks so that it stops
+  // first
+  std::unique_ptr<MetricsServer> metrics;
+  if (metrics_endpoint) {
+    std::vector<const Counters::Block *> blocks;
+    for (Stack *instance : instances)
+      blocks.push_back(&instance->counter_block());
+    metrics = std::make_unique<MetricsServer>(std::move(blocks));
+    std::string error;
+    if (!metrics->start(metrics_endpoint, error)) {
+      fprintf(stderr, "Could not serve metrics on %s: %s\n", metrics_endpoint, error.c_str());
+      exit(-1);
+    }
+  }
+
+  if (jobs > 1) {
+    replay = std::make_unique<Pipeline::Replay>(RX_BURST, std::move(stacks));
+    PcapReader reader(pcap_input_handle);
+    PcapWriter writer;
+    replay->run(reader, writer);
+  } else if (shard_count) {
+    std::vector<std::unique_ptr<Pipeline::Port>> ports;
+    for (size_t i = 0; i < shard_count; i++) {
+      ports.push_back(open_port(infile, dev, addresses, shard_count, errbuf));
+      if (!ports.back()) {
+        fprintf(stderr, "Could not open input of shard %zu: %s\n", i, errbuf);
+        exit(-1);
+      }
+    }
+    shards = std::make_unique<Pipeline::Shards>(pipeline.cpus, std::move(stacks));
+    shards->run(std::move(ports));
+
+    for (size_t i = 0; i < shards->size(); i++) {
+      const Pipeline::Shards::Stats &stats = shards->stats(i);
+      fprintf(stderr,
+              "Shard %zu: %lu frames handled, %lu ARP frames observed, %lu skipped, %lu "
+              "transmitted\n",
+              i, (unsigned long)stats.handled, (unsigned long)stats.observed,
+              (unsigned long)stats.skipped, (unsigned long)stats.transmitted);
+    }
+  } else if (pipelined) {
+    pipeline.lossless = infile != nullptr;
+    runner = std::make_unique<Pipeline::Runner>(pipeline, std::move(stacks));
+    PcapSource source(pcap_input_handle, infile != nullptr);
+    PcapSink sink;
+    runner->run(source, sink);
+
+    Pipeline::Runner::Stats stats = runner->stats();
+    fprintf(stderr,
+            "Pipeline: %lu frames received, %lu dropped (ring full), %lu rejected, %lu "
+            "transmitted\n",
+            (unsigned long)stats.received, (unsigned long)stats.dropped,
+            (unsigned long)stats.rejected, (unsigned long)stats.transmitted);
+  } else {
+    Stack *stack = instances[0];
+    ICMP::Protocol *icmp = stack->ipv4()->icmp();
+
+    std::unique_ptr<ICMP::PingClient> ping;
+    if (!ping_options.targets.empty()) {
+      ping = std::make_unique<ICMP::PingClient>(
+          icmp, ping_options, ping_identifier >= 0 ? ping_identifier : getpid() & 0xffff);
+      icmp->set_ping_client(ping.get());
+    }
+
+    auto handle_bytes = [](u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
+      reinterpret_cast<Stack *>(user)->handle_frame(
+          bytes, h->len, h->ts.tv_sec * Clock::NS_PER_SEC + h->ts.tv_usec * 1000);
+    };
+
+    // the ping client has to keep sending while nothing is received
+    if (ping && dev && pcap_setnonblock(pcap_input_handle, 1, errbuf) == PCAP_ERROR) {
+      fprintf(stderr, "Could not switch device to non-blocking mode: %s\n", errbuf);
+      exit(-1);
+    }
+
+    // flows are reported by capture time, so that a replay reports like the live run
+    uint64_t next_flow_report = 0;
+
+    // A replay sends its pings at capture time, after every frame, so that the replies in the
+    // capture arrive after their requests and the round trip times do not depend on the machine.
+    int burst = ping && infile ? 1 : RX_BURST;
+
+    // call handle_bytes for bursts of frames from the input source and let the services answer
+    // everything that was queued during a burst
+    int received;
+    while ((received = pcap_dispatch(pcap_input_handle, burst, handle_bytes, (u_char *)stack)) >=
+           0) {
+      stack->poll();
+      Trace::poll();
+      // frames end the intervals of a replay, the clock those of an idle device
+      if (stack->traffic() && !infile)
+        stack->traffic()->tick(Clock::realtime());
+      if (flow_report_interval && Clock::packet_time) {
+        if (!next_flow_report) {
+          next_flow_report = Clock::packet_time + flow_report_interval;
+        } else if (Clock::packet_time >= next_flow_report) {
+          Flows::report({stack->flows()});
+          next_flow_report = Clock::packet_time + flow_report_interval;
+        }
+      }
+      if (ping && (!infile || received)) {
+        ping->poll(infile ? Clock::packet_time : Clock::realtime());
+        if (ping->done())
+          break;
+      }
+      if (received == 0 && infile)
+        break;
+    }
+    if (received == PCAP_ERROR) {
+      fprintf(stderr, "pcap_dispatch() failed: %s\n", pcap_geterr(pcap_input_handle));
+    }
+
+    if (ping)
+      ping->finish();
+  }
+  Trace::dump();
+
+  if (config.traffic_report) {
+    std::vector<const Traffic::Recorder *> recorders;
+    for (Stack *stack : instances)
+      recorders.push_back(stack->traffic());
+    Traffic::report(recorders);
+  }
+
+  if (config.max_flows) {
+    std::vector<const Flows::Table *> tables;
+    for (Stack *stack : instances)
+      tables.push_back(stack->flows());
+    Flows::report(tables);
+  }
+
+  if (config.flood_window) {
+    uint64_t alerts = 0, denied = 0;
+    for (Stack *stack : instances) {
+      alerts += stack->flood()->alerts();
+      denied += stack->flood()->denied();
+    }
+    fprintf(stderr, "Flood detection: %lu alerts, %lu requests refused\n", (unsigned long)alerts,
+            (unsigned long)denied);
+  }
+
+  if (config.icmp_rate_limit) {
+    uint64_t counts[ICMP::RateLimiter::VERDICTS] = {};
+    for (Stack *stack : instances) {
+      for (size_t verdict = 0; verdict < ICMP::RateLimiter::VERDICTS; verdict++)
+        counts[verdict] += stack->ipv4()->icmp()->rate_limiter()->count(
+            (ICMP::RateLimiter::Verdict)verdict);
+    }
+    fprintf(stderr,
+            "ICMP echo requests: %lu answered, %lu dropped by source limit, %lu dropped by "
+            "global limit\n",
+            (unsigned long)counts[ICMP::RateLimiter::PASS],
+            (unsigned long)counts[ICMP::RateLimiter::DROP_SOURCE],
+            (unsigned long)counts[ICMP::RateLimiter::DROP_GLOBAL]);
   }
   return 0;
 }
@@ -0,0 +1,184 @@
+#include "metrics.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+MetricsServer::MetricsServer(std::vector<const Counters::Block *> blocks)
+    : blocks(std::move(blocks)) {}
+
+MetricsServer::~MetricsServer() {
+  if (thread.joinable()) {
+    char stop = 0;
+    if (write(stop_pipe[1], &stop, 1) < 0)
+      perror("metrics");
+    thread.join();
+  }
+  if (listen_fd >= 0)
+    close(listen_fd);
+  for (int fd : stop_pipe) {
+    if (fd >= 0)
+      close(fd);
+  }
+  if (!unix_path.empty())
+    unlink(unix_path.c_str());
+}
+
+bool MetricsServer::start(const char *endpoint, std::string &error) {
+  char *end;
+  long port = strtol(endpoint, &end, 10);
+  bool tcp = *endpoint && !*end;
+
+  if (tcp) {
+    if (port <= 0 || port > 0xffff) {
+      error = "invalid port";
+      return false;
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (listen_fd >= 0)
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == -1) {
+      error = strerror(errno);
+      return false;
+    }
+  } else {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(endpoint) >= sizeof(addr.sun_path)) {
+      error = "socket path too long";
+      return false;
+    }
+    strcpy(addr.sun_path, endpoint);
+    unlink(endpoint); // left behind by an earlier run
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == -1) {
+      error = strerror(errno);
+      return false;
+    }
+    unix_path = endpoint;
+  }
+
+  if (listen(listen_fd, 8) == -1 || pipe2(stop_pipe, O_CLOEXEC) == -1) {
+    error = strerror(errno);
+    return false;
+  }
+  thread = std::thread(&MetricsServer::serve, this);
+  return true;
+}
+
+void MetricsServer::serve() {
+  for (;;) {
+    pollfd fds[2] = {{listen_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents)
+      return;
+
+    int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0)
+      continue;
+
+    // every request gets the metrics, wait a moment for it so that clients do not see a reset
+    char request[1024];
+    pollfd in = {client, POLLIN, 0};
+    if (poll(&in, 1, 1000) > 0 && read(client, request, sizeof(request)) >= 0) {
+      std::string body = render();
+      char header[160];
+      int len = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                         body.size());
+      std::string response = std::string(header, len) + body;
+      for (size_t sent = 0; sent < response.size();) {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+          break;
+        sent += n;
+      }
+    }
+    close(client);
+  }
+}
+
+// "ipv4.drop.not_ours" -> "pinger_ipv4_drop_not_ours" + suffix
+static std::string metric_name(const char *name, const char *suffix) {
+  std::string metric = "pinger_";
+  for (const char *c = name; *c; c++)
+    metric += *c == '.' ? '_' : *c;
+  return metric + suffix;
+}
+
+std::string MetricsServer::render() const {
+  std::string out;
+  char line[256];
+
+  for (size_t i = 0; i < Counters::COUNTERS + Counters::GAUGES; i++) {
+    bool counter = i < Counters::COUNTERS;
+    std::string name = metric_name(Counters::NAMES[i], counter ? "_total" : "");
+    out += "# TYPE " + name + (counter ? " counter\n" : " gauge\n");
+    for (size_t stack = 0; stack < blocks.size(); stack++) {
+      snprintf(line, sizeof(line), "%s{stack=\"%zu\"} %lu\n", name.c_str(), stack,
+               (unsigned long)Counters::load(*blocks[stack], i));
+      out += line;
+    }
+  }
+
+#ifdef PINGER_LATENCY_TRACE
+  // the trace buckets folded into fixed boundaries, in seconds since the frame was received
+  static const double BOUNDS_NS[] = {100,   250,   500,    1000,   2500,   5000,  10000,
+                                     25000, 50000, 100000, 250000, 500000, 1000000};
+  constexpr size_t BOUNDS = sizeof(BOUNDS_NS) / sizeof(BOUNDS_NS[0]);
+
+  out += "# TYPE pinger_layer_latency_seconds histogram\n";
+  for (size_t point = 0; point < Trace::POINTS; point++) {
+    uint64_t buckets[BOUNDS + 1] = {};
+    uint64_t count = 0;
+    double sum_ns = 0;
+    for (size_t i = 0; i < Histogram::SIZE; i++) {
+      uint64_t n = Trace::counts[point][i].load(std::memory_order_relaxed);
+      if (!n)
+        continue;
+      double ns = Trace::nanoseconds(Histogram::highest_value(i));
+      size_t bucket = 0;
+      while (bucket < BOUNDS && ns > BOUNDS_NS[bucket])
+        bucket++;
+      buckets[bucket] += n;
+      count += n;
+      sum_ns += ns * n;
+    }
+
+    const char *name = Trace::name((Trace::Point)point);
+    uint64_t cumulative = 0;
+    for (size_t bucket = 0; bucket < BOUNDS; bucket++) {
+      cumulative += buckets[bucket];
+      snprintf(line, sizeof(line), "pinger_layer_latency_seconds_bucket{point=\"%s\",le=\"%g\"} %lu\n",
+               name, BOUNDS_NS[bucket] / 1e9, (unsigned long)cumulative);
+      out += line;
+    }
+    snprintf(line, sizeof(line),
+             "pinger_layer_latency_seconds_bucket{point=\"%s\",le=\"+Inf\"} %lu\n"
+             "pinger_layer_latency_seconds_sum{point=\"%s\"} %.9f\n"
+             "pinger_layer_latency_seconds_count{point=\"%s\"} %lu\n",
+             name, (unsigned long)count, name, sum_ns / 1e9, name, (unsigned long)count);
+    out += line;
+  }
+#endif
+  return out;
+}
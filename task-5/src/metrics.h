@@ -0,0 +1,38 @@
+#pragma once
+#include "counters.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serves the counters and gauges of the stack instances, and the latency trace if it is compiled
+// in, in the Prometheus text exposition format over HTTP:
+//
+//   curl http://127.0.0.1:<port>/metrics
+//   curl --unix-socket <path> http://localhost/metrics
+//
+// The server runs on a thread of its own. It only loads from the counter blocks, which every
+// instance writes on its own cache lines, so the packet path never waits for it and never has a
+// line of its own written by it.
+class MetricsServer {
+public:
+  // blocks[i] is the block of stack instance i, they have to outlive the server.
+  explicit MetricsServer(std::vector<const Counters::Block *> blocks);
+  ~MetricsServer();
+
+  // Listen on 127.0.0.1:<port> if endpoint is a number, on a Unix socket at endpoint otherwise.
+  // Returns false with a message in error if the socket cannot be set up.
+  bool start(const char *endpoint, std::string &error);
+
+  // The exposition as sent to a client.
+  std::string render() const;
+
+private:
+  std::vector<const Counters::Block *> blocks;
+  int listen_fd = -1;
+  int stop_pipe[2] = {-1, -1};
+  std::string unix_path;
+  std::thread thread;
+
+  void serve();
+};
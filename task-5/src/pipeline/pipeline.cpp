@@ -0,0 +1,174 @@
+#include "pipeline.h"
+#include "../counters.h"
+
+#include <cstring>
+
+using namespace Pipeline;
+
+constexpr size_t Runner::BUFFER_SIZE;
+constexpr size_t Runner::BATCH;
+
+thread_local Runner::Worker *Runner::current_worker = nullptr;
+
+Runner::Worker::Worker(std::unique_ptr<Stack> stack, size_t ring_size)
+    : stack(std::move(stack)), rx_ring(ring_size), tx_ring(ring_size),
+      rx_buffers(new uint8_t[ring_size * BUFFER_SIZE]),
+      tx_buffers(new uint8_t[ring_size * BUFFER_SIZE]) {
+  for (size_t i = 0; i < ring_size; i++) {
+    rx_ring.slot(i).data = rx_buffers.get() + i * BUFFER_SIZE;
+    tx_ring.slot(i).data = tx_buffers.get() + i * BUFFER_SIZE;
+  }
+}
+
+Runner::Runner(const Config &config, std::vector<std::unique_ptr<Stack>> stacks) : config(config) {
+  for (auto &stack : stacks)
+    workers.push_back(std::make_unique<Worker>(std::move(stack), config.ring_size));
+}
+
+Runner::~Runner() = default;
+
+void Runner::send_bytes(char *buf, size_t bufsiz) {
+  Worker *worker = current_worker;
+  if (bufsiz > BUFFER_SIZE) {
+    worker->rejected++;
+    return;
+  }
+
+  // the TX thread never blocks on anything else, so waiting for it is bounded
+  Packet *slot;
+  while (!(slot = worker->tx_ring.reserve()))
+    std::this_thread::yield();
+  memcpy(slot->data, buf, bufsiz);
+  slot->len = bufsiz;
+  slot->timestamp = 0;
+  worker->tx_ring.commit();
+}
+
+size_t Runner::select_worker(const uint8_t *frame, size_t len) const {
+  if (workers.size() == 1)
+    return 0;
+
+  // the sender's IPv4 address, ARP included, so that the worker serving a peer also learns its
+  // hardware address
+  uint32_t address;
+  uint16_t ether_type = frame[12] << 8 | frame[13];
+  if (ether_type == Ethernet::TYPE_IP && len >= 14 + 20)
+    memcpy(&address, frame + 14 + 12, sizeof(address));
+  else if (ether_type == Ethernet::TYPE_ARP && len >= 14 + 28)
+    memcpy(&address, frame + 14 + 14, sizeof(address));
+  else
+    return 0;
+
+  uint32_t hash = address * 0x9e3779b1u;
+  return (uint64_t)hash * workers.size() >> 32;
+}
+
+void Runner::dispatch(const uint8_t *frame, size_t len, uint64_t timestamp) {
+  rx_stats.received++;
+  if (len > BUFFER_SIZE || len < sizeof(Ethernet::Header)) {
+    rx_stats.rejected++;
+    return;
+  }
+
+  Worker &worker = *workers[select_worker(frame, len)];
+  Packet *slot;
+  while (!(slot = worker.rx_ring.reserve())) {
+    if (!config.lossless) {
+      rx_stats.dropped++;
+      return;
+    }
+    std::this_thread::yield();
+  }
+
+  memcpy(slot->data, frame, len);
+  slot->len = len;
+  slot->timestamp = timestamp;
+  worker.rx_ring.commit();
+}
+
+void Runner::worker_loop(Worker &worker) {
+  current_worker = &worker;
+  for (;;) {
+    size_t handled = 0;
+    Packet *packet;
+    while (handled < BATCH && (packet = worker.rx_ring.peek())) {
+      worker.stack->handle_frame(packet->data, packet->len, packet->timestamp);
+      worker.rx_ring.release();
+      handled++;
+    }
+    worker.stack->poll();
+    Counters::set(Counters::RING_RX_USED, worker.rx_ring.size());
+    Counters::set(Counters::RING_TX_USED, worker.tx_ring.size());
+
+    if (!handled) {
+      if (rx_finished.load(std::memory_order_acquire) && worker.rx_ring.empty())
+        break;
+      std::this_thread::yield();
+    }
+  }
+  worker.finished.store(true, std::memory_order_release);
+}
+
+void Runner::tx_loop(Sink &sink) {
+  for (;;) {
+    bool idle = true;
+    bool finished = true;
+    for (auto &worker : workers) {
+      // read before draining, a finished worker adds nothing afterwards
+      bool worker_finished = worker->finished.load(std::memory_order_acquire);
+
+      Packet *packet;
+      for (size_t n = 0; n < BATCH && (packet = worker->tx_ring.peek()); n++) {
+        sink.transmit(packet->data, packet->len);
+        worker->tx_ring.release();
+        transmitted++;
+        idle = false;
+      }
+      if (!worker_finished || !worker->tx_ring.empty())
+        finished = false;
+    }
+
+    if (finished)
+      break;
+    if (idle)
+      std::this_thread::yield();
+  }
+}
+
+void Runner::pin(pthread_t thread, size_t index) {
+  if (index >= config.cpus.size() || config.cpus[index] < 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(config.cpus[index], &set);
+  pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+void Runner::run(Source &source, Sink &sink) {
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers.size(); i++) {
+    threads.emplace_back(&Runner::worker_loop, this, std::ref(*workers[i]));
+    pin(threads.back().native_handle(), 1 + i);
+  }
+  threads.emplace_back(&Runner::tx_loop, this, std::ref(sink));
+  pin(threads.back().native_handle(), 1 + workers.size());
+  pin(pthread_self(), 0);
+
+  int received;
+  while ((received = source.receive(*this, BATCH)) >= 0) {
+    if (!received)
+      std::this_thread::yield();
+  }
+  rx_finished.store(true, std::memory_order_release);
+
+  for (auto &thread : threads)
+    thread.join();
+}
+
+Runner::Stats Runner::stats() const {
+  Stats stats = rx_stats;
+  for (auto &worker : workers)
+    stats.rejected += worker->rejected;
+  stats.transmitted = transmitted;
+  return stats;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "../stack.h"
+#include "ring.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+namespace Pipeline {
+// A frame in a ring. data points into a buffer owned by the ring slot, so passing a frame between
+// threads never copies it.
+struct Packet {
+  uint8_t *data;
+  uint32_t len;
+  uint64_t timestamp;
+};
+
+struct Config {
+  size_t workers = 1;
+  size_t ring_size = 1024;     // slots per ring, a power of two
+  std::vector<int> cpus;       // RX, the workers and TX in that order, -1 or missing to not pin
+  bool lossless = false;       // wait for a full ring instead of dropping (offline input)
+};
+
+// Provides the frames of the RX thread.
+class Source {
+public:
+  virtual ~Source() = default;
+
+  // Pass up to max frames to Runner::dispatch. Returns the number of frames, 0 if there are none
+  // right now and -1 at the end of the input.
+  virtual int receive(class Runner &runner, size_t max) = 0;
+};
+
+// Transmits the frames drained by the TX thread.
+class Sink {
+public:
+  virtual ~Sink() = default;
+  virtual void transmit(const uint8_t *frame, size_t len) = 0;
+};
+
+// Runs the stack on separate threads:
+//
+//   RX --ring--> worker 0..N-1 --ring--> TX
+//
+// The RX thread copies every frame once into a slot of the ring of the worker its source address
+// hashes to, so all frames of a peer are handled by the same stack instance and stay in order.
+// Workers handle frames in place and copy replies into their TX ring, which the TX thread drains
+// round robin. All rings are single producer single consumer.
+class Runner {
+public:
+  static constexpr size_t BUFFER_SIZE = 2048;
+  static constexpr size_t BATCH = 32;
+
+  struct Stats {
+    uint64_t received = 0;
+    uint64_t dropped = 0;  // RX ring full
+    uint64_t rejected = 0; // frames that do not fit into a slot
+    uint64_t transmitted = 0;
+  };
+
+  // The stacks have to be created with send_bytes as their send callback.
+  Runner(const Config &config, std::vector<std::unique_ptr<Stack>> stacks);
+  ~Runner();
+
+  static void send_bytes(char *buf, size_t bufsiz);
+
+  // Run until the source ends, blocks the calling thread.
+  void run(Source &source, Sink &sink);
+
+  // Called from Source::receive on the RX thread.
+  void dispatch(const uint8_t *frame, size_t len, uint64_t timestamp);
+
+  Stats stats() const;
+
+  size_t size() const { return workers.size(); }
+  Stack &stack(size_t i) { return *workers[i]->stack; }
+
+private:
+  struct Worker {
+    std::unique_ptr<Stack> stack;
+    SpscRing<Packet> rx_ring;
+    SpscRing<Packet> tx_ring;
+    std::unique_ptr<uint8_t[]> rx_buffers;
+    std::unique_ptr<uint8_t[]> tx_buffers;
+    std::atomic<bool> finished{false};
+    uint64_t rejected = 0; // replies too large for a TX slot
+
+    Worker(std::unique_ptr<Stack> stack, size_t ring_size);
+  };
+
+  // worker whose stack runs on this thread, send_bytes puts replies into its TX ring
+  static thread_local Worker *current_worker;
+
+  Config config;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<bool> rx_finished{false};
+  Stats rx_stats;
+  uint64_t transmitted = 0;
+
+  void worker_loop(Worker &worker);
+  void tx_loop(Sink &sink);
+  void pin(pthread_t thread, size_t index);
+  size_t select_worker(const uint8_t *frame, size_t len) const;
+};
+} // namespace Pipeline
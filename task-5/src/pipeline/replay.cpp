@@ -0,0 +1,172 @@
+#include "replay.h"
+#include "shards.h"
+#include "../logging.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+using namespace Pipeline;
+
+constexpr size_t Replay::CHUNK_FRAMES;
+constexpr size_t Replay::CHUNKS;
+
+thread_local Replay::Output *Replay::current_output = nullptr;
+
+Replay::Replay(size_t burst, std::vector<std::unique_ptr<Stack>> stacks)
+    : burst(burst), stacks(std::move(stacks)), done_count(this->stacks.size()) {
+  for (auto &outputs_of_chunk : outputs)
+    outputs_of_chunk.resize(this->stacks.size());
+}
+
+Replay::~Replay() = default;
+
+void Replay::send_bytes(char *buf, size_t bufsiz) {
+  std::vector<uint8_t> &frames = current_output->frames;
+  uint32_t len = bufsiz;
+  size_t end = frames.size();
+  frames.resize(end + sizeof(len) + bufsiz);
+  memcpy(&frames[end], &len, sizeof(len));
+  memcpy(&frames[end + sizeof(len)], buf, bufsiz);
+}
+
+void Replay::handle(size_t worker, const Chunk &chunk, uint64_t first_seq, Output &output) {
+  Stack &stack = *stacks[worker];
+  output.log.clear();
+  output.frames.clear();
+  output.marks.clear();
+  current_output = &output;
+  log_capture(&output.log);
+
+  auto mark = [&output](uint64_t key, uint64_t seq) {
+    size_t log_end = output.log.size();
+    size_t tx_end = output.frames.size();
+    if (!output.marks.empty() && output.marks.back().log_end == log_end &&
+        output.marks.back().tx_end == tx_end)
+      return; // nothing since the last mark
+    if (output.marks.empty() && !log_end && !tx_end)
+      return;
+    output.marks.push_back({key, seq, log_end, tx_end});
+  };
+
+  for (size_t i = 0; i < chunk.records.size(); i++) {
+    const Record &record = chunk.records[i];
+    const uint8_t *frame = chunk.data.data() + record.offset;
+    uint64_t seq = first_seq + i;
+
+    if (flow_owner(frame, record.len, stacks.size()) != worker) {
+      if (is_arp(frame, record.len))
+        stack.observe_frame(frame, record.len);
+      continue;
+    }
+
+    // output of a frame goes where the frame is, output of the services after its burst
+    stack.handle_frame(frame, record.len, record.timestamp);
+    mark(seq * 2, seq);
+    stack.poll();
+    mark((seq - seq % burst + burst - 1) * 2 + 1, seq);
+  }
+
+  log_capture(nullptr);
+  current_output = nullptr;
+}
+
+void Replay::merge(size_t chunk, Writer &writer) {
+  struct Piece {
+    const Mark *mark;
+    size_t worker;
+    size_t index; // of the mark
+  };
+  std::vector<Piece> pieces;
+  for (size_t worker = 0; worker < stacks.size(); worker++) {
+    const std::vector<Mark> &marks = outputs[chunk][worker].marks;
+    for (size_t i = 0; i < marks.size(); i++)
+      pieces.push_back({&marks[i], worker, i});
+  }
+  std::sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b) {
+    return a.mark->key != b.mark->key ? a.mark->key < b.mark->key : a.mark->seq < b.mark->seq;
+  });
+
+  for (const Piece &piece : pieces) {
+    const Output &output = outputs[chunk][piece.worker];
+    const Mark *previous = piece.index ? &output.marks[piece.index - 1] : nullptr;
+
+    size_t log_begin = previous ? previous->log_end : 0;
+    if (piece.mark->log_end > log_begin)
+      writer.log(output.log.data() + log_begin, piece.mark->log_end - log_begin);
+
+    for (size_t p = previous ? previous->tx_end : 0; p < piece.mark->tx_end;) {
+      uint32_t len;
+      memcpy(&len, &output.frames[p], sizeof(len));
+      writer.transmit(&output.frames[p + sizeof(len)], len);
+      p += sizeof(len) + len;
+    }
+  }
+}
+
+void Replay::worker_loop(size_t worker) {
+  for (size_t chunk = 0;; chunk++) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&] { return read_count > chunk || end; });
+      if (read_count <= chunk)
+        return;
+    }
+
+    handle(worker, chunks[chunk % CHUNKS], chunk * CHUNK_FRAMES, outputs[chunk % CHUNKS][worker]);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    done_count[worker] = chunk + 1;
+    changed.notify_all();
+  }
+}
+
+void Replay::run(Reader &reader, Writer &writer) {
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < stacks.size(); i++)
+    threads.emplace_back(&Replay::worker_loop, this, i);
+
+  auto wait_done = [this](size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] {
+      return std::all_of(done_count.begin(), done_count.end(),
+                         [count](size_t done) { return done >= count; });
+    });
+  };
+
+  // read ahead while the workers are busy, a chunk is reused once it is written
+  size_t merged = 0;
+  for (;;) {
+    if (read_count - merged == CHUNKS) {
+      wait_done(merged + 1);
+      merge(merged % CHUNKS, writer);
+      merged++;
+    }
+
+    Chunk &chunk = chunks[read_count % CHUNKS];
+    chunk.data.clear();
+    chunk.records.clear();
+    reader.read(chunk, CHUNK_FRAMES);
+    if (chunk.records.empty())
+      break;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    read_count++;
+    changed.notify_all();
+    if (chunk.records.size() < CHUNK_FRAMES)
+      break; // the input ended within the chunk
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    end = true;
+    changed.notify_all();
+  }
+  for (; merged < read_count; merged++) {
+    wait_done(merged + 1);
+    merge(merged % CHUNKS, writer);
+  }
+
+  for (auto &thread : threads)
+    thread.join();
+}
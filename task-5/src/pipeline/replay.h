@@ -0,0 +1,107 @@
+#pragma once
+#include "../stack.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Pipeline {
+// Replays a capture file on several threads with output identical to the sequential run.
+//
+// The input is read in chunks of whole records. Every worker thread looks at every chunk and
+// handles the frames it owns (flow_owner), so each flow and its state (TCP connections, HTTP
+// parsers, per source buckets) lives in exactly one stack instance and sees its frames in order.
+// ARP frames additionally go to all other workers through Stack::observe_frame, so that every
+// neighbour cache ends up the same as in the sequential run.
+//
+// Log messages and reply frames are collected per worker and chunk, tagged with the position of
+// the input frame that caused them, and written in that order once all workers are done with the
+// chunk. Sequentially, services answer after every burst of frames. Workers poll after every
+// frame instead and sort the output after the end of the burst, so a datagram is echoed at the
+// same place in the output.
+//
+// State that is shared by all flows cannot be split like this. The caller has to fall back to the
+// sequential run for the global ICMP rate limit and the ping client. Pools (HTTP parsers, UDP
+// buffers, the TCP connection table) are per instance, so once the sequential run exhausts one of
+// them the results differ, but they are still the same on every parallel run.
+class Replay {
+public:
+  static constexpr size_t CHUNK_FRAMES = 4096;
+  static constexpr size_t CHUNKS = 4; // chunks in flight
+
+  struct Record {
+    size_t offset;
+    uint32_t len;
+    uint64_t timestamp;
+  };
+
+  struct Chunk {
+    std::vector<uint8_t> data;
+    std::vector<Record> records;
+  };
+
+  class Reader {
+  public:
+    virtual ~Reader() = default;
+    // Fill chunk with up to max records, none at the end of the input.
+    virtual void read(Chunk &chunk, size_t max) = 0;
+  };
+
+  class Writer {
+  public:
+    virtual ~Writer() = default;
+    virtual void log(const char *text, size_t len) = 0;
+    virtual void transmit(const uint8_t *frame, size_t len) = 0;
+  };
+
+  // The stacks have to be created with send_bytes as their send callback. burst is the number of
+  // frames after which the sequential run polls the services, CHUNK_FRAMES has to be a multiple.
+  Replay(size_t burst, std::vector<std::unique_ptr<Stack>> stacks);
+  ~Replay();
+
+  static void send_bytes(char *buf, size_t bufsiz);
+
+  // Blocks until the input is replayed and all output is written.
+  void run(Reader &reader, Writer &writer);
+
+  size_t size() const { return stacks.size(); }
+  Stack &stack(size_t i) { return *stacks[i]; }
+
+private:
+  // end of a piece of output of one worker
+  struct Mark {
+    uint64_t key; // position in the output, see handle
+    uint64_t seq; // input frame
+    size_t log_end;
+    size_t tx_end;
+  };
+
+  struct Output {
+    std::string log;
+    std::vector<uint8_t> frames; // length followed by the frame
+    std::vector<Mark> marks;
+  };
+
+  // output of the chunk handled on this thread, send_bytes appends to it
+  static thread_local Output *current_output;
+
+  size_t burst;
+  std::vector<std::unique_ptr<Stack>> stacks;
+  Chunk chunks[CHUNKS];
+  std::vector<Output> outputs[CHUNKS]; // per worker
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  size_t read_count = 0; // chunks available to the workers
+  bool end = false;
+  std::vector<size_t> done_count; // chunks finished per worker
+
+  void worker_loop(size_t worker);
+  void handle(size_t worker, const Chunk &chunk, uint64_t first_seq, Output &output);
+  void merge(size_t chunk, Writer &writer);
+};
+} // namespace Pipeline
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace Pipeline {
+// Bounded lock-free ring between exactly one producer and one consumer thread.
+//
+// Slots are filled and consumed in place: the producer writes into reserve() and publishes it
+// with commit(), the consumer reads peek() and hands the slot back with release(). Each side keeps
+// a cached copy of the other side's index, so the shared cache line is only touched when the
+// ring looks full or empty.
+template <typename T> class SpscRing {
+public:
+  // capacity has to be a power of two
+  explicit SpscRing(size_t capacity) : slots(new T[capacity]()), mask(capacity - 1) {}
+
+  size_t capacity() const { return mask + 1; }
+
+  // Slot i of the storage, for initializing the slots before the threads start.
+  T &slot(size_t i) { return slots[i]; }
+
+  // producer side
+  T *reserve() {
+    size_t t = tail.value.load(std::memory_order_relaxed);
+    if (t - head_cache == capacity()) {
+      head_cache = head.value.load(std::memory_order_acquire);
+      if (t - head_cache == capacity())
+        return nullptr;
+    }
+    return &slots[t & mask];
+  }
+
+  void commit() {
+    tail.value.store(tail.value.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // consumer side
+  T *peek() {
+    size_t h = head.value.load(std::memory_order_relaxed);
+    if (h == tail_cache) {
+      tail_cache = tail.value.load(std::memory_order_acquire);
+      if (h == tail_cache)
+        return nullptr;
+    }
+    return &slots[h & mask];
+  }
+
+  void release() {
+    head.value.store(head.value.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Occupied slots, exact on either side of the ring and approximate elsewhere.
+  size_t size() const {
+    return tail.value.load(std::memory_order_acquire) - head.value.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return head.value.load(std::memory_order_acquire) == tail.value.load(std::memory_order_acquire);
+  }
+
+private:
+  // padded instead of aligned, C++14 new does not honour alignments beyond max_align_t
+  static constexpr size_t CACHE_LINE = 64;
+  struct Index {
+    std::atomic<size_t> value{0};
+    char padding[CACHE_LINE - sizeof(std::atomic<size_t>)];
+  };
+
+  char padding0[CACHE_LINE];
+  std::unique_ptr<T[]> slots;
+  size_t mask;
+  char padding1[CACHE_LINE];
+
+  Index head; // next slot to consume, written by the consumer
+  Index tail; // next slot to fill, written by the producer
+
+  // private to their side, on separate cache lines
+  size_t head_cache = 0; // producer's view of head
+  char padding2[CACHE_LINE - sizeof(size_t)];
+  size_t tail_cache = 0; // consumer's view of tail
+  char padding3[CACHE_LINE - sizeof(size_t)];
+};
+} // namespace Pipeline
@@ -0,0 +1,164 @@
+#include "shards.h"
+#include "../trace.h"
+
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h> // ntohl
+
+using namespace Pipeline;
+
+constexpr size_t Shards::BATCH;
+
+thread_local Shards::Shard *Shards::current_shard = nullptr;
+
+bool Pipeline::flow_hash(const uint8_t *frame, size_t len, uint32_t &hash) {
+  if (len < sizeof(Ethernet::Header))
+    return false;
+
+  uint32_t a, b;
+  uint16_t ether_type = frame[12] << 8 | frame[13];
+  if (ether_type == Ethernet::TYPE_IP && len >= 14 + 20) {
+    memcpy(&a, frame + 14 + 12, sizeof(a));
+    memcpy(&b, frame + 14 + 16, sizeof(b));
+  } else if (ether_type == Ethernet::TYPE_ARP && len >= 14 + 28) {
+    memcpy(&a, frame + 14 + 14, sizeof(a));
+    memcpy(&b, frame + 14 + 24, sizeof(b));
+  } else {
+    return false;
+  }
+  // as numbers, which is how BPF loads them
+  a = ntohl(a);
+  b = ntohl(b);
+
+  // order the pair, then the finalizer of MurmurHash3
+  uint32_t h = (a < b ? a : b) * 0x9e3779b1u ^ (a < b ? b : a);
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  hash = h;
+  return true;
+}
+
+std::vector<sock_filter> Pipeline::flow_owner_program(size_t n) {
+  // M[0] and M[1] hold the ordered pair, the hash * n >> 32 of flow_owner is computed in 16 bit
+  // halves as there is no 64 bit arithmetic
+  uint32_t shards = n;
+  return {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_PROTOCOL)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, Ethernet::TYPE_IP, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12)),
+      BPF_STMT(BPF_ST, 0),
+      BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 16)),
+      BPF_STMT(BPF_ST, 1),
+      BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 3, 0),
+      BPF_STMT(BPF_ST, 0),
+      BPF_STMT(BPF_MISC | BPF_TXA, 0),
+      BPF_STMT(BPF_ST, 1),
+
+      BPF_STMT(BPF_LD | BPF_MEM, 0),
+      BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1u),
+      BPF_STMT(BPF_LDX | BPF_MEM, 1),
+      BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x85ebca6bu),
+      BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 13),
+      BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0xc2b2ae35u),
+      BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+
+      BPF_STMT(BPF_ST, 2),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, shards),
+      BPF_STMT(BPF_ST, 3),
+      BPF_STMT(BPF_LD | BPF_MEM, 2),
+      BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff),
+      BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, shards),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      BPF_STMT(BPF_LDX | BPF_MEM, 3),
+      BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+}
+
+Shards::Shards(const std::vector<int> &cpus, std::vector<std::unique_ptr<Stack>> stacks)
+    : cpus(cpus) {
+  for (auto &stack : stacks) {
+    shards.push_back(std::make_unique<Shard>());
+    shards.back()->index = shards.size() - 1;
+    shards.back()->stack = std::move(stack);
+  }
+}
+
+Shards::~Shards() = default;
+
+void Shards::send_bytes(char *buf, size_t bufsiz) {
+  Shard *shard = current_shard;
+  shard->port->transmit(reinterpret_cast<uint8_t *>(buf), bufsiz);
+  shard->stats.transmitted++;
+}
+
+void Shards::dispatch(const uint8_t *frame, size_t len, uint64_t timestamp, bool steered) {
+  Shard &shard = *current_shard;
+  bool arp = is_arp(frame, len);
+  bool owned = (!arp && steered) || flow_owner(frame, len, shards.size()) == shard.index;
+
+  if (owned) {
+    shard.stack->handle_frame(frame, len, timestamp);
+    shard.stats.handled++;
+  } else if (arp) {
+    shard.stack->observe_frame(frame, len);
+    shard.stats.observed++;
+  } else {
+    shard.stats.skipped++;
+  }
+}
+
+void Shards::loop(Shard &shard) {
+  current_shard = &shard;
+  int received;
+  while ((received = shard.port->receive(*this, BATCH)) >= 0) {
+    shard.stack->poll();
+    if (shard.index == 0)
+      Trace::poll();
+    if (!received)
+      std::this_thread::yield();
+  }
+}
+
+void Shards::pin(pthread_t thread, size_t index) {
+  if (index >= cpus.size() || cpus[index] < 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[index], &set);
+  pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+void Shards::run(std::vector<std::unique_ptr<Port>> ports) {
+  for (size_t i = 0; i < shards.size(); i++)
+    shards[i]->port = ports[i].get();
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < shards.size(); i++) {
+    threads.emplace_back(&Shards::loop, this, std::ref(*shards[i]));
+    pin(threads.back().native_handle(), i);
+  }
+  pin(pthread_self(), 0);
+  loop(*shards[0]);
+
+  for (auto &thread : threads)
+    thread.join();
+  for (auto &shard : shards)
+    shard->port = nullptr;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "../stack.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <linux/filter.h> // sock_filter
+#include <pthread.h>
+
+namespace Pipeline {
+// Hash of the IPv4 source and destination address of a frame, for ARP of the sender and target
+// protocol address. The addresses are ordered before mixing, so both directions of a flow and the
+// ARP exchange between the same two hosts get the same value. Returns false for other frames.
+bool flow_hash(const uint8_t *frame, size_t len, uint32_t &hash);
+
+// flow_owner of IPv4 packets as a classic BPF program for a PACKET_FANOUT_CBPF group of n sockets,
+// so that the kernel steers a flow to the shard that also owns the ARP exchange of its hosts.
+// Everything else goes to socket 0, as it does in flow_owner.
+std::vector<sock_filter> flow_owner_program(size_t n);
+
+// Which of n stack instances owns a frame, 0 for frames without a flow hash.
+inline size_t flow_owner(const uint8_t *frame, size_t len, size_t n) {
+  uint32_t hash;
+  if (n == 1 || !flow_hash(frame, len, hash))
+    return 0;
+  return (uint64_t)hash * n >> 32;
+}
+
+// Whether a frame is ARP, which every instance has to see.
+inline bool is_arp(const uint8_t *frame, size_t len) {
+  return len >= sizeof(Ethernet::Header) &&
+         HeaderView::get<Ethernet::Fields::Type>(frame) == Ethernet::TYPE_ARP;
+}
+
+// Frame input and output of one shard, used only from the thread of that shard.
+class Port {
+public:
+  virtual ~Port() = default;
+
+  // Pass up to max frames to Shards::dispatch. Returns the number of frames, 0 if there are none
+  // right now and -1 at the end of the input.
+  virtual int receive(class Shards &shards, size_t max) = 0;
+
+  virtual void transmit(const uint8_t *frame, size_t len) = 0;
+};
+
+// Software RSS: runs N independent stack instances, each to completion on a thread of its own.
+//
+// A frame is owned by the shard its flow hash maps to, so a flow is always handled by the same
+// instance, in order. Ports either deliver only the frames of their shard (a kernel fanout group
+// running flow_owner_program) or all frames, in which case the shards skip what they do not own.
+// ARP frames always reach every shard: the owner handles them, the others only learn the
+// neighbour, so that all instances can resolve a peer while exactly one of them answers.
+//
+// The owner follows the address pair, not the source alone. State a stack keeps per source, the
+// ICMP rate limit buckets and the flood detector, therefore sees every packet of a source only
+// while the source talks to one address of ours, which is all the kernel prefilter lets through.
+// Sources that reach other addresses (--no-prefilter, broadcasts) are counted by several shards.
+//
+// Apart from the routing table and the global ICMP bucket nothing is shared between the shards,
+// not even the counters.
+class Shards {
+public:
+  static constexpr size_t BATCH = 32;
+
+  struct Stats {
+    uint64_t handled = 0;
+    uint64_t observed = 0; // ARP frames owned by another shard
+    uint64_t skipped = 0;  // other frames owned by another shard
+    uint64_t transmitted = 0;
+  };
+
+  // The stacks have to be created with send_bytes as their send callback. cpus[i] is the CPU of
+  // shard i, -1 or missing to not pin it.
+  Shards(const std::vector<int> &cpus, std::vector<std::unique_ptr<Stack>> stacks);
+  ~Shards();
+
+  static void send_bytes(char *buf, size_t bufsiz);
+
+  // Run one thread per port until all ports end. Shard 0 runs on the calling thread.
+  void run(std::vector<std::unique_ptr<Port>> ports);
+
+  // Called from Port::receive on the thread of the shard. steered tells that the frame is known
+  // to belong to this shard already.
+  void dispatch(const uint8_t *frame, size_t len, uint64_t timestamp, bool steered);
+
+  size_t size() const { return shards.size(); }
+  Stack &stack(size_t i) { return *shards[i]->stack; }
+  const Stats &stats(size_t i) const { return shards[i]->stats; }
+
+private:
+  struct Shard {
+    size_t index;
+    std::unique_ptr<Stack> stack;
+    Port *port = nullptr;
+    Stats stats;
+  };
+
+  // shard running on this thread, send_bytes transmits on its port
+  static thread_local Shard *current_shard;
+
+  std::vector<int> cpus;
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  void loop(Shard &shard);
+  void pin(pthread_t thread, size_t index);
+};
+} // namespace Pipeline
@@ -0,0 +1,120 @@
+#include "stack.h"
+#include "clock.h"
+#include "trace.h"
+#include "icmp/icmp.h"
+#include "tcp/tcp.h"
+#include "udp/udp.h"
+
+// Flow table groups checked for idle flows per poll.
+#define FLOW_EXPIRE_GROUPS 8
+
+Stack::Stack(const StackConfig &config, Ethernet::Protocol::send_callback send_bytes)
+    : ipv4_handler(std::make_unique<IPv4::Protocol>(config.ip)),
+      arp_handler(std::make_unique<ARP::Protocol>()),
+      ethernet_handler(std::make_unique<Ethernet::Protocol>(
+          config.mac, ipv4_handler, arp_handler, config.respond ? send_bytes : nullptr)),
+      router(config.router), own_counters(Counters::allocate()), counters(own_counters.get()) {
+  arp_handler->set_ethernet_handler(ethernet_handler);
+  arp_handler->set_ipv4_handler(ipv4_handler);
+  ipv4_handler->set_ethernet_handler(ethernet_handler);
+  ipv4_handler->set_arp_handler(arp_handler);
+  ipv4_handler->set_router(config.router);
+  if (router)
+    router_reader = router->add_reader();
+
+  if (config.mac_filter) {
+    auto admission = std::make_unique<Ethernet::Admission>();
+    admission->add({{0xff, 0xff, 0xff, 0xff, 0xff, 0xff}});
+    admission->add(config.mac);
+    for (const Ethernet::Address &group : config.multicast)
+      admission->add(group);
+    ethernet_handler->set_admission(std::move(admission), config.log_dropped);
+  }
+
+  if (config.max_flows) {
+    flow_table = std::make_unique<Flows::Table>(config.max_flows, config.flow_timeout);
+    ipv4_handler->set_flow_table(flow_table.get());
+  }
+
+  if (config.flood_window) {
+    flood_detector = std::make_unique<Flood::Detector>(config.flood_window,
+                                                       config.flood_thresholds, config.flood_deny);
+    arp_handler->set_flood_detector(flood_detector.get());
+    ipv4_handler->icmp()->set_flood_detector(flood_detector.get());
+  }
+
+  if (config.traffic_report)
+    traffic_recorder = std::make_unique<Traffic::Recorder>(config.report_interval);
+}
+
+std::unique_ptr<Stack> Stack::create(const StackConfig &config,
+                                     Ethernet::Protocol::send_callback send_bytes) {
+  std::unique_ptr<Stack> stack(new Stack(config, send_bytes));
+  IPv4::Protocol *ipv4 = stack->ipv4();
+
+  if (config.icmp_rate_limit)
+    ipv4->icmp()->set_rate_limit(config.icmp_source_rate, config.icmp_global_rate,
+                                  config.icmp_global_bucket);
+
+  UDP::Protocol *udp = ipv4->udp();
+  if (config.udp_echo_port >= 0) {
+    UDP::Socket *socket = udp->bind(config.udp_echo_port);
+    if (!socket)
+      return nullptr;
+    udp->add_service(std::make_unique<UDP::EchoService>(socket));
+  }
+
+  TCP::Protocol *tcp = ipv4->tcp();
+  for (uint16_t port : config.tcp_ports)
+    tcp->listen(port);
+  for (uint16_t port : config.http_ports)
+    tcp->listen(port, &stack->http_inspector);
+  if (config.has_syncookie_secret)
+    tcp->set_cookie_secret(config.syncookie_secret);
+  tcp->set_idle_timeout(config.tcp_idle_timeout);
+
+  return stack;
+}
+
+void Stack::handle_frame(const uint8_t *frame, size_t len, uint64_t timestamp) {
+  Clock::packet_time = timestamp;
+  Counters::local = counters;
+  TRACE_RX();
+  // all frames, the ones the stack turns away are traffic too
+  if (traffic_recorder)
+    traffic_recorder->add(frame, len, timestamp);
+  ethernet_handler->handle_packet(frame, len);
+  TRACE_POINT(POINT_DONE);
+  TRACE_END();
+}
+
+void Stack::observe_frame(const uint8_t *frame, size_t len) {
+  Counters::local = counters;
+  if (len < sizeof(Ethernet::Header))
+    return;
+  if (HeaderView::get<Ethernet::Fields::Type>(frame) == Ethernet::TYPE_ARP)
+    arp_handler->observe(frame + sizeof(Ethernet::Header), len - sizeof(Ethernet::Header));
+}
+
+void Stack::poll() {
+  Counters::local = counters;
+  if (router)
+    router->quiescent(router_reader);
+  UDP::Protocol *udp = ipv4_handler->udp();
+  udp->poll();
+
+  Counters::set(Counters::ARP_NEIGHBOURS, arp_handler->neighbour_count());
+  Counters::set(Counters::UDP_BUFFERS_USED, UDP::Protocol::POOL_SIZE - udp->buffers().available());
+  TCP::Protocol *tcp = ipv4_handler->tcp();
+  tcp->expire(Clock::packet_time);
+  Counters::set(Counters::TCP_CONNECTIONS, tcp->connection_table().size());
+  Counters::set(Counters::HTTP_PARSERS_USED, http_inspector.parsers_used());
+
+  if (flow_table) {
+    // packets of the burst not counted yet, then a few groups at a time, a sweep of the table
+    // spreads over many polls
+    flow_table->flush();
+    flow_table->expire(Clock::packet_time, FLOW_EXPIRE_GROUPS);
+    Counters::set(Counters::FLOWS_ACTIVE, flow_table->size());
+  }
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "clock.h"
+#include "counters.h"
+#include "flood.h"
+#include "flows.h"
+#include "traffic.h"
+#include "layer_link/ethernet.h"
+#include "layer_internet/arp.h"
+#include "layer_internet/ipv4.h"
+#include "layer_internet/route.h"
+#include "icmp/ratelimit.h"
+#include "http/http.h"
+#include "tcp/tcp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Everything needed to set up an instance of the protocol stack.
+struct StackConfig {
+  Ethernet::Address mac;
+  IPv4::Address ip;
+  bool respond = false;
+  // admit only frames to broadcast, mac and the multicast groups, log_dropped logs the others
+  bool mac_filter = false;
+  std::vector<Ethernet::Address> multicast;
+  bool log_dropped = false;
+  Route::Router *router = nullptr; // shared, every instance is one of its readers
+
+  int udp_echo_port = -1;
+  std::vector<uint16_t> tcp_ports;
+  uint64_t tcp_idle_timeout = TCP::Protocol::DEFAULT_IDLE_TIMEOUT;
+  std::vector<uint16_t> http_ports;
+
+  bool has_syncookie_secret = false;
+  uint8_t syncookie_secret[16] = {};
+
+  bool icmp_rate_limit = false;
+  uint32_t icmp_source_rate = 0;
+  uint32_t icmp_global_rate = 0;
+  ICMP::GlobalBucket *icmp_global_bucket = nullptr; // shared, each instance has its own if not set
+
+  // alert on sources above the ARP and echo request thresholds per flood_window, refuse their
+  // requests for flood_deny
+  uint64_t flood_window = 0; // no detection without
+  uint32_t flood_thresholds[Flood::Detector::KINDS] = {};
+  uint64_t flood_deny = 0;
+
+  size_t max_flows = 0; // no flow table without
+  uint64_t flow_timeout = 60 * Clock::NS_PER_SEC;
+
+  // summarize the frames for traffic reports, one per report_interval or once with 0
+  bool traffic_report = false;
+  uint64_t report_interval = 0;
+};
+
+// The layers wired to each other together with the configured services.
+//
+// An instance is not thread-safe. Multi-threaded modes create one per thread.
+class Stack {
+public:
+  // Returns nullptr if a service cannot be set up.
+  static std::unique_ptr<Stack> create(const StackConfig &config,
+                                       Ethernet::Protocol::send_callback send_bytes);
+
+  // Handle a frame captured at timestamp (nanoseconds since the epoch).
+  void handle_frame(const uint8_t *frame, size_t len, uint64_t timestamp);
+
+  // Learn from a frame that another instance handles. Only ARP updates the neighbour cache, so
+  // that every instance can resolve the peers that one of them answered.
+  void observe_frame(const uint8_t *frame, size_t len);
+
+  // Let the services answer what was queued since the last call, count the flows of the frames
+  // and publish the gauges. The instance holds no routing table between frames, poll reports
+  // that to the router.
+  void poll();
+
+  Ethernet::Protocol *ethernet() { return ethernet_handler.get(); }
+  ARP::Protocol *arp() { return arp_handler.get(); }
+  IPv4::Protocol *ipv4() { return ipv4_handler.get(); }
+  const Flows::Table *flows() const { return flow_table.get(); }        // nullptr without
+  const Flood::Detector *flood() const { return flood_detector.get(); } // nullptr without
+  Traffic::Recorder *traffic() { return traffic_recorder.get(); }       // nullptr without
+
+  // Count into block, for example one of a Counters::Segment, instead of a private block.
+  void set_counters(Counters::Block *block) { counters = block; }
+  const Counters::Block &counter_block() const { return *counters; }
+
+private:
+  std::unique_ptr<IPv4::Protocol> ipv4_handler;
+  std::unique_ptr<ARP::Protocol> arp_handler;
+  std::unique_ptr<Ethernet::Protocol> ethernet_handler;
+  HTTP::Inspector http_inspector;
+  std::unique_ptr<Flows::Table> flow_table;
+  std::unique_ptr<Flood::Detector> flood_detector;
+  std::unique_ptr<Traffic::Recorder> traffic_recorder;
+  Route::Router *router;
+  Route::Router::Reader *router_reader = nullptr;
+  Counters::BlockPtr own_counters;
+  Counters::Block *counters;
+
+  Stack(const StackConfig &config, Ethernet::Protocol::send_callback send_bytes);
+};
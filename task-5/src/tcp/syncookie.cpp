@@ -0,0 +1,104 @@
+#include "syncookie.h"
+#include "../clock.h"
+
+#include <cstring>
+#include <random>
+
+using namespace TCP;
+
+// MSS values a cookie can encode, the peer MSS is rounded down to one of them
+static const uint16_t MSS_TABLE[] = {536, 1220, 1360, 1400, 1440, 1460, 4312, 8960};
+
+// time steps of 64 seconds
+static uint32_t time_counter(uint64_t now) { return now / Clock::NS_PER_SEC >> 6; }
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                                                   \
+  do {                                                                                             \
+    v0 += v1;                                                                                      \
+    v1 = ROTL(v1, 13);                                                                             \
+    v1 ^= v0;                                                                                      \
+    v0 = ROTL(v0, 32);                                                                             \
+    v2 += v3;                                                                                      \
+    v3 = ROTL(v3, 16);                                                                             \
+    v3 ^= v2;                                                                                      \
+    v0 += v3;                                                                                      \
+    v3 = ROTL(v3, 21);                                                                             \
+    v3 ^= v0;                                                                                      \
+    v2 += v1;                                                                                      \
+    v1 = ROTL(v1, 17);                                                                             \
+    v1 ^= v2;                                                                                      \
+    v2 = ROTL(v2, 32);                                                                             \
+  } while (0)
+
+// SipHash-2-4 over a whole number of 64 bit words.
+static uint64_t siphash(const uint64_t key[2], const uint64_t *words, size_t count) {
+  uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+  uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+  uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+  uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+
+  for (size_t i = 0; i < count; i++) {
+    v3 ^= words[i];
+    SIPROUND;
+    SIPROUND;
+    v0 ^= words[i];
+  }
+
+  uint64_t last = (uint64_t)(count * 8) << 56;
+  v3 ^= last;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= last;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+SynCookies::SynCookies() {
+  std::random_device random;
+  for (auto &word : key)
+    word = (uint64_t)random() << 32 | random();
+}
+
+void SynCookies::set_secret(const uint8_t secret[16]) { memcpy(key, secret, sizeof(key)); }
+
+uint32_t SynCookies::hash(const IPv4::Address &src_ip, const IPv4::Address &dst_ip,
+                          uint16_t src_port, uint16_t dst_port, uint32_t peer_isn,
+                          uint32_t counter) const {
+  uint64_t words[3] = {(uint64_t)src_ip.s_addr << 32 | dst_ip.s_addr,
+                       (uint64_t)src_port << 48 | (uint64_t)dst_port << 32 | peer_isn, counter};
+  return siphash(key, words, 3) & 0xffffff;
+}
+
+uint32_t SynCookies::make(const IPv4::Address &src_ip, const IPv4::Address &dst_ip,
+                          uint16_t src_port, uint16_t dst_port, uint32_t peer_isn, uint16_t mss,
+                          uint64_t now) const {
+  uint32_t mss_index = 0;
+  while (mss_index + 1 < sizeof(MSS_TABLE) / sizeof(MSS_TABLE[0]) &&
+         MSS_TABLE[mss_index + 1] <= mss)
+    mss_index++;
+
+  uint32_t counter = time_counter(now);
+  return (counter & 0x1f) << 27 | mss_index << 24 |
+         hash(src_ip, dst_ip, src_port, dst_port, peer_isn, counter);
+}
+
+uint16_t SynCookies::check(const IPv4::Address &src_ip, const IPv4::Address &dst_ip,
+                           uint16_t src_port, uint16_t dst_port, uint32_t peer_isn,
+                           uint32_t cookie, uint64_t now) const {
+  // accept cookies from the current and the previous time step
+  uint32_t counter = time_counter(now);
+  if ((cookie >> 27) != (counter & 0x1f))
+    counter--;
+  if ((cookie >> 27) != (counter & 0x1f))
+    return 0;
+
+  if ((cookie & 0xffffff) != hash(src_ip, dst_ip, src_port, dst_port, peer_isn, counter))
+    return 0;
+  return MSS_TABLE[cookie >> 24 & 0x7];
+}
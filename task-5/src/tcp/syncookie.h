@@ -0,0 +1,36 @@
+#pragma once
+#include "../layer_internet/ipv4.h"
+
+#include <cstdint>
+
+namespace TCP {
+
+// SYN cookies (RFC 4987). The initial sequence number of a SYN-ACK encodes everything needed to
+// accept the final ACK of the handshake, so no state is kept for half-open connections.
+//
+// Layout of a cookie:
+//   bits 31..27  time counter (64 second steps, modulo 32)
+//   bits 26..24  index of the peer MSS in MSS_TABLE
+//   bits 23..0   keyed hash over the connection tuple, the peer ISN and the time counter
+class SynCookies {
+public:
+  // The secret is random unless it is set explicitly.
+  SynCookies();
+
+  void set_secret(const uint8_t secret[16]);
+
+  uint32_t make(const IPv4::Address &src_ip, const IPv4::Address &dst_ip, uint16_t src_port,
+                uint16_t dst_port, uint32_t peer_isn, uint16_t mss, uint64_t now) const;
+
+  // Validate the cookie echoed in an ACK. Returns the encoded MSS or 0 if the cookie is invalid
+  // or older than two time steps.
+  uint16_t check(const IPv4::Address &src_ip, const IPv4::Address &dst_ip, uint16_t src_port,
+                 uint16_t dst_port, uint32_t peer_isn, uint32_t cookie, uint64_t now) const;
+
+private:
+  uint64_t key[2];
+
+  uint32_t hash(const IPv4::Address &src_ip, const IPv4::Address &dst_ip, uint16_t src_port,
+                uint16_t dst_port, uint32_t peer_isn, uint32_t counter) const;
+};
+} // namespace TCP
@@ -0,0 +1,308 @@
+#include "tcp.h"
+#include "../clock.h"
+#include "../counters.h"
+#include "../logging.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace TCP;
+
+constexpr uint64_t Protocol::DEFAULT_IDLE_TIMEOUT;
+constexpr uint64_t Protocol::LAST_ACK_TIMEOUT;
+
+// TCP option kinds
+#define OPT_END 0
+#define OPT_NOP 1
+#define OPT_MSS 2
+
+// MSS assumed when the peer does not announce one (RFC 879)
+#define DEFAULT_MSS 536
+
+Connection *ConnectionTable::find(const IPv4::Address &peer_ip, uint16_t peer_port,
+                                  const IPv4::Address &local_ip, uint16_t local_port) {
+  for (size_t i = slot(peer_ip, peer_port, local_ip, local_port);; i = (i + 1) & mask) {
+    Connection &conn = entries[i];
+    if (conn.state == STATE_FREE)
+      return nullptr;
+    if (conn.peer_ip.s_addr == peer_ip.s_addr && conn.peer_port == peer_port &&
+        conn.local_ip.s_addr == local_ip.s_addr && conn.local_port == local_port)
+      return &conn;
+  }
+}
+
+Connection *ConnectionTable::insert(const IPv4::Address &peer_ip, uint16_t peer_port,
+                                    const IPv4::Address &local_ip, uint16_t local_port) {
+  // keep probe sequences short
+  if (used >= entries.size() / 4 * 3)
+    return nullptr;
+
+  size_t i = slot(peer_ip, peer_port, local_ip, local_port);
+  while (entries[i].state != STATE_FREE)
+    i = (i + 1) & mask;
+
+  Connection &conn = entries[i];
+  memset(&conn, 0, sizeof(conn));
+  conn.peer_ip = peer_ip;
+  conn.peer_port = peer_port;
+  conn.local_ip = local_ip;
+  conn.local_port = local_port;
+  conn.state = STATE_ESTABLISHED;
+  used++;
+  return &conn;
+}
+
+void ConnectionTable::erase(Connection *conn) {
+  size_t hole = conn - entries.data();
+
+  // move back entries whose probe sequence passes the hole
+  for (size_t i = (hole + 1) & mask; entries[i].state != STATE_FREE; i = (i + 1) & mask) {
+    const Connection &next = entries[i];
+    size_t home = slot(next.peer_ip, next.peer_port, next.local_ip, next.local_port);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      entries[hole] = next;
+      hole = i;
+    }
+  }
+
+  entries[hole].state = STATE_FREE;
+  used--;
+}
+
+static uint16_t parse_mss(const Header *tcp, size_t header_len) {
+  auto *options = reinterpret_cast<const uint8_t *>(tcp) + sizeof(Header);
+  size_t len = header_len - sizeof(Header);
+
+  for (size_t i = 0; i < len;) {
+    if (options[i] == OPT_END)
+      break;
+    if (options[i] == OPT_NOP) {
+      i++;
+      continue;
+    }
+    if (i + 1 >= len || options[i + 1] < 2 || i + options[i + 1] > len)
+      break;
+    if (options[i] == OPT_MSS && options[i + 1] == 4)
+      return options[i + 2] << 8 | options[i + 3];
+    i += options[i + 1];
+  }
+  return DEFAULT_MSS;
+}
+
+void Protocol::handle_packet(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+                             const IPv4::Address &dst_ip, const uint8_t *buffer,
+                             size_t buffer_len) {
+  auto *tcp = reinterpret_cast<const Header *>(buffer);
+  size_t header_len = buffer_len < sizeof(Header) ? 0 : (tcp->data_off >> 4) * 4;
+  if (header_len < sizeof(Header) || header_len > buffer_len) {
+    Counters::count(Counters::TCP_DROP_MALFORMED);
+    return;
+  }
+
+  if (IPv4::Protocol::checksum(src_ip, dst_ip, IPPROTO_TCP, buffer, buffer_len)) {
+    Counters::count(Counters::TCP_DROP_CHECKSUM);
+    return;
+  }
+  Counters::count(Counters::TCP_RX_SEGMENTS);
+
+  uint16_t src_port = ntohs(tcp->src_port);
+  uint16_t dst_port = ntohs(tcp->dst_port);
+  uint32_t seq = ntohl(tcp->seq);
+  uint32_t ack = ntohl(tcp->ack);
+  log_tcp_segment(src_port, dst_port, seq, ack, tcp->flags);
+
+  const uint8_t *payload = buffer + header_len;
+  size_t payload_len = buffer_len - header_len;
+
+  // a connection the sweep did not get to yet is just as gone
+  Connection *conn = connections.find(src_ip, src_port, dst_ip, dst_port);
+  if (conn && expired(*conn, Clock::packet_time)) {
+    connections.erase(conn);
+    conn = nullptr;
+  }
+  if (conn) {
+    conn->last_seen = Clock::packet_time;
+    handle_segment(*conn, src_mac, tcp, payload, payload_len);
+    return;
+  }
+
+  // never answer a reset
+  if (tcp->flags & FLAG_RST)
+    return;
+
+  if (!listening[dst_port]) {
+    reset(src_mac, src_ip, tcp, payload_len);
+    return;
+  }
+
+  uint8_t handshake = tcp->flags & (FLAG_SYN | FLAG_ACK);
+  if (handshake == FLAG_SYN) {
+    // answer statelessly, the cookie carries everything needed to accept the final ACK
+    uint32_t cookie = cookies.make(src_ip, dst_ip, src_port, dst_port, seq,
+                                   parse_mss(tcp, header_len), Clock::packet_time);
+    send(src_mac, src_ip, dst_port, src_port, cookie, seq + 1, FLAG_SYN | FLAG_ACK, MSS);
+    return;
+  }
+
+  if (handshake == FLAG_ACK) {
+    uint16_t mss =
+        cookies.check(src_ip, dst_ip, src_port, dst_port, seq - 1, ack - 1, Clock::packet_time);
+    conn = mss ? connections.insert(src_ip, src_port, dst_ip, dst_port) : nullptr;
+    if (!conn) {
+      reset(src_mac, src_ip, tcp, payload_len);
+      return;
+    }
+
+    Counters::count(Counters::TCP_ACCEPTED);
+    conn->snd_nxt = ack;
+    conn->rcv_nxt = seq;
+    conn->last_seen = Clock::packet_time;
+    Application *app = applications[dst_port];
+    if (app)
+      app->accept(*conn);
+
+    // the final ACK of the handshake may already carry data
+    handle_segment(*conn, src_mac, tcp, payload, payload_len);
+    return;
+  }
+
+  reset(src_mac, src_ip, tcp, payload_len);
+}
+
+void Protocol::handle_segment(Connection &conn, const Ethernet::Address &src_mac,
+                              const Header *tcp, const uint8_t *payload, size_t payload_len) {
+  uint32_t seq = ntohl(tcp->seq);
+  Application *app = applications[conn.local_port];
+
+  if (tcp->flags & FLAG_RST) {
+    // only accept resets exactly at the expected sequence number (RFC 5961)
+    if (seq == conn.rcv_nxt) {
+      if (app)
+        app->close(conn);
+      connections.erase(&conn);
+    }
+    return;
+  }
+
+  // a SYN on an established connection or anything out of order only gets an ACK, segments are
+  // not reassembled
+  if ((tcp->flags & FLAG_SYN) || seq != conn.rcv_nxt) {
+    send(src_mac, conn.peer_ip, conn.local_port, conn.peer_port, conn.snd_nxt, conn.rcv_nxt,
+         FLAG_ACK);
+    return;
+  }
+
+  if (conn.state == STATE_LAST_ACK) {
+    if ((tcp->flags & FLAG_ACK) && ntohl(tcp->ack) == conn.snd_nxt) {
+      if (app)
+        app->close(conn);
+      connections.erase(&conn);
+    }
+    return;
+  }
+
+  if (payload_len) {
+    if (app)
+      app->receive(conn, payload, payload_len);
+    conn.rcv_nxt += payload_len;
+  }
+
+  if (tcp->flags & FLAG_FIN) {
+    conn.rcv_nxt++;
+    send(src_mac, conn.peer_ip, conn.local_port, conn.peer_port, conn.snd_nxt, conn.rcv_nxt,
+         FLAG_FIN | FLAG_ACK);
+    conn.snd_nxt++;
+    conn.state = STATE_LAST_ACK;
+  } else if (payload_len) {
+    send(src_mac, conn.peer_ip, conn.local_port, conn.peer_port, conn.snd_nxt, conn.rcv_nxt,
+         FLAG_ACK);
+  }
+}
+
+void Protocol::expire(uint64_t now) {
+  if (now <= last_expire)
+    return;
+  if (!last_expire) {
+    last_expire = now;
+    return;
+  }
+
+  uint64_t period = std::max<uint64_t>(idle_timeout / 4, 1);
+  uint64_t elapsed = now - last_expire;
+  size_t count = connections.capacity();
+  if (elapsed < period) {
+    // the time of a partial slot is left for the next call
+    count = count * elapsed / period;
+    if (!count)
+      return;
+    last_expire += count * period / connections.capacity();
+  } else {
+    last_expire = now;
+  }
+
+  connections.expire(count, [this, now](Connection &conn) { return expired(conn, now); });
+}
+
+bool Protocol::expired(Connection &conn, uint64_t now) {
+  uint64_t timeout =
+      conn.state == STATE_LAST_ACK ? std::min(idle_timeout, LAST_ACK_TIMEOUT) : idle_timeout;
+  if (conn.last_seen + timeout > now)
+    return false;
+  Application *app = applications[conn.local_port];
+  if (app)
+    app->close(conn);
+  Counters::count(Counters::TCP_EXPIRED);
+  return true;
+}
+
+void Protocol::reset(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+                     const Header *tcp, size_t payload_len) {
+  uint16_t src_port = ntohs(tcp->dst_port);
+  uint16_t dst_port = ntohs(tcp->src_port);
+
+  // RFC 793: take the sequence number from the ACK if there is one, otherwise acknowledge
+  // everything the segment occupied
+  if (tcp->flags & FLAG_ACK) {
+    send(src_mac, src_ip, src_port, dst_port, ntohl(tcp->ack), 0, FLAG_RST);
+  } else {
+    uint32_t ack = ntohl(tcp->seq) + payload_len + !!(tcp->flags & FLAG_SYN) +
+                   !!(tcp->flags & FLAG_FIN);
+    send(src_mac, src_ip, src_port, dst_port, 0, ack, FLAG_RST | FLAG_ACK);
+  }
+}
+
+void Protocol::send(const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip,
+                    uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack,
+                    uint8_t flags, uint16_t mss) {
+  uint8_t *segment = tx_buffer + IPv4::Protocol::HEADROOM;
+  size_t segment_len = sizeof(Header) + (mss ? 4 : 0);
+
+  auto *tcp = reinterpret_cast<Header *>(segment);
+  tcp->src_port = htons(src_port);
+  tcp->dst_port = htons(dst_port);
+  tcp->seq = htonl(seq);
+  tcp->ack = htonl(ack);
+  tcp->data_off = (segment_len / 4) << 4;
+  tcp->flags = flags;
+  tcp->window = htons(0xffff);
+  tcp->checksum = 0;
+  tcp->urgent = 0;
+
+  if (mss) {
+    uint8_t *option = segment + sizeof(Header);
+    option[0] = OPT_MSS;
+    option[1] = 4;
+    option[2] = mss >> 8;
+    option[3] = mss & 0xff;
+  }
+
+  tcp->checksum =
+      IPv4::Protocol::checksum(ipv4_handler->address(), dst_ip, IPPROTO_TCP, segment, segment_len);
+
+  log_tcp_segment(src_port, dst_port, seq, ack, flags);
+  Counters::count(Counters::TCP_TX_SEGMENTS);
+  if (flags & FLAG_RST)
+    Counters::count(Counters::TCP_TX_RESETS);
+
+  ipv4_handler->send_in_place(dst_mac, dst_ip, IPPROTO_TCP, segment, segment_len);
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include "../clock.h"
+#include "../layer_link/ethernet.h"
+#include "../layer_internet/ipv4.h"
+#include "syncookie.h"
+
+#include <bitset>
+#include <memory>
+#include <vector>
+
+namespace TCP {
+struct Header {
+  uint16_t src_port; /* source port */
+  uint16_t dst_port; /* destination port */
+  uint32_t seq;      /* sequence number */
+  uint32_t ack;      /* acknowledgement number */
+  uint8_t data_off;  /* data offset in the upper 4 bits */
+  uint8_t flags;
+  uint16_t window;
+  uint16_t checksum;
+  uint16_t urgent; /* urgent pointer */
+} __attribute__((__packed__));
+
+enum { FLAG_FIN = 0x01, FLAG_SYN = 0x02, FLAG_RST = 0x04, FLAG_PSH = 0x08, FLAG_ACK = 0x10 };
+
+// Established connection. Half-open connections never get an entry, see SynCookies.
+struct Connection {
+  IPv4::Address peer_ip;
+  IPv4::Address local_ip;
+  uint16_t peer_port; // host byte order
+  uint16_t local_port;
+  uint32_t snd_nxt; // next sequence number we send
+  uint32_t rcv_nxt; // next sequence number we expect
+  uint8_t state;
+  uint16_t app;       // per connection slot of the application, if any
+  uint64_t last_seen; // capture time of the last segment
+};
+static_assert(sizeof(Connection) == 32, "connection entries should stay compact");
+
+enum { STATE_FREE = 0, STATE_ESTABLISHED, STATE_LAST_ACK };
+
+// Fixed size open addressing table with linear probing. Entries are stored inline, so a lookup
+// usually touches a single cache line. Deletion shifts following entries back instead of leaving
+// tombstones.
+class ConnectionTable {
+public:
+  ConnectionTable(size_t capacity_log2)
+      : entries((size_t)1 << capacity_log2), mask(((size_t)1 << capacity_log2) - 1) {}
+
+  Connection *find(const IPv4::Address &peer_ip, uint16_t peer_port,
+                   const IPv4::Address &local_ip, uint16_t local_port);
+
+  // Returns nullptr if the table is (almost) full.
+  Connection *insert(const IPv4::Address &peer_ip, uint16_t peer_port,
+                     const IPv4::Address &local_ip, uint16_t local_port);
+
+  void erase(Connection *conn);
+
+  // Check the connections in the next count slots, continuing where the previous call stopped.
+  // expired is called with each and returns true to have it removed.
+  template <typename Expired> void expire(size_t count, Expired expired);
+
+  size_t size() const { return used; }
+  size_t capacity() const { return entries.size(); }
+
+private:
+  std::vector<Connection> entries;
+  size_t mask;
+  size_t used = 0;
+  size_t next_expire = 0; // slot
+
+  size_t slot(const IPv4::Address &peer_ip, uint16_t peer_port, const IPv4::Address &local_ip,
+              uint16_t local_port) const {
+    uint64_t key = (uint64_t)peer_ip.s_addr << 32 | (uint32_t)peer_port << 16 | local_port;
+    key ^= (uint64_t)local_ip.s_addr * 0x9e3779b97f4a7c15ULL;
+    key *= 0xff51afd7ed558ccdULL;
+    return (key ^ key >> 32) & mask;
+  }
+};
+
+template <typename Expired> void ConnectionTable::expire(size_t count, Expired expired) {
+  for (size_t n = 0; n < count && n < entries.size(); n++) {
+    Connection &conn = entries[next_expire];
+    // erasing moves a following entry into the slot, it is checked next
+    if (conn.state != STATE_FREE && expired(conn))
+      erase(&conn);
+    else
+      next_expire = (next_expire + 1) & mask;
+  }
+}
+
+// Receiver of the byte stream of connections on a listening port.
+class Application {
+public:
+  virtual ~Application() = default;
+  virtual void accept(Connection &conn) = 0;
+  virtual void receive(Connection &conn, const uint8_t *data, size_t len) = 0;
+  virtual void close(Connection &conn) = 0;
+};
+
+class Protocol {
+private:
+  IPv4::Protocol *ipv4_handler;
+  SynCookies cookies;
+  ConnectionTable connections;
+
+  std::bitset<1 << 16> listening;
+  std::vector<Application *> applications;
+
+  uint64_t idle_timeout = DEFAULT_IDLE_TIMEOUT;
+  uint64_t last_expire = 0; // time the sweep has caught up with
+
+  // headroom for the lower layers plus the largest segment we send (header and MSS option)
+  uint8_t tx_buffer[IPv4::Protocol::HEADROOM + sizeof(Header) + 4];
+
+  void send(const Ethernet::Address &dst_mac, const IPv4::Address &dst_ip, uint16_t src_port,
+            uint16_t dst_port, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t mss = 0);
+
+  void reset(const Ethernet::Address &src_mac, const IPv4::Address &src_ip, const Header *tcp,
+             size_t payload_len);
+
+  void handle_segment(Connection &conn, const Ethernet::Address &src_mac, const Header *tcp,
+                      const uint8_t *payload, size_t payload_len);
+
+  // Close conn if it was idle for too long at now, the caller removes it.
+  bool expired(Connection &conn, uint64_t now);
+
+public:
+  static constexpr size_t TABLE_SIZE_LOG2 = 16;
+  static constexpr uint16_t MSS = 1460;
+  static constexpr uint64_t DEFAULT_IDLE_TIMEOUT = 300 * Clock::NS_PER_SEC;
+  // our FIN is never retransmitted, a lost final ACK only leaves the entry behind
+  static constexpr uint64_t LAST_ACK_TIMEOUT = 10 * Clock::NS_PER_SEC;
+
+  Protocol(IPv4::Protocol *handler)
+      : ipv4_handler(handler), connections(TABLE_SIZE_LOG2), applications(1 << 16) {}
+
+  // Accept connections on port. The application, if any, receives their data.
+  void listen(uint16_t port, Application *app = nullptr) {
+    listening.set(port);
+    applications[port] = app;
+  }
+
+  void set_cookie_secret(const uint8_t secret[16]) { cookies.set_secret(secret); }
+
+  // Connections without a segment for this long are closed and removed, LAST_ACK ones after
+  // LAST_ACK_TIMEOUT at the latest.
+  void set_idle_timeout(uint64_t timeout) { idle_timeout = timeout; }
+
+  // Remove the idle connections. The table is swept once per quarter of the idle timeout of
+  // capture time, every call checks the share of the slots that the time since the previous one
+  // stands for, so that a busy stack checks a few slots per call.
+  void expire(uint64_t now);
+
+  void handle_packet(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+                     const IPv4::Address &dst_ip, const uint8_t *buffer, size_t buffer_len);
+
+  const ConnectionTable &connection_table() const { return connections; }
+};
+} // namespace TCP
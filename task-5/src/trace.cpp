@@ -0,0 +1,69 @@
+#include "trace.h"
+
+#ifdef PINGER_LATENCY_TRACE
+#include "clock.h"
+
+#include <csignal>
+#include <cstdio>
+
+thread_local uint64_t Trace::rx_start = 0;
+std::atomic<uint64_t> Trace::counts[POINTS][Histogram::SIZE];
+
+static const char *POINT_NAMES[Trace::POINTS] = {"arp", "ipv4", "icmp", "udp", "tcp", "tx", "done"};
+
+// calibrated in init()
+static double ns_per_cycle = 1;
+
+static volatile sig_atomic_t dump_requested = 0;
+
+static void request_dump(int) { dump_requested = 1; }
+
+void Trace::init() {
+  // count cycles over 20 ms of the monotonic clock
+  uint64_t start_ns = Clock::monotonic();
+  uint64_t start = cycles();
+  while (Clock::monotonic() - start_ns < Clock::NS_PER_SEC / 50)
+    ;
+  ns_per_cycle = (double)(Clock::monotonic() - start_ns) / (cycles() - start);
+
+  struct sigaction action = {};
+  action.sa_handler = request_dump;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, nullptr);
+}
+
+const char *Trace::name(Point point) { return POINT_NAMES[point]; }
+
+double Trace::nanoseconds(uint64_t cycles) { return cycles * ns_per_cycle; }
+
+void Trace::poll() {
+  if (dump_requested) {
+    dump_requested = 0;
+    dump();
+  }
+}
+
+void Trace::dump() {
+  fprintf(stderr, "%-6s %12s %10s %10s %10s %10s %10s   (ns since RX)\n", "point", "count", "p50",
+          "p90", "p99", "p99.9", "max");
+  for (size_t point = 0; point < POINTS; point++) {
+    Histogram histogram;
+    uint64_t max = 0;
+    for (size_t i = 0; i < Histogram::SIZE; i++) {
+      uint64_t count = counts[point][i].load(std::memory_order_relaxed);
+      if (count) {
+        histogram.record(Histogram::highest_value(i), count);
+        max = Histogram::highest_value(i);
+      }
+    }
+    if (!histogram.count())
+      continue;
+
+    auto ns = [](uint64_t cycles) { return (unsigned long)(cycles * ns_per_cycle); };
+    fprintf(stderr, "%-6s %12lu %10lu %10lu %10lu %10lu %10lu\n", POINT_NAMES[point],
+            (unsigned long)histogram.count(), ns(histogram.percentile(50)),
+            ns(histogram.percentile(90)), ns(histogram.percentile(99)),
+            ns(histogram.percentile(99.9)), ns(max));
+  }
+}
+#endif
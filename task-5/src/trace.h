@@ -0,0 +1,78 @@
+#pragma once
+// Per packet latency trace, compiled in with the CMake option PINGER_LATENCY_TRACE.
+//
+// TRACE_RX() reads the timestamp counter when a frame enters the stack, TRACE_POINT(point) adds
+// the cycles elapsed since then to the histogram of point and TRACE_END() closes the frame.
+// Without the option the macros expand to nothing and the functions are empty inlines, so a
+// production build pays nothing.
+#include "histogram.h"
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef PINGER_LATENCY_TRACE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#else
+#include "clock.h"
+#endif
+#endif
+
+namespace Trace {
+// layer boundaries, each one is recorded when a frame is handed to the next layer
+enum Point {
+  POINT_ARP,
+  POINT_IPV4,
+  POINT_ICMP,
+  POINT_UDP,
+  POINT_TCP,
+  POINT_TX,   // a frame is handed to the driver
+  POINT_DONE, // the stack returns from a frame
+  POINTS
+};
+
+#ifdef PINGER_LATENCY_TRACE
+extern thread_local uint64_t rx_start; // 0 outside of a frame
+
+// Histograms are shared by all threads, the buckets are counted with relaxed atomics.
+extern std::atomic<uint64_t> counts[POINTS][Histogram::SIZE];
+
+inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return Clock::monotonic();
+#endif
+}
+
+inline void record(Point point) {
+  if (rx_start)
+    counts[point][Histogram::index(cycles() - rx_start)].fetch_add(1, std::memory_order_relaxed);
+}
+
+#define TRACE_RX() (Trace::rx_start = Trace::cycles())
+#define TRACE_POINT(point) Trace::record(Trace::point)
+#define TRACE_END() (Trace::rx_start = 0)
+
+// Calibrate the counter against the monotonic clock and dump on SIGUSR1.
+void init();
+
+// Dump if SIGUSR1 arrived since the last call.
+void poll();
+
+// Name of a point and the calibrated duration of a number of cycles, for exporting counts.
+const char *name(Point point);
+double nanoseconds(uint64_t cycles);
+
+// Print the percentiles of every point in nanoseconds to stderr.
+void dump();
+#else
+#define TRACE_RX() ((void)0)
+#define TRACE_POINT(point) ((void)0)
+#define TRACE_END() ((void)0)
+
+inline void init() {}
+inline void poll() {}
+inline void dump() {}
+#endif
+} // namespace Trace
@@ -0,0 +1,278 @@
+#include "traffic.h"
+#include "fixed_tables.h"
+#include "header_view.h"
+#include "logging.h"
+#include "layer_internet/ipv4.h"
+#include "layer_link/ethernet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+using namespace Traffic;
+
+constexpr size_t SpaceSaving::K;
+constexpr size_t SpaceSaving::BUCKETS;
+constexpr size_t SpaceSaving::SLOTS;
+constexpr unsigned HyperLogLog::PRECISION;
+constexpr size_t HyperLogLog::REGISTERS;
+constexpr size_t Summary::TYPES;
+
+// the index slot comes from the low bits of the hash, the bucket from the high ones
+static size_t bucket(uint64_t hash) { return (hash >> 32) & (SpaceSaving::BUCKETS - 1); }
+
+size_t SpaceSaving::find(uint32_t key, uint64_t hash) const {
+  size_t slot = hash & (SLOTS - 1);
+  while (index[slot] && entries[index[slot] - 1].key != key)
+    slot = (slot + 1) & (SLOTS - 1);
+  return slot;
+}
+
+void SpaceSaving::remove(size_t slot) {
+  // move the following entries of the probe back into the hole, unless they would land before
+  // their home slot
+  index[slot] = 0;
+  for (size_t next = (slot + 1) & (SLOTS - 1); index[next]; next = (next + 1) & (SLOTS - 1)) {
+    size_t home = Fixed::mix(entries[index[next] - 1].key) & (SLOTS - 1);
+    if (((next - home) & (SLOTS - 1)) >= ((next - slot) & (SLOTS - 1))) {
+      place(index[next] - 1, slot);
+      index[next] = 0;
+      slot = next;
+    }
+  }
+}
+
+void SpaceSaving::place(size_t entry, size_t slot) {
+  index[slot] = entry + 1;
+  slot_of[entry] = slot;
+}
+
+void SpaceSaving::swap(size_t a, size_t b) {
+  std::swap(entries[a], entries[b]);
+  size_t slot_a = slot_of[a];
+  place(a, slot_of[b]);
+  place(b, slot_a);
+}
+
+void SpaceSaving::sift_up(size_t entry) {
+  while (entry > 0 && entries[entry].count < entries[(entry - 1) / 2].count) {
+    swap(entry, (entry - 1) / 2);
+    entry = (entry - 1) / 2;
+  }
+}
+
+void SpaceSaving::sift_down(size_t entry) {
+  for (size_t child; (child = 2 * entry + 1) < used; entry = child) {
+    if (child + 1 < used && entries[child + 1].count < entries[child].count)
+      child++;
+    if (entries[entry].count <= entries[child].count)
+      break;
+    swap(entry, child);
+  }
+}
+
+void SpaceSaving::add(uint32_t key, uint64_t weight) {
+  uint64_t hash = Fixed::mix(key);
+  size_t slot = find(key, hash);
+  if (index[slot]) {
+    size_t entry = index[slot] - 1;
+    entries[entry].count += weight;
+    sift_down(entry);
+    return;
+  }
+  uint64_t &bucket_weight = buckets[bucket(hash)];
+  if (used == K && bucket_weight + weight <= entries[0].count) {
+    bucket_weight += weight;
+    return;
+  }
+
+  Entry entry = {key, bucket_weight + weight, bucket_weight};
+  if (used < K) {
+    entries[used] = entry;
+    place(used, slot);
+    sift_up(used++);
+    return;
+  }
+  // the lowest counter is the top of the heap
+  uint64_t &evicted = buckets[bucket(Fixed::mix(entries[0].key))];
+  evicted = std::max(evicted, entries[0].count);
+  remove(slot_of[0]);
+  entries[0] = entry;
+  place(0, find(key, hash));
+  sift_down(0);
+}
+
+void SpaceSaving::add(const SpaceSaving &other) {
+  // A key without a counter had at most the weight of its bucket, which the merged count and error
+  // include. Of the union the K highest counts are kept, as in the mergeable summaries of Agarwal
+  // et al., the others go to their buckets.
+  std::vector<Entry> merged;
+  for (size_t i = 0; i < used; i++) {
+    Entry entry = entries[i];
+    uint64_t hash = Fixed::mix(entry.key);
+    size_t slot = other.find(entry.key, hash);
+    if (other.index[slot]) {
+      entry.count += other.entries[other.index[slot] - 1].count;
+      entry.error += other.entries[other.index[slot] - 1].error;
+    } else {
+      entry.count += other.buckets[bucket(hash)];
+      entry.error += other.buckets[bucket(hash)];
+    }
+    merged.push_back(entry);
+  }
+  for (size_t i = 0; i < other.used; i++) {
+    const Entry &entry = other.entries[i];
+    uint64_t hash = Fixed::mix(entry.key);
+    if (!index[find(entry.key, hash)])
+      merged.push_back({entry.key, entry.count + buckets[bucket(hash)],
+                        entry.error + buckets[bucket(hash)]});
+  }
+  uint64_t sums[BUCKETS];
+  for (size_t i = 0; i < BUCKETS; i++)
+    sums[i] = buckets[i] + other.buckets[i];
+
+  std::sort(merged.begin(), merged.end(),
+            [](const Entry &a, const Entry &b) { return a.count > b.count; });
+  for (size_t i = K; i < merged.size(); i++) {
+    uint64_t &evicted = sums[bucket(Fixed::mix(merged[i].key))];
+    evicted = std::max(evicted, merged[i].count);
+  }
+  if (merged.size() > K)
+    merged.resize(K);
+
+  reset();
+  memcpy(buckets, sums, sizeof(buckets));
+  // ascending counts are a heap already
+  for (auto entry = merged.rbegin(); entry != merged.rend(); ++entry) {
+    entries[used] = *entry;
+    place(used++, find(entry->key, Fixed::mix(entry->key)));
+  }
+}
+
+std::vector<SpaceSaving::Entry> SpaceSaving::top(size_t n) const {
+  std::vector<Entry> sorted(entries, entries + used);
+  // ties by key, so that the order does not depend on the order of arrival
+  std::sort(sorted.begin(), sorted.end(), [](const Entry &a, const Entry &b) {
+    return a.count != b.count ? a.count > b.count : a.key < b.key;
+  });
+  if (sorted.size() > n)
+    sorted.resize(n);
+  return sorted;
+}
+
+void SpaceSaving::reset() {
+  used = 0;
+  memset(index, 0, sizeof(index));
+  memset(buckets, 0, sizeof(buckets));
+}
+
+uint64_t HyperLogLog::estimate() const {
+  double sum = 0;
+  size_t zeros = 0;
+  for (uint8_t rank : registers) {
+    sum += std::ldexp(1.0, -rank);
+    zeros += rank == 0;
+  }
+  double m = REGISTERS;
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  // the raw estimate is biased for small sets, counting the empty registers is not
+  if (estimate <= 2.5 * m && zeros)
+    estimate = m * std::log(m / zeros);
+  return std::llround(estimate);
+}
+
+void HyperLogLog::add(const HyperLogLog &other) {
+  for (size_t i = 0; i < REGISTERS; i++)
+    registers[i] = std::max(registers[i], other.registers[i]);
+}
+
+void HyperLogLog::reset() { memset(registers, 0, sizeof(registers)); }
+
+static void add_totals(Totals &to, uint64_t frames, uint64_t bytes) {
+  to.frames += frames;
+  to.bytes += bytes;
+}
+
+Totals &Summary::type_totals(uint16_t type) {
+  for (size_t i = 0; i < types_used; i++) {
+    if (types[i].type == type)
+      return types[i].totals;
+  }
+  if (types_used == TYPES)
+    return rest;
+  types[types_used] = {type, {0, 0}};
+  return types[types_used++].totals;
+}
+
+void Summary::add(const uint8_t *frame, size_t len) {
+  add_totals(all, 1, len);
+  if (len < sizeof(Ethernet::Header))
+    return;
+  uint16_t type = HeaderView::get<Ethernet::Fields::Type>(frame);
+  add_totals(type_totals(type), 1, len);
+  size_t payload_len = len - sizeof(Ethernet::Header);
+  payload.record(payload_len);
+
+  const uint8_t *ip = frame + sizeof(Ethernet::Header);
+  if (type != Ethernet::TYPE_IP || payload_len < sizeof(IPv4::Header) ||
+      HeaderView::get<IPv4::Fields::Version>(ip) != 4)
+    return;
+  add_totals(protocols[HeaderView::get<IPv4::Fields::Protocol>(ip)], 1, len);
+  uint32_t source = HeaderView::get<IPv4::Fields::Source>(ip).s_addr;
+  sources.add(source, len);
+  distinct.add(Fixed::mix(source));
+}
+
+void Summary::add(const Summary &other) {
+  add_totals(all, other.all.frames, other.all.bytes);
+  for (size_t i = 0; i < other.types_used; i++)
+    add_totals(type_totals(other.types[i].type), other.types[i].totals.frames,
+               other.types[i].totals.bytes);
+  add_totals(rest, other.rest.frames, other.rest.bytes);
+  for (size_t i = 0; i < 256; i++)
+    add_totals(protocols[i], other.protocols[i].frames, other.protocols[i].bytes);
+  sources.add(other.sources);
+  distinct.add(other.distinct);
+  payload.add(other.payload);
+}
+
+void Summary::reset() {
+  all = {};
+  types_used = 0;
+  rest = {};
+  memset(protocols, 0, sizeof(protocols));
+  sources.reset();
+  distinct.reset();
+  payload.reset();
+}
+
+void Recorder::add(const uint8_t *frame, size_t len, uint64_t timestamp) {
+  tick(timestamp);
+  if (!current.total().frames)
+    begin = interval ? timestamp - timestamp % interval : timestamp;
+  current.add(frame, len);
+  last = std::max(last, timestamp);
+}
+
+void Recorder::tick(uint64_t now) {
+  if (!interval || !current.total().frames || now < begin + interval)
+    return;
+  log_traffic_report(begin, begin + interval, current);
+  current.reset();
+}
+
+void Traffic::report(const std::vector<const Recorder *> &recorders) {
+  // some 50 KB, kept off the stack
+  auto merged = std::make_unique<Summary>();
+  uint64_t start = UINT64_MAX, end = 0;
+  for (const Recorder *recorder : recorders) {
+    if (!recorder->summary().total().frames)
+      continue;
+    merged->add(recorder->summary());
+    start = std::min(start, recorder->start());
+    end = std::max(end, recorder->end());
+  }
+  if (merged->total().frames)
+    log_traffic_report(start, end, *merged);
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include "histogram.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Traffic {
+// The heaviest keys of a weighted stream in constant memory, the Filtered Space-Saving of Homem and
+// Carvalho.
+//
+// K counters are kept, every key without one adds its weight to one of BUCKETS buckets picked by
+// its hash instead. A key takes over the lowest counter once the weight of its bucket exceeds it,
+// starting at that weight as its error, and the weight of the key it replaces goes to the bucket
+// of that one. So a count is never below the true one and exceeds it by at most the error, every
+// key with more than total / K of the weight has a counter, and keys seen once or twice, like
+// those of spoofed sources, rarely displace a counter. Keys are found through an open addressing
+// index. The counters form a min-heap by count, so the lowest one is at the top and a counter that
+// grows sinks a few levels at most.
+class SpaceSaving {
+public:
+  static constexpr size_t K = 64;
+  static constexpr size_t BUCKETS = 16 * K;
+
+  struct Entry {
+    uint32_t key;
+    uint64_t count;
+    uint64_t error; // the true count is at least count - error
+  };
+
+  void add(uint32_t key, uint64_t weight);
+
+  // Add the counters of other, the bounds then hold for both streams together.
+  void add(const SpaceSaving &other);
+
+  // Up to n entries, the highest counts first.
+  std::vector<Entry> top(size_t n) const;
+
+  void reset();
+
+private:
+  static constexpr size_t SLOTS = 2 * K; // of the index, a power of two
+
+  Entry entries[K]; // the heap
+  uint8_t slot_of[K]; // in the index, of each entry
+  size_t used = 0;
+  uint8_t index[SLOTS] = {}; // entry + 1, 0 if the slot is empty
+  uint64_t buckets[BUCKETS] = {}; // at least the weight of every key without a counter in them
+
+  size_t find(uint32_t key, uint64_t hash) const; // slot of key or the empty slot ending its probe
+  void remove(size_t slot);
+  void place(size_t entry, size_t slot);
+  void swap(size_t a, size_t b);
+  void sift_up(size_t entry);
+  void sift_down(size_t entry);
+};
+
+// Number of distinct keys in constant memory, the HyperLogLog of Flajolet et al. with linear
+// counting for small sets. 2^PRECISION one byte registers, the standard error is
+// 1.04 / sqrt(2^PRECISION), 1.6%.
+class HyperLogLog {
+public:
+  static constexpr unsigned PRECISION = 12;
+  static constexpr size_t REGISTERS = (size_t)1 << PRECISION;
+
+  // hash has to be uniform over all 64 bits
+  void add(uint64_t hash) {
+    size_t index = hash >> (64 - PRECISION);
+    // position of the first set bit in the rest, the sentinel bit bounds it
+    uint8_t rank = __builtin_clzll(hash << PRECISION | (uint64_t)1 << (PRECISION - 1)) + 1;
+    if (rank > registers[index])
+      registers[index] = rank;
+  }
+
+  uint64_t estimate() const;
+
+  void add(const HyperLogLog &other);
+  void reset();
+
+private:
+  uint8_t registers[REGISTERS] = {};
+};
+
+struct Totals {
+  uint64_t frames;
+  uint64_t bytes; // frame lengths
+};
+
+// Totals and sketches of the frames of an interval, the memory does not depend on the traffic.
+//
+// Frames are totalled per EtherType, the first TYPES types get a total of their own and the rest
+// is counted as other. IPv4 packets are also totalled per protocol, and their source addresses
+// feed the top talkers by bytes and the count of distinct sources. The payload sizes are those
+// of the Ethernet frames.
+class Summary {
+public:
+  static constexpr size_t TYPES = 8;
+
+  struct Type {
+    uint16_t type;
+    Totals totals;
+  };
+
+  void add(const uint8_t *frame, size_t len);
+
+  void add(const Summary &other);
+  void reset();
+
+  const Totals &total() const { return all; }
+  size_t type_count() const { return types_used; }
+  const Type &type(size_t i) const { return types[i]; }
+  const Totals &other_types() const { return rest; }
+  const Totals &protocol(uint8_t protocol) const { return protocols[protocol]; }
+  const SpaceSaving &talkers() const { return sources; }
+  uint64_t distinct_sources() const { return distinct.estimate(); }
+  const Histogram &payload_sizes() const { return payload; }
+
+private:
+  Totals all = {};
+  Type types[TYPES];
+  size_t types_used = 0;
+  Totals rest = {}; // of the types without a total of their own
+  Totals protocols[256] = {};
+  SpaceSaving sources;
+  HyperLogLog distinct;
+  Histogram payload;
+
+  Totals &type_totals(uint16_t type); // rest if all TYPES are taken
+};
+
+// Summaries of consecutive intervals of capture time, each logged once a frame after its end is
+// added or tick passes it. Intervals start at multiples of the interval since the epoch, so that
+// the records of different runs line up, intervals without frames are not logged. Without an
+// interval everything is summarized for report.
+class Recorder {
+public:
+  explicit Recorder(uint64_t interval) : interval(interval) {}
+
+  void add(const uint8_t *frame, size_t len, uint64_t timestamp);
+
+  // Log the current interval if now is past its end, lets an idle live capture report.
+  void tick(uint64_t now);
+
+  // The frames since the last record and the times they cover.
+  const Summary &summary() const { return current; }
+  uint64_t start() const { return begin; }
+  uint64_t end() const { return interval ? begin + interval : last; }
+
+private:
+  Summary current;
+  uint64_t interval;
+  uint64_t begin = 0; // of the current interval or the first frame without interval
+  uint64_t last = 0;  // frame
+};
+
+// Log what the recorders summarized since their last record as one record, the intervals of the
+// multi-threaded modes merged.
+void report(const std::vector<const Recorder *> &recorders);
+} // namespace Traffic
@@ -0,0 +1,137 @@
+#include "udp.h"
+#include "../counters.h"
+#include "../logging.h"
+
+#include <cstring>
+
+using namespace UDP;
+
+// port 0 and echo, daytime, chargen and time
+static bool is_reflector(uint16_t port) {
+  return port == 0 || port == 7 || port == 13 || port == 19 || port == 37;
+}
+
+size_t Socket::recv(Datagram *dgrams, size_t count) {
+  size_t received = 0;
+  while (received < count && head != tail)
+    dgrams[received++] = queue[head++ % queue.size()];
+  return received;
+}
+
+size_t Socket::send(Datagram *dgrams, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    dgrams[i].local_port = port;
+    udp_handler->send(dgrams[i]);
+  }
+  return count;
+}
+
+void Socket::release(Datagram *dgrams, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    udp_handler->buffers().free(dgrams[i].buffer);
+}
+
+bool Socket::alloc(Datagram &dgram) {
+  int32_t buffer = udp_handler->buffers().alloc();
+  if (buffer < 0)
+    return false;
+
+  memset(&dgram, 0, sizeof(dgram));
+  dgram.local_port = port;
+  dgram.buffer = buffer;
+  dgram.payload = udp_handler->buffers().data(buffer) + HEADROOM;
+  return true;
+}
+
+Socket *Protocol::bind(uint16_t port, size_t queue_len) {
+  if (sockets[port])
+    return nullptr;
+  sockets[port] = std::make_unique<Socket>(this, port, queue_len);
+  return sockets[port].get();
+}
+
+void Protocol::handle_packet(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+                             const IPv4::Address &dst_ip, const uint8_t *buffer,
+                             size_t buffer_len) {
+  auto *udp = reinterpret_cast<const Header *>(buffer);
+  size_t udp_len = buffer_len < sizeof(Header) ? 0 : ntohs(udp->length);
+  if (udp_len < sizeof(Header) || udp_len > buffer_len) {
+    Counters::count(Counters::UDP_DROP_MALFORMED);
+    return;
+  }
+
+  // a zero checksum means the sender did not compute one
+  if (udp->checksum && IPv4::Protocol::checksum(src_ip, dst_ip, IPPROTO_UDP, buffer, udp_len)) {
+    Counters::count(Counters::UDP_DROP_CHECKSUM);
+    return;
+  }
+  Counters::count(Counters::UDP_RX_DATAGRAMS);
+
+  uint16_t src_port = ntohs(udp->src_port);
+  uint16_t dst_port = ntohs(udp->dst_port);
+  log_udp_datagram(src_port, dst_port, udp_len);
+
+  Socket *socket = sockets[dst_port].get();
+  if (!socket) {
+    Counters::count(Counters::UDP_DROP_NO_PORT);
+    return;
+  }
+  if (socket->reflectors_refused && is_reflector(src_port)) {
+    Counters::count(Counters::UDP_DROP_REFLECTOR);
+    return;
+  }
+
+  size_t payload_len = udp_len - sizeof(Header);
+  if (HEADROOM + payload_len > BufferPool::BUFFER_SIZE) {
+    Counters::count(Counters::UDP_DROP_TOO_LARGE);
+    return;
+  }
+
+  // the capture buffer is only valid during this call, copy the payload out once
+  int32_t index = pool.alloc();
+  if (index < 0) {
+    Counters::count(Counters::UDP_DROP_QUEUE);
+    return;
+  }
+
+  Datagram dgram;
+  dgram.peer_mac = src_mac;
+  dgram.peer_ip = src_ip;
+  dgram.peer_port = src_port;
+  dgram.local_port = dst_port;
+  dgram.payload = pool.data(index) + HEADROOM;
+  dgram.payload_len = payload_len;
+  dgram.buffer = index;
+  memcpy(dgram.payload, buffer + sizeof(Header), payload_len);
+
+  if (!socket->enqueue(dgram)) {
+    Counters::count(Counters::UDP_DROP_QUEUE);
+    pool.free(index);
+  }
+}
+
+void Protocol::send(Datagram &dgram) {
+  size_t udp_len = sizeof(Header) + dgram.payload_len;
+  if (HEADROOM + dgram.payload_len > BufferPool::BUFFER_SIZE) {
+    pool.free(dgram.buffer);
+    return;
+  }
+
+  auto *udp = reinterpret_cast<Header *>(dgram.payload - sizeof(Header));
+  udp->src_port = htons(dgram.local_port);
+  udp->dst_port = htons(dgram.peer_port);
+  udp->length = htons(udp_len);
+  udp->checksum = 0;
+
+  uint16_t sum = IPv4::Protocol::checksum(ipv4_handler->address(), dgram.peer_ip, IPPROTO_UDP,
+                                          udp, udp_len);
+  // zero is reserved for "no checksum", transmit its one's complement equivalent
+  udp->checksum = sum ? sum : 0xffff;
+
+  log_udp_datagram(dgram.local_port, dgram.peer_port, udp_len);
+  Counters::count(Counters::UDP_TX_DATAGRAMS);
+
+  ipv4_handler->send_in_place(dgram.peer_mac, dgram.peer_ip, IPPROTO_UDP,
+                              reinterpret_cast<uint8_t *>(udp), udp_len);
+  pool.free(dgram.buffer);
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "../buffer_pool.h"
+#include "../layer_link/ethernet.h"
+#include "../layer_internet/ipv4.h"
+
+#include <memory>
+#include <vector>
+
+namespace UDP {
+struct Header {
+  uint16_t src_port; /* source port */
+  uint16_t dst_port; /* destination port */
+  uint16_t length;   /* length of header and data */
+  uint16_t checksum;
+} __attribute__((__packed__));
+
+// Space in front of a datagram payload which is reserved for the headers of all layers.
+constexpr size_t HEADROOM = IPv4::Protocol::HEADROOM + sizeof(Header);
+
+// Descriptor of one datagram, in the spirit of struct mmsghdr. The payload is not copied out of
+// the stack: it points into a stack owned buffer which stays valid until the descriptor is passed
+// back through Socket::send or Socket::release.
+struct Datagram {
+  Ethernet::Address peer_mac;
+  IPv4::Address peer_ip;
+  uint16_t peer_port;  // host byte order
+  uint16_t local_port; // host byte order
+  uint8_t *payload;
+  size_t payload_len;
+  int32_t buffer;
+};
+
+class Protocol;
+
+// Receive queue of a bound port.
+class Socket {
+public:
+  Socket(Protocol *handler, uint16_t port, size_t queue_len)
+      : udp_handler(handler), port(port), queue(queue_len) {}
+
+  // Dequeue up to count received datagrams. Returns the number of descriptors filled in.
+  size_t recv(Datagram *dgrams, size_t count);
+
+  // Send count datagrams to their peers and return their buffers to the stack. The payload may
+  // have been modified in place, payload_len may change up to the buffer size.
+  size_t send(Datagram *dgrams, size_t count);
+
+  // Return buffers to the stack without sending.
+  void release(Datagram *dgrams, size_t count);
+
+  // Get a buffer for a new datagram originating from this socket. The caller fills in the peer
+  // and the payload and then passes the descriptor to send.
+  bool alloc(Datagram &dgram);
+
+  uint16_t local_port() const { return port; }
+
+  // Drop datagrams from port 0, which cannot be answered, and from the well known ports of
+  // services that answer anything (echo, daytime, chargen, time). A socket answering every
+  // datagram would otherwise keep bouncing them with such a service that a spoofed one points it
+  // at.
+  void refuse_reflectors() { reflectors_refused = true; }
+
+private:
+  friend class Protocol;
+
+  Protocol *udp_handler;
+  uint16_t port;
+  bool reflectors_refused = false;
+
+  // ring of received datagrams
+  std::vector<Datagram> queue;
+  size_t head = 0;
+  size_t tail = 0;
+
+  bool enqueue(const Datagram &dgram) {
+    if (tail - head == queue.size())
+      return false;
+    queue[tail++ % queue.size()] = dgram;
+    return true;
+  }
+};
+
+// Application running on top of one or more sockets. Services are polled after every burst of
+// received frames so that they can process everything that was queued in one batch.
+class Service {
+public:
+  virtual ~Service() = default;
+  virtual void poll() = 0;
+};
+
+class Protocol {
+private:
+  IPv4::Protocol *ipv4_handler;
+  BufferPool pool;
+
+  // port based dispatch, indexed by the destination port in host byte order
+  std::vector<std::unique_ptr<Socket>> sockets;
+  std::vector<std::unique_ptr<Service>> services;
+
+public:
+  static constexpr size_t POOL_SIZE = 1024;
+  static constexpr size_t QUEUE_LEN = 256;
+
+  Protocol(IPv4::Protocol *handler) : ipv4_handler(handler), pool(POOL_SIZE), sockets(1 << 16) {}
+
+  // Bind a port. Returns nullptr if it is already bound.
+  Socket *bind(uint16_t port, size_t queue_len = QUEUE_LEN);
+
+  void add_service(std::unique_ptr<Service> service) { services.push_back(std::move(service)); }
+
+  // Let every service process its queued datagrams.
+  void poll() {
+    for (auto &service : services)
+      service->poll();
+  }
+
+  void handle_packet(const Ethernet::Address &src_mac, const IPv4::Address &src_ip,
+                     const IPv4::Address &dst_ip, const uint8_t *buffer, size_t buffer_len);
+
+  void send(Datagram &dgram);
+
+  BufferPool &buffers() { return pool; }
+};
+
+// RFC 862 echo service. Datagrams are sent back from the buffer they were received in.
+class EchoService : public Service {
+public:
+  static constexpr uint16_t PORT = 7;
+  static constexpr size_t BATCH = 32;
+
+  EchoService(Socket *socket) : socket(socket) { socket->refuse_reflectors(); }
+
+  void poll() override {
+    Datagram batch[BATCH];
+    size_t count;
+    while ((count = socket->recv(batch, BATCH)) > 0)
+      socket->send(batch, count);
+  }
+
+private:
+  Socket *socket;
+};
+} // namespace UDP
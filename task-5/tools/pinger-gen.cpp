@@ -0,0 +1,561 @@
+// Write a capture of synthetic traffic for pinger, for replays and tests too large for git.
+//
+//   pinger-gen -o <file> [-n <frames>] [--format pcap|pcapng] [--seed <n>] [--sources <n>]
+//              [--mix <kind>=<weight>,...] [--sizes <bytes>,...] [--rate <frames per second>]
+//              [--mac <mac address>] [--ip <ip address>]
+//
+// Frames are addressed to --mac/--ip (11:22:33:44:55:66 / 192.168.56.101 like the tests) from
+// --sources peers 10.0.0.1, 10.0.0.2, ... with hardware addresses 02:00:0a:xx:xx:xx. The kind of
+// every frame is drawn by the weights of the mix:
+//
+//   arp        ARP request for our address
+//   echo       ICMP echo request, the payload size is drawn from --sizes
+//   foreign    ICMP echo request to an address in 198.51.100.0/24
+//   vlan       ICMP echo request with an 802.1Q tag
+//   fragment   first or last fragment of a UDP datagram
+//   malformed  runt frame, bad IPv4 version, header length, total length or checksum, truncated
+//              ICMP header or bad ICMP checksum
+//   udp        UDP datagram to port 7, payload size from --sizes
+//   syn        TCP SYN to port 80
+//
+// The default mix is arp=2,echo=80,foreign=4,vlan=4,fragment=4,malformed=6. The same arguments
+// and seed always give the same file. The format follows the extension unless --format is given.
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>     // inet_aton, htons
+#include <fcntl.h>         // open
+#include <netinet/ether.h> // ether_aton_r
+#include <unistd.h>        // write
+
+namespace {
+
+// clang-format off
+#define KIND_LIST(X) \
+  X(ARP,       "arp",       2) \
+  X(ECHO,      "echo",      80) \
+  X(FOREIGN,   "foreign",   4) \
+  X(VLAN,      "vlan",      4) \
+  X(FRAGMENT,  "fragment",  4) \
+  X(MALFORMED, "malformed", 6) \
+  X(UDP,       "udp",       0) \
+  X(SYN,       "syn",       0)
+// clang-format on
+
+enum Kind {
+#define KIND_ENUM(id, name, weight) id,
+  KIND_LIST(KIND_ENUM)
+#undef KIND_ENUM
+      KINDS
+};
+
+const char *const KIND_NAMES[KINDS] = {
+#define KIND_NAME(id, name, weight) name,
+    KIND_LIST(KIND_NAME)
+#undef KIND_NAME
+};
+
+const double DEFAULT_WEIGHTS[KINDS] = {
+#define KIND_WEIGHT(id, name, weight) weight,
+    KIND_LIST(KIND_WEIGHT)
+#undef KIND_WEIGHT
+};
+
+const size_t MAX_FRAME = 14 + 4 + 20 + 8 + 9000;
+const size_t MIN_FRAME = 60; // without the frame check sequence
+const uint64_t START_SECONDS = 1700000000;
+
+// splitmix64, fast and the same everywhere unlike the distributions of <random>
+class Random {
+public:
+  explicit Random(uint64_t seed) : state(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  // uniform in [0, n)
+  uint32_t below(uint32_t n) { return (uint64_t)(uint32_t)next() * n >> 32; }
+
+private:
+  uint64_t state;
+};
+
+// Buffered output in large writes, frames are built in place.
+class Output {
+public:
+  static constexpr size_t SIZE = 8 << 20;
+
+  explicit Output(int fd) : fd(fd), buffer(SIZE) {}
+
+  // Space for size bytes at the end of the buffer.
+  uint8_t *reserve(size_t size) {
+    if (used + size > buffer.size() && !flush())
+      return nullptr;
+    return buffer.data() + used;
+  }
+
+  void commit(size_t size) { used += size; }
+
+  bool flush() {
+    for (size_t done = 0; done < used;) {
+      ssize_t n = write(fd, buffer.data() + done, used - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      done += n;
+    }
+    used = 0;
+    return true;
+  }
+
+private:
+  int fd;
+  std::vector<uint8_t> buffer;
+  size_t used = 0;
+};
+
+uint16_t load16(const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, 2);
+  return v;
+}
+
+// one's complement sum of data in memory order, an odd byte is padded with zero
+uint32_t sum16(const uint8_t *data, size_t len, uint32_t sum = 0) {
+  for (; len > 1; data += 2, len -= 2)
+    sum += load16(data);
+  if (len) {
+    uint8_t last[2] = {*data, 0};
+    sum += load16(last);
+  }
+  return sum;
+}
+
+uint16_t fold(uint64_t sum) {
+  while (sum >> 16)
+    sum = (sum >> 16) + (sum & 0xffff);
+  return ~sum;
+}
+
+void store16(uint8_t *p, uint16_t v) { memcpy(p, &v, 2); }
+void store_be16(uint8_t *p, uint16_t v) { store16(p, htons(v)); }
+
+class Generator {
+public:
+  struct Options {
+    uint8_t mac[6];
+    uint8_t ip[4];
+    size_t sources = 256;
+    std::vector<size_t> sizes = {56};
+    double weights[KINDS];
+  };
+
+  Generator(const Options &options, uint64_t seed) : options(options), random(seed) {
+    double total = 0;
+    for (double weight : options.weights)
+      total += weight;
+    double cumulative = 0;
+    for (size_t i = 0; i < KINDS; i++) {
+      cumulative += options.weights[i];
+      thresholds[i] = cumulative / total * 4294967296.0;
+    }
+    thresholds[KINDS - 1] = 1ull << 32;
+
+    for (size_t i = 0; i < sizeof(payload); i++)
+      payload[i] = i;
+    for (size_t size : options.sizes)
+      payload_sums.push_back(sum16(payload, size));
+  }
+
+  // Build the next frame at p, which has room for MAX_FRAME bytes, and return its length.
+  size_t next(uint8_t *p) {
+    uint32_t draw = (uint32_t)random.next();
+    size_t kind = 0;
+    while (draw >= thresholds[kind])
+      kind++;
+    uint32_t source = random.below(options.sources);
+    sequence++;
+
+    size_t len;
+    switch (kind) {
+    case ARP:
+      len = arp_request(p, source);
+      break;
+    case ECHO:
+    case FOREIGN:
+    case VLAN: {
+      size_t size = random.below(options.sizes.size());
+      uint8_t dst[4] = {198, 51, 100, (uint8_t)random.below(256)};
+      len = echo_request(p, source, kind == FOREIGN ? dst : options.ip, size, kind == VLAN);
+      break;
+    }
+    case FRAGMENT:
+      len = fragment(p, source);
+      break;
+    case MALFORMED:
+      len = malformed(p, source);
+      break;
+    case UDP:
+      len = udp(p, source);
+      break;
+    default:
+      len = syn(p, source);
+      break;
+    }
+    if (len < MIN_FRAME && kind != MALFORMED) {
+      memset(p + len, 0, MIN_FRAME - len);
+      len = MIN_FRAME;
+    }
+    return len;
+  }
+
+private:
+  Options options;
+  Random random;
+  uint64_t thresholds[KINDS];
+  uint8_t payload[9000];
+  std::vector<uint32_t> payload_sums; // of the payload for every size
+  uint16_t sequence = 0;
+
+  static void source_mac(uint8_t *p, uint32_t source) {
+    uint32_t host = source + 1;
+    const uint8_t mac[6] = {0x02, 0, 0x0a, (uint8_t)(host >> 16), (uint8_t)(host >> 8),
+                            (uint8_t)host};
+    memcpy(p, mac, 6);
+  }
+
+  static void source_ip(uint8_t *p, uint32_t source) {
+    uint32_t host = source + 1;
+    const uint8_t ip[4] = {10, (uint8_t)(host >> 16), (uint8_t)(host >> 8), (uint8_t)host};
+    memcpy(p, ip, 4);
+  }
+
+  size_t ethernet(uint8_t *p, uint32_t source, uint16_t type, bool vlan) {
+    memcpy(p, options.mac, 6);
+    source_mac(p + 6, source);
+    if (vlan) {
+      store_be16(p + 12, 0x8100);
+      store_be16(p + 14, 100);
+      p += 4;
+    }
+    store_be16(p + 12, type);
+    return vlan ? 18 : 14;
+  }
+
+  // IPv4 header without options, total is the length including the header
+  size_t ipv4(uint8_t *p, uint32_t source, const uint8_t *dst, uint8_t protocol, size_t total,
+              uint16_t fragment = 0) {
+    p[0] = 0x45;
+    p[1] = 0;
+    store_be16(p + 2, total);
+    store_be16(p + 4, sequence);
+    store_be16(p + 6, fragment);
+    p[8] = 64;
+    p[9] = protocol;
+    store16(p + 10, 0);
+    source_ip(p + 12, source);
+    memcpy(p + 16, dst, 4);
+    store16(p + 10, fold(sum16(p, 20)));
+    return 20;
+  }
+
+  size_t arp_request(uint8_t *p, uint32_t source) {
+    size_t len = ethernet(p, source, 0x0806, false);
+    memset(p, 0xff, 6);
+    uint8_t *arp = p + len;
+    const uint8_t fixed[8] = {0, 1, 8, 0, 6, 4, 0, 1}; // Ethernet, IPv4, request
+    memcpy(arp, fixed, 8);
+    source_mac(arp + 8, source);
+    source_ip(arp + 14, source);
+    memset(arp + 18, 0, 6);
+    memcpy(arp + 24, options.ip, 4);
+    return len + 28;
+  }
+
+  size_t echo_request(uint8_t *p, uint32_t source, const uint8_t *dst, size_t size_index,
+                      bool vlan) {
+    size_t size = options.sizes[size_index];
+    size_t len = ethernet(p, source, 0x0800, vlan);
+    len += ipv4(p + len, source, dst, IPPROTO_ICMP, 20 + 8 + size);
+    uint8_t *icmp = p + len;
+    icmp[0] = 8;
+    icmp[1] = 0;
+    store16(icmp + 2, 0);
+    store_be16(icmp + 4, source);
+    store_be16(icmp + 6, sequence);
+    memcpy(icmp + 8, payload, size);
+    // the payload is the same for every frame of a size, only the header is summed
+    store16(icmp + 2, fold(sum16(icmp, 8, payload_sums[size_index])));
+    return len + 8 + size;
+  }
+
+  size_t udp_header(uint8_t *udp, uint32_t source, const uint8_t *dst, uint16_t port,
+                    size_t size) {
+    store_be16(udp, 1024 + source % 60000);
+    store_be16(udp + 2, port);
+    store_be16(udp + 4, 8 + size);
+    store16(udp + 6, 0);
+    memcpy(udp + 8, payload, size);
+
+    uint8_t pseudo[12];
+    source_ip(pseudo, source);
+    memcpy(pseudo + 4, dst, 4);
+    pseudo[8] = 0;
+    pseudo[9] = IPPROTO_UDP;
+    store_be16(pseudo + 10, 8 + size);
+    uint16_t checksum = fold(sum16(udp, 8 + size, sum16(pseudo, 12)));
+    store16(udp + 6, checksum ? checksum : 0xffff);
+    return 8 + size;
+  }
+
+  size_t udp(uint8_t *p, uint32_t source) {
+    size_t size = std::min<size_t>(options.sizes[random.below(options.sizes.size())], 1472);
+    size_t len = ethernet(p, source, 0x0800, false);
+    len += ipv4(p + len, source, options.ip, IPPROTO_UDP, 20 + 8 + size);
+    return len + udp_header(p + len, source, options.ip, 7, size);
+  }
+
+  // first or last fragment of a UDP datagram with 2992 bytes of payload, which is split at 1480
+  // and 2960 bytes
+  size_t fragment(uint8_t *p, uint32_t source) {
+    size_t len = ethernet(p, source, 0x0800, false);
+    if (random.below(2)) {
+      len += ipv4(p + len, source, options.ip, IPPROTO_UDP, 20 + 1480, 0x2000);
+      uint8_t *udp = p + len;
+      store_be16(udp, 1024 + source % 60000);
+      store_be16(udp + 2, 7);
+      store_be16(udp + 4, 3000);
+      store16(udp + 6, 0); // no checksum, it would cover the other fragments
+      memcpy(udp + 8, payload, 1472);
+      return len + 1480;
+    }
+    len += ipv4(p + len, source, options.ip, IPPROTO_UDP, 20 + 40, 2960 / 8);
+    memcpy(p + len, payload, 40);
+    return len + 40;
+  }
+
+  size_t syn(uint8_t *p, uint32_t source) {
+    size_t len = ethernet(p, source, 0x0800, false);
+    len += ipv4(p + len, source, options.ip, IPPROTO_TCP, 20 + 20);
+    uint8_t *tcp = p + len;
+    store_be16(tcp, 1024 + source % 60000);
+    store_be16(tcp + 2, 80);
+    uint32_t seq = htonl((uint32_t)random.next());
+    memcpy(tcp + 4, &seq, 4);
+    memset(tcp + 8, 0, 4);
+    tcp[12] = 5 << 4;
+    tcp[13] = 0x02; // SYN
+    store_be16(tcp + 14, 65535);
+    memset(tcp + 16, 0, 4);
+
+    uint8_t pseudo[12];
+    source_ip(pseudo, source);
+    memcpy(pseudo + 4, options.ip, 4);
+    pseudo[8] = 0;
+    pseudo[9] = IPPROTO_TCP;
+    store_be16(pseudo + 10, 20);
+    store16(tcp + 16, fold(sum16(tcp, 20, sum16(pseudo, 12))));
+    return len + 20;
+  }
+
+  size_t malformed(uint8_t *p, uint32_t source) {
+    // a well-formed echo request which is then broken in one place
+    size_t len = echo_request(p, source, options.ip, 0, false);
+    uint8_t *ip = p + 14;
+    switch (random.below(7)) {
+    case 0: // runt
+      return 1 + random.below(13);
+    case 1: // IPv6 version in an IPv4 frame
+      ip[0] = 0x65;
+      break;
+    case 2: // header shorter than 20 bytes
+      ip[0] = 0x40 | random.below(5);
+      break;
+    case 3: // total length beyond the frame
+      store_be16(ip + 2, len - 14 + 1 + random.below(1000));
+      break;
+    case 4: // header checksum
+      ip[10] ^= 0x5a;
+      break;
+    case 5: // ICMP header cut short
+      store_be16(ip + 2, 20 + 4);
+      return 14 + 20 + 4;
+    default: // ICMP checksum
+      ip[20 + 2] ^= 0xa5;
+      break;
+    }
+    return len;
+  }
+};
+
+bool parse_mix(const char *spec, double *weights) {
+  for (size_t i = 0; i < KINDS; i++)
+    weights[i] = 0;
+  std::string str = spec;
+  size_t start = 0;
+  while (start <= str.size()) {
+    size_t end = str.find(',', start);
+    if (end == std::string::npos)
+      end = str.size();
+    std::string item = str.substr(start, end - start);
+    size_t equals = item.find('=');
+    if (equals == std::string::npos)
+      return false;
+    std::string name = item.substr(0, equals);
+    char *rest;
+    double weight = strtod(item.c_str() + equals + 1, &rest);
+    if (*rest || weight < 0)
+      return false;
+    size_t kind = 0;
+    while (kind < KINDS && name != KIND_NAMES[kind])
+      kind++;
+    if (kind == KINDS)
+      return false;
+    weights[kind] = weight;
+    start = end + 1;
+  }
+  double total = 0;
+  for (size_t i = 0; i < KINDS; i++)
+    total += weights[i];
+  return total > 0;
+}
+
+bool parse_sizes(const char *spec, std::vector<size_t> &sizes) {
+  sizes.clear();
+  for (const char *p = spec; *p;) {
+    char *end;
+    unsigned long size = strtoul(p, &end, 10);
+    if (end == p || size > 8972 || (*end && *end != ','))
+      return false;
+    sizes.push_back(size);
+    p = *end ? end + 1 : end;
+  }
+  return !sizes.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  const char *format = nullptr;
+  uint64_t frames = 1000000;
+  uint64_t seed = 1;
+  double rate = 1000000;
+  Generator::Options options;
+  ether_aton_r("11:22:33:44:55:66", (ether_addr *)options.mac);
+  inet_aton("192.168.56.101", (in_addr *)options.ip);
+  memcpy(options.weights, DEFAULT_WEIGHTS, sizeof(options.weights));
+
+  bool valid = true;
+  for (int i = 1; i < argc && valid; i++) {
+    int remaining = argc - i;
+    if (remaining < 2) {
+      valid = false;
+    } else if (strcmp("-o", argv[i]) == 0) {
+      path = argv[++i];
+    } else if (strcmp("-n", argv[i]) == 0) {
+      frames = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp("--format", argv[i]) == 0) {
+      format = argv[++i];
+      valid = strcmp(format, "pcap") == 0 || strcmp(format, "pcapng") == 0;
+    } else if (strcmp("--seed", argv[i]) == 0) {
+      seed = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp("--sources", argv[i]) == 0) {
+      options.sources = strtoul(argv[++i], nullptr, 10);
+      valid = options.sources > 0 && options.sources < (1 << 24) - 1;
+    } else if (strcmp("--mix", argv[i]) == 0) {
+      valid = parse_mix(argv[++i], options.weights);
+    } else if (strcmp("--sizes", argv[i]) == 0) {
+      valid = parse_sizes(argv[++i], options.sizes);
+    } else if (strcmp("--rate", argv[i]) == 0) {
+      rate = atof(argv[++i]);
+      valid = rate > 0;
+    } else if (strcmp("--mac", argv[i]) == 0) {
+      valid = ether_aton_r(argv[++i], (ether_addr *)options.mac) != nullptr;
+    } else if (strcmp("--ip", argv[i]) == 0) {
+      valid = inet_aton(argv[++i], (in_addr *)options.ip) != 0;
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid || !path) {
+    fprintf(stderr,
+            "Usage: %s -o <file> [-n <frames>] [--format pcap|pcapng] [--seed <n>] [--sources "
+            "<n>] [--mix <kind>=<weight>,...] [--sizes <bytes>,...] [--rate <frames per second>] "
+            "[--mac <mac address>] [--ip <ip address>]\n"
+            "Kinds: arp echo foreign vlan fragment malformed udp syn\n",
+            argv[0]);
+    return -1;
+  }
+  if (!format) {
+    size_t len = strlen(path);
+    format = len > 7 && strcmp(path + len - 7, ".pcapng") == 0 ? "pcapng" : "pcap";
+  }
+  bool pcapng = strcmp(format, "pcapng") == 0;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  Output output(fd);
+  Generator generator(options, seed);
+
+  // file header, timestamps in microseconds and Ethernet link type in both formats
+  if (pcapng) {
+    const uint32_t section[7] = {0x0a0d0d0a, 28, 0x1a2b3c4d, 1, 0xffffffff, 0xffffffff, 28};
+    const uint32_t interface[5] = {1, 20, 1, 65535, 20}; // link type 1, snap length
+    uint8_t *p = output.reserve(sizeof(section) + sizeof(interface));
+    memcpy(p, section, sizeof(section));
+    memcpy(p + sizeof(section), interface, sizeof(interface));
+    output.commit(sizeof(section) + sizeof(interface));
+  } else {
+    const uint32_t header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1};
+    uint8_t *p = output.reserve(sizeof(header));
+    memcpy(p, header, sizeof(header));
+    output.commit(sizeof(header));
+  }
+
+  const size_t record = pcapng ? 28 : 16;
+  double interval = 1e6 / rate;
+  for (uint64_t i = 0; i < frames; i++) {
+    uint8_t *p = output.reserve(record + MAX_FRAME + 4 + 4);
+    if (!p)
+      break;
+    size_t len = generator.next(p + record);
+    uint64_t us = START_SECONDS * 1000000 + (uint64_t)(i * interval);
+
+    if (pcapng) {
+      size_t padded = (len + 3) & ~(size_t)3;
+      uint32_t block = 28 + padded + 4;
+      const uint32_t header[7] = {6,        block,         0, (uint32_t)(us >> 32),
+                                  (uint32_t)us, (uint32_t)len, (uint32_t)len};
+      memcpy(p, header, sizeof(header));
+      memset(p + record + len, 0, padded - len);
+      memcpy(p + record + padded, &block, 4);
+      output.commit(block);
+    } else {
+      const uint32_t header[4] = {(uint32_t)(us / 1000000), (uint32_t)(us % 1000000),
+                                  (uint32_t)len, (uint32_t)len};
+      memcpy(p, header, sizeof(header));
+      output.commit(record + len);
+    }
+  }
+
+  if (!output.flush() || close(fd) != 0) {
+    fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
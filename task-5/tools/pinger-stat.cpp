@@ -0,0 +1,108 @@
+// Show the counters of a running pinger, summed over its stack instances.
+//
+//   pinger-stat [<pid>] [-i <seconds>] [-a]
+//
+// Without a pid the only running pinger is used. With -i the counters are shown again every
+// interval together with their rate, -a also shows values that are still zero. Gauges are shown
+// after the counters, without a rate.
+#include "counters.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+
+static bool running(long pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+
+// Find the pid of the only running pinger with a segment, 0 if there is none or several.
+static long find_pid() {
+  DIR *dir = opendir("/dev/shm");
+  if (!dir)
+    return 0;
+  long found = 0;
+  size_t count = 0;
+  while (dirent *entry = readdir(dir)) {
+    char *end;
+    if (strncmp(entry->d_name, "pinger.", 7) != 0)
+      continue;
+    long pid = strtol(entry->d_name + 7, &end, 10);
+    if (*end || pid <= 0 || !running(pid))
+      continue;
+    found = pid;
+    count++;
+    fprintf(stderr, "%s%ld", count > 1 ? ", " : "Running: ", pid);
+  }
+  closedir(dir);
+  if (count)
+    fprintf(stderr, "\n");
+  return count == 1 ? found : 0;
+}
+
+int main(int argc, char **argv) {
+  long pid = 0;
+  double interval = 0;
+  bool all = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp("-i", argv[i]) == 0 && i + 1 < argc) {
+      interval = atof(argv[++i]);
+    } else if (strcmp("-a", argv[i]) == 0) {
+      all = true;
+    } else if (argv[i][0] != '-' && !pid) {
+      pid = strtol(argv[i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: %s [<pid>] [-i <seconds>] [-a]\n", argv[0]);
+      return -1;
+    }
+  }
+
+  if (!pid && !(pid = find_pid())) {
+    fprintf(stderr, "No single running pinger found, pass its pid\n");
+    return -1;
+  }
+
+  auto segment = Counters::Segment::open(pid);
+  if (!segment) {
+    fprintf(stderr, "No counters of pinger %ld in /dev/shm (not running or other version)\n", pid);
+    return -1;
+  }
+
+  const Counters::Segment::Header &header = segment->header();
+  std::vector<uint64_t> previous(header.counters);
+  for (bool first = true;; first = false) {
+    printf("pinger %ld, %u instances\n", pid, header.blocks);
+    for (size_t i = 0; i < header.counters + header.gauges; i++) {
+      uint64_t value = segment->total(i);
+      if (i >= header.counters) {
+        if (value || all)
+          printf("  %-24s %16lu\n", segment->name(i), (unsigned long)value);
+        continue;
+      }
+      if (value || all) {
+        if (interval > 0 && !first)
+          printf("  %-24s %16lu %14.0f/s\n", segment->name(i), (unsigned long)value,
+                 (value - previous[i]) / interval);
+        else
+          printf("  %-24s %16lu\n", segment->name(i), (unsigned long)value);
+      }
+      previous[i] = value;
+    }
+
+    if (interval <= 0)
+      break;
+    fflush(stdout);
+    usleep(interval * 1000000);
+    if (!running(pid)) {
+      fprintf(stderr, "pinger %ld exited\n", pid);
+      break;
+    }
+    printf("\n");
+  }
+  return 0;
+}